@@ -0,0 +1,60 @@
+/******************************************************************************
+ * Filename: arena.cpp
+ * Author: Zachary Colbert
+ * Contact: zcolbert@sfsu.edu
+ *
+ * Description:
+ *      Implementation of the bump allocator.
+ *****************************************************************************/
+
+#include "arena.h"
+
+#include <algorithm>
+#include <cstdint>
+
+
+/**
+ * @param block_size The size of each block, in bytes. Larger allocations get a block of their own.
+ */
+Arena::Arena(size_t block_size)
+    : block_size(block_size)
+{
+}
+
+/** Free every block at once, invalidating all allocations. */
+void Arena::release()
+{
+    block_list.clear();
+    next = nullptr;
+    remaining = 0;
+    reserved_bytes = 0;
+    used_bytes = 0;
+}
+
+/**
+ * Allocate from the current block, starting a new block if it does not have room.
+ *
+ * @param bytes The size of the allocation.
+ * @param align The alignment of the allocation, a power of two.
+ * @return A pointer to the allocation.
+ */
+void* Arena::allocateBytes(size_t bytes, size_t align)
+{
+    size_t padding = (align - reinterpret_cast<uintptr_t>(next) % align) % align;
+    if (next == nullptr || padding + bytes > remaining)
+    {
+        // new[] of char is aligned for any fundamental type
+        const size_t size = std::max(block_size, bytes);
+        block_list.emplace_back(new char[size]);
+        next = block_list.back().get();
+        remaining = size;
+        reserved_bytes += size;
+        padding = 0;
+    }
+
+    char* result = next + padding;
+    next = result + bytes;
+    remaining -= padding + bytes;
+    used_bytes += bytes;
+    return result;
+}
@@ -0,0 +1,72 @@
+/******************************************************************************
+ * Filename: arena.h
+ * Author: Zachary Colbert
+ * Contact: zcolbert@sfsu.edu
+ *
+ * Description:
+ *      Interface of a bump allocator, which hands out memory from large
+ *      blocks and releases all of it in one operation.
+ *****************************************************************************/
+
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+
+/**
+ * Allocates from a list of large blocks by advancing a pointer, so each allocation
+ * costs a few instructions and needs no bookkeeping of its own. Memory is only
+ * returned all at once, by release() or destruction.
+ *
+ * Destructors are never run, so the arena should only hold trivially destructible types.
+ */
+class Arena
+{
+public:
+    /** The default size of each block, in bytes. */
+    static constexpr size_t default_block_size = size_t(1) << 20;
+
+    /**
+     * @param block_size The size of each block, in bytes. Larger allocations get a block of their own.
+     */
+    explicit Arena(size_t block_size = default_block_size);
+
+    Arena(Arena&&) = default;
+    Arena& operator=(Arena&&) = default;
+
+    /**
+     * Allocate uninitialized, suitably aligned storage for an array.
+     *
+     * @param count The number of elements.
+     * @return A pointer to the first element, valid until the arena is released.
+     */
+    template <typename T>
+    T* allocate(size_t count)
+    {
+        return static_cast<T*>(allocateBytes(count * sizeof(T), alignof(T)));
+    }
+
+    /** Free every block at once, invalidating all allocations. */
+    void release();
+
+    /** @return The number of blocks obtained from the system allocator. */
+    size_t blocks() const { return block_list.size(); }
+
+    /** @return The total size of the blocks, in bytes. */
+    size_t reserved() const { return reserved_bytes; }
+
+    /** @return The number of bytes handed out, excluding alignment padding. */
+    size_t used() const { return used_bytes; }
+
+private:
+    void* allocateBytes(size_t bytes, size_t align);
+
+    size_t block_size;
+    std::vector<std::unique_ptr<char[]>> block_list;
+    char* next = nullptr;
+    size_t remaining = 0;
+    size_t reserved_bytes = 0;
+    size_t used_bytes = 0;
+};
@@ -0,0 +1,282 @@
+/******************************************************************************
+ * Filename: autotune.cpp
+ * Author: Zachary Colbert
+ * Contact: zcolbert@sfsu.edu
+ *
+ * Description: Implementation of the matrix multiply autotuner and the
+ *              tuning cache.
+ *****************************************************************************/
+
+#include "autotune.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>   // rename
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <utility>
+#include <unistd.h> // gethostname
+#include <omp.h>
+
+#include "gemm.h"
+#include "linear.h"
+
+
+// Loop orders in the order they are tried, so ties go to the simpler kernel
+static const std::vector<std::pair<std::string, MultiplyKernel>> multiply_kernels = {
+        {"ijk", &matrixMultiply_ijk},
+        {"ikj", &matrixMultiply_ikj},
+        {"jik", &matrixMultiply_jik},
+        {"jki", &matrixMultiply_jki},
+        {"kij", &matrixMultiply_kij},
+        {"kji", &matrixMultiply_kji},
+        {"simd", &matrixMultiply_simd},
+};
+
+// A candidate slower than this multiple of the best time is not repeated
+static const double trial_cutoff = 4.0;
+static const int trial_reps = 2;
+
+
+/**
+ * Look up the multiply function for a loop order accepted by --mmloop.
+ *
+ * @param mmloop The loop order: one of ijk, ikj, jik, jki, kij, kji or simd.
+ * @return The function, or nullptr if the loop order is unknown.
+ */
+MultiplyKernel findMultiplyKernel(const std::string& mmloop)
+{
+    for (const auto& kernel: multiply_kernels)
+    {
+        if (kernel.first == mmloop) {
+            return kernel.second;
+        }
+    }
+    return nullptr;
+}
+
+/**
+ * Time a single multiply with the given configuration.
+ *
+ * @param config The configuration to run. The thread count must already be set.
+ * @param lhs The left-hand operand matrix, with dimensions N x M.
+ * @param rhs The right-hand operand matrix, with dimensions M x N.
+ * @param result The N x N result matrix, cleared before the multiply.
+ * @param n The number of rows in the left matrix, columns in the right matrix.
+ * @param m The number of columns in the left matrix, rows in the right matrix.
+ * @return The elapsed time in seconds.
+ */
+static double timeMultiply(const TuningConfig& config, const std::vector<float>& lhs, const std::vector<float>& rhs,
+                           std::vector<float>& result, size_t n, size_t m)
+{
+    MultiplyKernel mmfunc = findMultiplyKernel(config.mmloop);
+    std::fill(result.begin(), result.end(), 0.0f);
+
+    auto start_time = std::chrono::high_resolution_clock::now();
+    if (config.blocksize > 0) {
+        matrixMultiply_bco(mmfunc, lhs, rhs, result, n, m, config.blocksize);
+    } else {
+        mmfunc(lhs, rhs, result, n, m);
+    }
+    auto end_time = std::chrono::high_resolution_clock::now();
+
+    std::chrono::duration<double> elapsed = end_time - start_time;
+    return elapsed.count();
+}
+
+/**
+ * Time every candidate configuration on a trial multiply of the leading rows and
+ * columns of the operands, and return the fastest.
+ *
+ * Candidates are each loop order, block sizes from 16 up to the trial size (and no
+ * blocking), and thread counts doubling from 1 up to omp_get_max_threads().
+ * The trial is at most trial_rows x trial_cols, so tuning takes a fraction of
+ * the time of the full multiply while still seeing the same cache behaviour.
+ *
+ * @param lhs The left-hand operand matrix, with dimensions N x M.
+ * @param rhs The right-hand operand matrix, with dimensions M x N.
+ * @param n The number of rows in the left matrix, columns in the right matrix.
+ * @param m The number of columns in the left matrix, rows in the right matrix.
+ * @param trial_rows The largest number of rows (N) of the trial multiply.
+ * @param trial_cols The largest number of columns (M) of the trial multiply.
+ * @param verbose Print the time of each candidate to stderr.
+ * @return The fastest configuration.
+ */
+TuningConfig autotune(const std::vector<float>& lhs, const std::vector<float>& rhs, size_t n, size_t m,
+                      size_t trial_rows, size_t trial_cols, bool verbose)
+{
+    const size_t tn = std::min(n, trial_rows);
+    const size_t tm = std::min(m, trial_cols);
+
+    // Copy the leading tn x tm block of lhs and the matching tm x tn block of rhs
+    std::vector<float> trial_lhs(tn * tm);
+    std::vector<float> trial_rhs(tm * tn);
+    for (size_t i = 0; i < tn; ++i) {
+        std::copy_n(&lhs[i * m], tm, &trial_lhs[i * tm]);
+    }
+    for (size_t k = 0; k < tm; ++k) {
+        std::copy_n(&rhs[k * n], tn, &trial_rhs[k * tn]);
+    }
+    std::vector<float> trial_result(tn * tn);
+
+    std::vector<size_t> block_sizes = {0};
+    for (size_t bs = 16; bs <= tn; bs *= 2) {
+        block_sizes.push_back(bs);
+    }
+
+    const int max_threads = omp_get_max_threads();
+    std::vector<int> thread_counts;
+    for (int t = 1; t < max_threads; t *= 2) {
+        thread_counts.push_back(t);
+    }
+    thread_counts.push_back(max_threads);
+
+    TuningConfig best;
+    best.seconds = -1.0;
+
+    for (int threads: thread_counts)
+    {
+        omp_set_num_threads(threads);
+        for (const auto& kernel: multiply_kernels)
+        {
+            for (size_t bs: block_sizes)
+            {
+                TuningConfig config;
+                config.mmloop = kernel.first;
+                config.blocksize = bs;
+                config.threads = threads;
+
+                // Take the best of a few repetitions, but give up early on hopeless candidates
+                config.seconds = timeMultiply(config, trial_lhs, trial_rhs, trial_result, tn, tm);
+                for (int rep = 1; rep < trial_reps; ++rep)
+                {
+                    if (best.seconds >= 0.0 && config.seconds > trial_cutoff * best.seconds) {
+                        break;
+                    }
+                    config.seconds = std::min(config.seconds,
+                                              timeMultiply(config, trial_lhs, trial_rhs, trial_result, tn, tm));
+                }
+
+                if (verbose) {
+                    std::cerr << "autotune: mmloop=" << config.mmloop << " bco=" << config.blocksize
+                              << " threads=" << config.threads << " " << config.seconds << " s" << std::endl;
+                }
+                if (best.seconds < 0.0 || config.seconds < best.seconds) {
+                    best = config;
+                }
+            }
+        }
+    }
+
+    omp_set_num_threads(max_threads);
+    return best;
+}
+
+/**
+ * Get the key under which a tuned configuration is cached: the host name,
+ * the matrix shape and the number of threads available to the program.
+ *
+ * @param n The number of rows of the matrix.
+ * @param m The number of columns of the matrix.
+ * @return The cache key.
+ */
+std::string tuningKey(size_t n, size_t m)
+{
+    char host[256] = {0};
+    if (gethostname(host, sizeof(host) - 1) != 0 || host[0] == '\0') {
+        std::snprintf(host, sizeof(host), "unknown");
+    }
+
+    std::ostringstream key;
+    key << host << ':' << n << 'x' << m << ":t" << omp_get_max_threads();
+    return key.str();
+}
+
+/**
+ * Read every entry of the tuning cache. Each line holds a key followed by the
+ * loop order, block size, thread count and trial time; '#' starts a comment.
+ *
+ * @param path The tuning cache file.
+ * @return The key and configuration of each entry, in file order.
+ */
+static std::vector<std::pair<std::string, TuningConfig>> readTuningCache(const std::string& path)
+{
+    std::vector<std::pair<std::string, TuningConfig>> entries;
+    std::ifstream infile(path);
+    std::string line;
+
+    while (std::getline(infile, line))
+    {
+        if (line.empty() || line[0] == '#') {
+            continue;
+        }
+        std::istringstream fields(line);
+        std::string key;
+        TuningConfig config;
+        if (fields >> key >> config.mmloop >> config.blocksize >> config.threads >> config.seconds
+                && findMultiplyKernel(config.mmloop) != nullptr && config.threads > 0) {
+            entries.emplace_back(key, config);
+        }
+    }
+    return entries;
+}
+
+/**
+ * Read a configuration from the tuning cache.
+ *
+ * @param path The tuning cache file. A missing file is treated as empty.
+ * @param key The key returned by tuningKey().
+ * @param config Receives the configuration when one is found.
+ * @return True if the cache holds a configuration for the key.
+ */
+bool loadTuning(const std::string& path, const std::string& key, TuningConfig& config)
+{
+    for (const auto& entry: readTuningCache(path))
+    {
+        if (entry.first == key) {
+            config = entry.second;
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * Store a configuration in the tuning cache, replacing any previous entry with the same key.
+ *
+ * @param path The tuning cache file, created if it does not exist.
+ * @param key The key returned by tuningKey().
+ * @param config The configuration to store.
+ * @return False if the cache could not be written.
+ */
+bool saveTuning(const std::string& path, const std::string& key, const TuningConfig& config)
+{
+    auto entries = readTuningCache(path);
+    auto it = std::find_if(entries.begin(), entries.end(),
+                           [&key](const std::pair<std::string, TuningConfig>& entry) { return entry.first == key; });
+    if (it != entries.end()) {
+        it->second = config;
+    } else {
+        entries.emplace_back(key, config);
+    }
+
+    // Write a complete copy and rename it over the cache, so a concurrent reader never sees half a file
+    const std::string tmp_path = path + ".tmp";
+    {
+        std::ofstream outfile(tmp_path, std::ios::trunc);
+        if (!outfile) {
+            return false;
+        }
+        outfile << "# host:<rows>x<cols>:t<max threads> mmloop bco threads seconds" << std::endl;
+        for (const auto& entry: entries)
+        {
+            outfile << entry.first << ' ' << entry.second.mmloop << ' ' << entry.second.blocksize << ' '
+                    << entry.second.threads << ' ' << entry.second.seconds << std::endl;
+        }
+        if (!outfile) {
+            return false;
+        }
+    }
+    return std::rename(tmp_path.c_str(), path.c_str()) == 0;
+}
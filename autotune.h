@@ -0,0 +1,87 @@
+/******************************************************************************
+ * Filename: autotune.h
+ * Author: Zachary Colbert
+ * Contact: zcolbert@sfsu.edu
+ *
+ * Description: Interface of the matrix multiply autotuner, which times short
+ *              trial multiplies to choose a loop order, block size and thread
+ *              count, and of the tuning cache which remembers the choice for
+ *              each host and matrix shape.
+ *****************************************************************************/
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+
+/** A matrix multiply with the interface of the matrixMultiply_<order> functions. */
+typedef void (*MultiplyKernel)(const std::vector<float>&, const std::vector<float>&, std::vector<float>&, size_t, size_t);
+
+/** A configuration of the dense matrix multiply. */
+struct TuningConfig
+{
+    std::string mmloop;     // Loop order as given to --mmloop
+    size_t blocksize = 0;   // Block size as given to --bco, or 0 without block copy
+    int threads = 1;        // Number of OpenMP threads
+    double seconds = 0.0;   // Best trial time of this configuration
+};
+
+/**
+ * Look up the multiply function for a loop order accepted by --mmloop.
+ *
+ * @param mmloop The loop order: one of ijk, ikj, jik, jki, kij, kji or simd.
+ * @return The function, or nullptr if the loop order is unknown.
+ */
+MultiplyKernel findMultiplyKernel(const std::string& mmloop);
+
+/**
+ * Time every candidate configuration on a trial multiply of the leading rows and
+ * columns of the operands, and return the fastest.
+ *
+ * Candidates are each loop order, block sizes from 16 up to the trial size (and no
+ * blocking), and thread counts doubling from 1 up to omp_get_max_threads().
+ * The trial is at most trial_rows x trial_cols, so tuning takes a fraction of
+ * the time of the full multiply while still seeing the same cache behaviour.
+ *
+ * @param lhs The left-hand operand matrix, with dimensions N x M.
+ * @param rhs The right-hand operand matrix, with dimensions M x N.
+ * @param n The number of rows in the left matrix, columns in the right matrix.
+ * @param m The number of columns in the left matrix, rows in the right matrix.
+ * @param trial_rows The largest number of rows (N) of the trial multiply.
+ * @param trial_cols The largest number of columns (M) of the trial multiply.
+ * @param verbose Print the time of each candidate to stderr.
+ * @return The fastest configuration.
+ */
+TuningConfig autotune(const std::vector<float>& lhs, const std::vector<float>& rhs, size_t n, size_t m,
+                      size_t trial_rows, size_t trial_cols, bool verbose);
+
+/**
+ * Get the key under which a tuned configuration is cached: the host name,
+ * the matrix shape and the number of threads available to the program.
+ *
+ * @param n The number of rows of the matrix.
+ * @param m The number of columns of the matrix.
+ * @return The cache key.
+ */
+std::string tuningKey(size_t n, size_t m);
+
+/**
+ * Read a configuration from the tuning cache.
+ *
+ * @param path The tuning cache file. A missing file is treated as empty.
+ * @param key The key returned by tuningKey().
+ * @param config Receives the configuration when one is found.
+ * @return True if the cache holds a configuration for the key.
+ */
+bool loadTuning(const std::string& path, const std::string& key, TuningConfig& config);
+
+/**
+ * Store a configuration in the tuning cache, replacing any previous entry with the same key.
+ *
+ * @param path The tuning cache file, created if it does not exist.
+ * @param key The key returned by tuningKey().
+ * @param config The configuration to store.
+ * @return False if the cache could not be written.
+ */
+bool saveTuning(const std::string& path, const std::string& key, const TuningConfig& config);
@@ -0,0 +1,408 @@
+/******************************************************************************
+ * Program: lts_bench
+ * Author: Zachary Colbert
+ * Contact: zcolbert@sfsu.edu
+ *
+ * Description: Microbenchmarks each stage of the similarity pipeline
+ *              separately, with warm-up runs and repetitions, and writes the
+ *              timings as CSV tables in the layout of likwid-perfctr reports
+ *              so scripts/likwidcsv.py and buildreport.py can read them.
+ *
+ * Usage: lts_bench --data <path> [--count N] [--reps R] [--warmup W]
+ *                  [--bco B] [--stages a,b,...] [--output file.csv]
+ *****************************************************************************/
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <functional>
+#include <getopt.h>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <omp.h>
+
+#include "../autotune.h"
+#include "../linear.h"
+#include "../mapped_file.h"
+#include "../sparse.h"
+#include "../tokenize.h"
+
+
+/** The timings of one benchmarked stage. */
+struct StageResult
+{
+    std::string name;
+    std::vector<double> seconds;    // One entry per timed repetition
+    double work = 0.0;              // Units of work per repetition, for the throughput metric
+    std::string work_unit;          // Name of the throughput metric, e.g. "MFLOP/s"
+};
+
+/** Summary statistics of a set of repetitions. */
+struct Summary
+{
+    double sum = 0.0;
+    double min = 0.0;
+    double max = 0.0;
+    double avg = 0.0;
+    double median = 0.0;
+    double stddev = 0.0;
+};
+
+/**
+ * Compute the summary statistics of a set of timings.
+ *
+ * @param values The timings. Must not be empty.
+ * @return The sum, extremes, mean, median and sample standard deviation.
+ */
+Summary summarize(std::vector<double> values)
+{
+    Summary s;
+    std::sort(values.begin(), values.end());
+    for (double v: values) {
+        s.sum += v;
+    }
+    s.min = values.front();
+    s.max = values.back();
+    s.avg = s.sum / values.size();
+
+    size_t mid = values.size() / 2;
+    s.median = (values.size() % 2) ? values[mid] : (values[mid - 1] + values[mid]) / 2.0;
+
+    double sq = 0.0;
+    for (double v: values) {
+        sq += (v - s.avg) * (v - s.avg);
+    }
+    s.stddev = values.size() > 1 ? std::sqrt(sq / (values.size() - 1)) : 0.0;
+    return s;
+}
+
+/**
+ * Run a stage for a number of untimed warm-up runs followed by timed repetitions.
+ * The setup function runs before every repetition and is not timed, so stages
+ * which modify their input can start from the same state each time.
+ *
+ * @param name The stage name reported in the CSV.
+ * @param warmup The number of untimed runs.
+ * @param reps The number of timed runs.
+ * @param setup Prepares the input of the next run.
+ * @param run The stage being measured.
+ * @return The timings of each repetition.
+ */
+StageResult runStage(const std::string& name, int warmup, int reps,
+                     const std::function<void()>& setup, const std::function<void()>& run)
+{
+    StageResult result;
+    result.name = name;
+
+    std::cerr << "Running " << name << " " << std::flush;
+    for (int r = 0; r < warmup + reps; ++r)
+    {
+        setup();
+        auto start = std::chrono::high_resolution_clock::now();
+        run();
+        std::chrono::duration<double> elapsed = std::chrono::high_resolution_clock::now() - start;
+        if (r >= warmup) {
+            result.seconds.push_back(elapsed.count());
+        }
+    }
+    std::cerr << "(median " << summarize(result.seconds).median << " s)" << std::endl;
+    return result;
+}
+
+/**
+ * Read a field of /proc/cpuinfo for the first processor.
+ *
+ * @param field The field name, e.g. "model name".
+ * @return The field value, or "unknown".
+ */
+std::string cpuInfo(const std::string& field)
+{
+    std::ifstream infile("/proc/cpuinfo");
+    std::string line;
+    while (std::getline(infile, line))
+    {
+        if (line.rfind(field, 0) == 0)
+        {
+            size_t colon = line.find(':');
+            if (colon != std::string::npos && colon + 2 <= line.size()) {
+                return line.substr(colon + 2);
+            }
+        }
+    }
+    return "unknown";
+}
+
+/**
+ * Write the results in the layout of a likwid-perfctr CSV report: an Info section
+ * followed by the raw table (one column per repetition), its statistics table,
+ * and a metric statistics table with the runtime and throughput of each stage.
+ * The statistics tables add Median and Stddev columns after likwid's Sum, Min, Max, Avg.
+ *
+ * @param out The output stream.
+ * @param results The benchmarked stages.
+ * @param reps The number of repetitions of each stage.
+ */
+void writeLikwidCsv(std::ostream& out, const std::vector<StageResult>& results, int reps)
+{
+    const std::string group = "BENCH";
+    const int width = std::max(reps + 2, 8);
+    auto pad = [&](int used) { return std::string(std::max(0, width - used), ','); };
+
+    out << "STRUCT,Info,4" << pad(3) << "\n";
+    out << "CPU name:," << cpuInfo("model name") << pad(2) << "\n";
+    out << "CPU clock:," << cpuInfo("cpu MHz") << " MHz" << pad(2) << "\n";
+    out << "Threads:," << omp_get_max_threads() << pad(2) << "\n";
+    out << "Repetitions:," << reps << pad(2) << "\n";
+
+    out << "TABLE,Group 1 Raw," << group << "," << results.size() << pad(4) << "\n";
+    out << "Event,Counter";
+    for (int r = 0; r < reps; ++r) {
+        out << ",Rep " << r;
+    }
+    out << pad(reps + 2) << "\n";
+    for (const auto& result: results)
+    {
+        out << result.name << ",TIME";
+        for (double s: result.seconds) {
+            out << "," << s;
+        }
+        out << pad(reps + 2) << "\n";
+    }
+
+    out << "TABLE,Group 1 Raw STAT," << group << "," << results.size() << pad(4) << "\n";
+    out << "Event,Counter,Sum,Min,Max,Avg,Median,Stddev" << pad(8) << "\n";
+    for (const auto& result: results)
+    {
+        Summary s = summarize(result.seconds);
+        out << result.name << " STAT,TIME," << s.sum << "," << s.min << "," << s.max << ","
+            << s.avg << "," << s.median << "," << s.stddev << pad(8) << "\n";
+    }
+
+    // Throughput statistics are derived from the runtimes: the fastest run gives the maximum rate
+    out << "TABLE,Group 1 Metric STAT," << group << "," << 2 * results.size() << pad(4) << "\n";
+    out << "Metric,Sum,Min,Max,Avg,Median,Stddev" << pad(7) << "\n";
+    for (const auto& result: results)
+    {
+        Summary s = summarize(result.seconds);
+        out << result.name << " runtime [s] STAT," << s.sum << "," << s.min << "," << s.max << ","
+            << s.avg << "," << s.median << "," << s.stddev << pad(7) << "\n";
+
+        std::vector<double> rates;
+        for (double sec: result.seconds) {
+            rates.push_back(sec > 0.0 ? result.work / sec : 0.0);
+        }
+        Summary r = summarize(rates);
+        out << result.name << " " << result.work_unit << " STAT," << r.sum << "," << r.min << "," << r.max << ","
+            << r.avg << "," << r.median << "," << r.stddev << pad(7) << "\n";
+    }
+}
+
+/**
+ * Split a comma-separated list.
+ */
+std::vector<std::string> splitList(const std::string& list)
+{
+    std::vector<std::string> items;
+    std::stringstream ss(list);
+    std::string item;
+    while (std::getline(ss, item, ',')) {
+        if (!item.empty()) {
+            items.push_back(item);
+        }
+    }
+    return items;
+}
+
+int main(int argc, char* argv[])
+{
+    std::string datafile;
+    std::string outpath;
+    size_t data_count = 1000;
+    size_t blocksize = 0;
+    int reps = 5;
+    int warmup = 1;
+    const short ngram_len = 2;
+
+    // Every stage of the pipeline, in pipeline order
+    std::vector<std::string> stages = {
+            "tokenize", "tokenizeFile", "extractUniqueKeys", "getTermFrequencyMatrix", "normalizeMatrix",
+            "transpose", "ijk", "ikj", "jik", "jki", "kij", "kji", "simd", "syrk", "sparse"
+    };
+
+    static struct option long_options[] = {
+            {"data", required_argument, NULL, 0 },
+            {"count", required_argument, NULL, 0 },
+            {"reps", required_argument, NULL, 0 },
+            {"warmup", required_argument, NULL, 0 },
+            {"bco", required_argument, NULL, 0 },
+            {"stages", required_argument, NULL, 0 },
+            {"output", required_argument, NULL, 0 },
+            {NULL, 0, NULL, 0 }
+    };
+
+    std::string opt_name;
+    std::string opt_val;
+    int opt_idx = 0;
+    while (getopt_long(argc, argv, "", long_options, &opt_idx) >= 0)
+    {
+        opt_name = long_options[opt_idx].name;
+        opt_val = optarg ? optarg : "";
+
+        if (opt_name == "data") {
+            datafile = opt_val;
+        } else if (opt_name == "count") {
+            data_count = stoull(opt_val);
+        } else if (opt_name == "reps") {
+            reps = std::max(1, std::stoi(opt_val));
+        } else if (opt_name == "warmup") {
+            warmup = std::max(0, std::stoi(opt_val));
+        } else if (opt_name == "bco") {
+            blocksize = stoull(opt_val);
+        } else if (opt_name == "stages") {
+            stages = splitList(opt_val);
+        } else if (opt_name == "output") {
+            outpath = opt_val;
+        }
+    }
+
+    if (datafile.empty()) {
+        std::cout << "Usage: " << argv[0] << " --data <path> [--count N] [--reps R] [--warmup W]"
+                  << " [--bco B] [--stages a,b,...] [--output file.csv]" << std::endl;
+        return 1;
+    }
+
+    // Build the input of every stage once, untimed, so each stage can be measured on its own
+    MappedFile file(datafile);
+    std::vector<std::string_view> lines = splitLines(file.view(), data_count);
+    size_t bytes = 0;
+    for (auto line: lines) {
+        bytes += line.size();
+    }
+
+    TokenDictionary dictionary(ngram_len);
+    DocumentTokenCounts docs = tokenizeFile(datafile, ngram_len, data_count, true, dictionary);
+    std::vector<uint32_t> vocabulary = extractUniqueKeys(docs);
+    const size_t rows = docs.size();
+    const size_t cols = vocabulary.size();
+    if (rows == 0 || cols == 0) {
+        std::cout << "No documents read from " << datafile << std::endl;
+        return 1;
+    }
+
+    std::vector<float> tf = getTermFrequencyMatrix(docs, vocabulary, rows, cols);
+    std::vector<float> matrix = tf;
+    normalizeMatrix(matrix, rows, cols);
+    std::vector<float> m_T = transpose(matrix, rows, cols);
+    CsrMatrix sparse_matrix = getSparseTermFrequencyMatrix(docs, vocabulary);
+    normalizeSparseMatrix(sparse_matrix);
+
+    std::cerr << rows << " documents, " << cols << " columns, " << bytes << " bytes" << std::endl;
+
+    const double flops = 2.0 * rows * rows * cols;
+    const double megabytes = bytes / 1e6;
+    std::vector<float> scratch;
+    std::vector<float> result(rows * rows);
+    auto nothing = []() {};
+    auto clearResult = [&]() { std::fill(result.begin(), result.end(), 0.0f); };
+
+    std::vector<StageResult> results;
+    for (const auto& stage: stages)
+    {
+        StageResult r;
+        if (stage == "tokenize")
+        {
+            r = runStage(stage, warmup, reps, nothing, [&]() {
+                TokenDictionary dict(ngram_len);
+                for (auto line: lines) {
+                    tokenize(line, ngram_len, true, dict);
+                }
+            });
+            r.work = megabytes;
+            r.work_unit = "MB/s";
+        }
+        else if (stage == "tokenizeFile")
+        {
+            r = runStage(stage, warmup, reps, nothing, [&]() {
+                TokenDictionary dict(ngram_len);
+                tokenizeFile(datafile, ngram_len, data_count, true, dict);
+            });
+            r.work = megabytes;
+            r.work_unit = "MB/s";
+        }
+        else if (stage == "extractUniqueKeys")
+        {
+            r = runStage(stage, warmup, reps, nothing, [&]() { extractUniqueKeys(docs); });
+            r.work = rows / 1e3;
+            r.work_unit = "kdocs/s";
+        }
+        else if (stage == "getTermFrequencyMatrix")
+        {
+            r = runStage(stage, warmup, reps, nothing, [&]() {
+                scratch = getTermFrequencyMatrix(docs, vocabulary, rows, cols);
+            });
+            r.work = rows / 1e3;
+            r.work_unit = "kdocs/s";
+        }
+        else if (stage == "normalizeMatrix")
+        {
+            r = runStage(stage, warmup, reps, [&]() { scratch = tf; }, [&]() {
+                normalizeMatrix(scratch, rows, cols);
+            });
+            r.work = rows * cols * 4 / 1e6;
+            r.work_unit = "MB/s";
+        }
+        else if (stage == "transpose")
+        {
+            r = runStage(stage, warmup, reps, nothing, [&]() { scratch = transpose(matrix, rows, cols); });
+            r.work = rows * cols * 4 / 1e6;
+            r.work_unit = "MB/s";
+        }
+        else if (findMultiplyKernel(stage) != nullptr)
+        {
+            MultiplyKernel mmfunc = findMultiplyKernel(stage);
+            std::string name = blocksize > 0 ? stage + "_bco_" + std::to_string(blocksize) : stage;
+            r = runStage(name, warmup, reps, clearResult, [&]() {
+                if (blocksize > 0) {
+                    matrixMultiply_bco(mmfunc, matrix, m_T, result, rows, cols, blocksize);
+                } else {
+                    mmfunc(matrix, m_T, result, rows, cols);
+                }
+            });
+            r.work = flops / 1e6;
+            r.work_unit = "MFLOP/s";
+        }
+        else if (stage == "syrk")
+        {
+            r = runStage(stage, warmup, reps, clearResult, [&]() {
+                matrixSelfMultiply(matrix, result, rows, cols, true);
+            });
+            r.work = flops / 1e6;
+            r.work_unit = "MFLOP/s";
+        }
+        else if (stage == "sparse")
+        {
+            r = runStage(stage, warmup, reps, clearResult, [&]() {
+                sparseMultiplyTranspose(sparse_matrix, sparse_matrix, result);
+            });
+            // Dense-equivalent rate, so it can be compared against the dense kernels
+            r.work = flops / 1e6;
+            r.work_unit = "MFLOP/s";
+        }
+        else {
+            std::cerr << "Unknown stage '" << stage << "'. Skipping." << std::endl;
+            continue;
+        }
+        results.push_back(r);
+    }
+
+    if (outpath.empty()) {
+        writeLikwidCsv(std::cout, results, reps);
+    } else {
+        std::ofstream outfile(outpath);
+        writeLikwidCsv(outfile, results, reps);
+    }
+    return 0;
+}
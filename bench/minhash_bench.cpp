@@ -0,0 +1,157 @@
+/******************************************************************************
+ * Program: minhash_bench
+ * Author: Zachary Colbert
+ * Contact: zcolbert@sfsu.edu
+ *
+ * Description: Measures the throughput of the MinHash/LSH near-duplicate
+ *              search over a synthetic corpus with planted near-duplicates.
+ *
+ *              Each document is a run of words drawn from a skewed random
+ *              vocabulary. Every 100th document is a copy of an earlier
+ *              document with a fraction of its words replaced. The report
+ *              gives the time and documents per second of each stage, the
+ *              candidate count, and the recall of the planted pairs whose
+ *              exact similarity reaches the threshold.
+ *
+ * Usage: minhash_bench [documents] [bands] [rows] [threshold] [mutation]
+ *****************************************************************************/
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "../minhash.h"
+
+
+/**
+ * Time a single call of a function.
+ *
+ * @param fn The function to call.
+ * @return The elapsed time, in seconds.
+ */
+template <typename Fn>
+double timeOnce(Fn fn)
+{
+    auto start = std::chrono::high_resolution_clock::now();
+    fn();
+    std::chrono::duration<double> elapsed = std::chrono::high_resolution_clock::now() - start;
+    return elapsed.count();
+}
+
+int main(int argc, char* argv[])
+{
+    const size_t doc_count = argc > 1 ? std::stoull(argv[1]) : 1000000;
+    LshParams params;
+    params.bands = argc > 2 ? std::stoull(argv[2]) : params.bands;
+    params.rows = argc > 3 ? std::stoull(argv[3]) : params.rows;
+    params.threshold = argc > 4 ? std::stof(argv[4]) : params.threshold;
+    const double mutation = argc > 5 ? std::stod(argv[5]) : 0.05;
+    const size_t ngram_len = 2;
+    const size_t words_per_doc = 50;
+    const size_t vocabulary_size = 20000;
+    const size_t duplicate_every = 100;
+
+    // Random lowercase words of 2 to 9 letters, drawn with a Zipf-like skew
+    std::mt19937_64 rng(1);
+    std::vector<std::string> vocabulary(vocabulary_size);
+    for (auto& word: vocabulary)
+    {
+        word.resize(2 + rng() % 8);
+        for (auto& c: word) {
+            c = static_cast<char>('a' + rng() % 26);
+        }
+    }
+    std::vector<double> weights(vocabulary_size);
+    for (size_t i = 0; i < vocabulary_size; ++i) {
+        weights[i] = 1.0 / (i + 1);
+    }
+    std::discrete_distribution<size_t> pick(weights.begin(), weights.end());
+
+    // Generate the word sequence of each document; every 100th copies an earlier one
+    std::vector<std::vector<uint32_t>> doc_words(doc_count);
+    std::vector<std::pair<uint32_t, uint32_t>> planted;
+    for (size_t d = 0; d < doc_count; ++d)
+    {
+        auto& words = doc_words[d];
+        if (d > 0 && d % duplicate_every == 0)
+        {
+            const size_t source = rng() % d;
+            words = doc_words[source];
+            for (auto& w: words) {
+                if (std::uniform_real_distribution<double>(0.0, 1.0)(rng) < mutation) {
+                    w = static_cast<uint32_t>(pick(rng));
+                }
+            }
+            planted.emplace_back(static_cast<uint32_t>(source), static_cast<uint32_t>(d));
+        }
+        else
+        {
+            words.resize(words_per_doc);
+            for (auto& w: words) {
+                w = static_cast<uint32_t>(pick(rng));
+            }
+        }
+    }
+
+    // Lay the documents out in one buffer, as the mapped input file would be
+    std::string text;
+    std::vector<size_t> offsets(doc_count + 1, 0);
+    for (size_t d = 0; d < doc_count; ++d)
+    {
+        for (uint32_t w: doc_words[d]) {
+            text += vocabulary[w];
+            text += ' ';
+        }
+        text.back() = '\n';
+        offsets[d + 1] = text.size();
+    }
+    doc_words = {};
+    std::vector<std::string_view> docs(doc_count);
+    for (size_t d = 0; d < doc_count; ++d) {
+        docs[d] = std::string_view(text.data() + offsets[d], offsets[d + 1] - offsets[d] - 1);
+    }
+
+    std::cout << doc_count << " documents, " << std::fixed << std::setprecision(1)
+              << static_cast<double>(text.size()) / doc_count << " bytes each, "
+              << planted.size() << " planted near-duplicates" << std::endl;
+    std::cout << "bands=" << params.bands << " rows=" << params.rows << " shingle=" << params.shingle_len
+              << " threshold=" << std::setprecision(2) << params.threshold << std::endl;
+
+    std::vector<uint32_t> signatures;
+    std::vector<std::pair<uint32_t, uint32_t>> candidates;
+    std::vector<SimilarPair> pairs;
+    const double t_sign = timeOnce([&]() { signatures = minhashSignatures(docs, params); });
+    const double t_band = timeOnce([&]() { candidates = lshCandidates(signatures, doc_count, params); });
+    const double t_verify = timeOnce([&]() {
+        pairs = verifyCandidates(docs, candidates, ngram_len, true, params.threshold);
+    });
+
+    std::cout << std::left << std::setw(12) << "Stage" << std::right << std::setw(12) << "Seconds"
+              << std::setw(16) << "Docs/s" << std::endl;
+    const std::pair<const char*, double> stages[] = {
+        {"signatures", t_sign}, {"candidates", t_band}, {"verify", t_verify}, {"total", t_sign + t_band + t_verify}
+    };
+    for (const auto& stage: stages) {
+        std::cout << std::left << std::setw(12) << stage.first << std::right << std::setw(12) << std::setprecision(3)
+                  << stage.second << std::setw(16) << std::setprecision(0) << doc_count / stage.second << std::endl;
+    }
+
+    // Recall of the planted pairs whose exact similarity reaches the threshold
+    std::sort(planted.begin(), planted.end());
+    planted.erase(std::unique(planted.begin(), planted.end()), planted.end());
+    std::vector<SimilarPair> expected = verifyCandidates(docs, planted, ngram_len, true, params.threshold);
+    size_t found = 0;
+    for (const auto& pair: expected) {
+        found += std::binary_search(candidates.begin(), candidates.end(), std::make_pair(pair.first, pair.second));
+    }
+
+    std::cout << candidates.size() << " candidate pairs, " << pairs.size() << " verified" << std::endl;
+    std::cout << "Recall: " << found << " of " << expected.size() << " planted pairs at or above the threshold ("
+              << std::setprecision(2) << (expected.empty() ? 100.0 : 100.0 * found / expected.size()) << "%)" << std::endl;
+    return 0;
+}
@@ -0,0 +1,132 @@
+/******************************************************************************
+ * Program: tokenize_bench
+ * Author: Zachary Colbert
+ * Contact: zcolbert@sfsu.edu
+ *
+ * Description: Measures the throughput of the string-keyed tokenize() against
+ *              the packed-integer NgramCounter over the lines of a text file.
+ *
+ * Usage: tokenize_bench <path> [max_lines] [repetitions]
+ *****************************************************************************/
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "../tokenize.h"
+
+
+/**
+ * Time repeated passes of a function over all lines and return the fastest pass.
+ *
+ * @param lines The input lines.
+ * @param reps The number of timed passes.
+ * @param fn The function to apply to each line.
+ * @return The fastest pass, in seconds.
+ */
+template <typename Fn>
+double timeBest(const std::vector<std::string>& lines, int reps, Fn fn)
+{
+    double best = 0;
+    for (int r = 0; r < reps; ++r)
+    {
+        auto start = std::chrono::high_resolution_clock::now();
+        for (const auto& line: lines) {
+            fn(line);
+        }
+        std::chrono::duration<double> elapsed = std::chrono::high_resolution_clock::now() - start;
+        if (r == 0 || elapsed.count() < best) {
+            best = elapsed.count();
+        }
+    }
+    return best;
+}
+
+/**
+ * Check that both tokenizers produce the same counts for a line.
+ */
+bool sameCounts(const std::string& line, size_t ngram_len)
+{
+    auto expected = tokenize(line, ngram_len, true);
+
+    NgramCounter counter(ngram_len, true);
+    counter.count(line);
+    if (counter.size() != expected.size()) {
+        return false;
+    }
+    bool same = true;
+    counter.forEach([&](uint64_t key, unsigned int count) {
+        bool found = false;
+        for (const auto& kv: expected) {
+            if (TokenDictionary::pack(kv.first) == key) {
+                found = kv.second == count;
+                break;
+            }
+        }
+        same = same && found;
+    });
+    return same;
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc < 2) {
+        std::cout << "Usage: " << argv[0] << " <path> [max_lines] [repetitions]" << std::endl;
+        return 1;
+    }
+    const size_t max_lines = argc > 2 ? std::stoull(argv[2]) : 1000;
+    const int reps = argc > 3 ? std::stoi(argv[3]) : 5;
+
+    std::vector<std::string> lines;
+    size_t bytes = 0;
+    std::ifstream fs(argv[1]);
+    std::string line;
+    while (lines.size() < max_lines && std::getline(fs, line)) {
+        bytes += line.length();
+        lines.push_back(line);
+    }
+    if (lines.empty()) {
+        std::cout << "No input read from " << argv[1] << std::endl;
+        return 1;
+    }
+
+    std::cout << lines.size() << " lines, " << bytes << " bytes" << std::endl;
+    std::cout << std::left << std::setw(8) << "ngram" << std::setw(12) << "verified"
+              << std::setw(18) << "tokenize (GB/s)" << std::setw(22) << "NgramCounter (GB/s)"
+              << "speedup" << std::endl;
+
+    for (size_t ngram_len: {1, 2, 3, 5, 8})
+    {
+        bool verified = true;
+        for (size_t i = 0; i < lines.size() && i < 50; ++i) {
+            verified = verified && sameCounts(lines[i], ngram_len);
+        }
+
+        size_t sink = 0;
+        double ref = timeBest(lines, reps, [&](const std::string& text) {
+            sink += tokenize(text, ngram_len, true).size();
+        });
+
+        NgramCounter counter(ngram_len, true);
+        double packed = timeBest(lines, reps, [&](const std::string& text) {
+            counter.count(text);
+            sink += counter.size();
+            counter.clear();
+        });
+
+        std::cout << std::left << std::setw(8) << ngram_len << std::setw(12) << (verified ? "yes" : "NO")
+                  << std::setw(18) << std::fixed << std::setprecision(4) << bytes / ref / 1e9
+                  << std::setw(22) << bytes / packed / 1e9
+                  << std::setprecision(1) << ref / packed << "x" << std::endl;
+
+        // Keep the results observable so the work cannot be optimized away
+        if (sink == 0) {
+            std::cout << std::endl;
+        }
+    }
+    return 0;
+}
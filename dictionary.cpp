@@ -0,0 +1,150 @@
+/******************************************************************************
+ * Filename: dictionary.cpp
+ * Author: Zachary Colbert
+ * Contact: zcolbert@sfsu.edu
+ *
+ * Description:
+ *      Implementation of the token dictionary.
+ *****************************************************************************/
+
+#include "dictionary.h"
+
+#include <algorithm>
+
+
+/**
+ * @param ngram_len The length of the ngrams this dictionary will hold.
+ */
+TokenDictionary::TokenDictionary(size_t ngram_len)
+    : ngram_len(ngram_len)
+{
+}
+
+/**
+ * Pack up to 8 characters into a 64-bit key, first character in the most significant byte used.
+ *
+ * @param token The characters to pack.
+ * @return The packed key.
+ */
+uint64_t TokenDictionary::pack(std::string_view token)
+{
+    uint64_t key = 0;
+    for (size_t i = 0; i < token.length() && i < max_packed_len; ++i) {
+        key = (key << 8) | static_cast<unsigned char>(token[i]);
+    }
+    return key;
+}
+
+/**
+ * Get the ID of a token, assigning the next ID if it has not been seen before.
+ *
+ * @param token The token characters. Should not be longer than the ngram length.
+ * @return The ID of the token.
+ */
+uint32_t TokenDictionary::intern(std::string_view token)
+{
+    if (packed()) {
+        return internPacked(pack(token));
+    }
+
+    // A single lookup either finds the existing ID or inserts the next one
+    auto result = string_ids.try_emplace(std::string(token), static_cast<uint32_t>(string_tokens.size()));
+    if (result.second) {
+        string_tokens.emplace_back(token);
+    }
+    return result.first->second;
+}
+
+/**
+ * Get the ID of a packed token, assigning the next ID if it has not been seen before.
+ * Only valid when the ngram length is at most max_packed_len.
+ *
+ * @param key The token packed with pack().
+ * @return The ID of the token.
+ */
+uint32_t TokenDictionary::internPacked(uint64_t key)
+{
+    // Keep the load factor at or below one half
+    if ((packed_tokens.size() + 1) * 2 > packed_slots.size()) {
+        growPackedSlots();
+    }
+
+    // Linear probing from a multiplicative hash of the key
+    const size_t slot_mask = packed_slots.size() - 1;
+    size_t slot = (key * 0x9E3779B97F4A7C15ULL) >> 32 & slot_mask;
+    while (packed_slots[slot] != 0)
+    {
+        const uint32_t id = packed_slots[slot] - 1;
+        if (packed_tokens[id] == key) {
+            return id;
+        }
+        slot = (slot + 1) & slot_mask;
+    }
+
+    const uint32_t id = static_cast<uint32_t>(packed_tokens.size());
+    packed_slots[slot] = id + 1;
+    packed_tokens.push_back(key);
+    return id;
+}
+
+/**
+ * Double the number of packed slots and reinsert every ID.
+ */
+void TokenDictionary::growPackedSlots()
+{
+    packed_slots.assign(std::max<size_t>(1024, packed_slots.size() * 2), 0);
+    const size_t slot_mask = packed_slots.size() - 1;
+    for (uint32_t id = 0; id < packed_tokens.size(); ++id)
+    {
+        size_t slot = (packed_tokens[id] * 0x9E3779B97F4A7C15ULL) >> 32 & slot_mask;
+        while (packed_slots[slot] != 0) {
+            slot = (slot + 1) & slot_mask;
+        }
+        packed_slots[slot] = id + 1;
+    }
+}
+
+/**
+ * Get the text of the token with the given ID.
+ *
+ * @param id A previously assigned ID.
+ * @return The token as a string.
+ */
+std::string TokenDictionary::token(uint32_t id) const
+{
+    if (!packed()) {
+        return string_tokens[id];
+    }
+
+    // Unpack from the most significant non-zero byte down
+    std::string text;
+    uint64_t key = packed_tokens[id];
+    for (int shift = 56; shift >= 0; shift -= 8)
+    {
+        char c = static_cast<char>((key >> shift) & 0xFF);
+        if (c != '\0' || !text.empty()) {
+            text.push_back(c);
+        }
+    }
+    return text;
+}
+
+/**
+ * Map each token ID to the column it occupies in a term frequency matrix.
+ *
+ * @param vocabulary The token IDs defining the column space, in column order.
+ * @return A vector indexed by token ID holding its column, or no_column.
+ */
+std::vector<uint32_t> getColumnMap(const std::vector<uint32_t>& vocabulary)
+{
+    uint32_t max_id = 0;
+    for (uint32_t id: vocabulary) {
+        max_id = std::max(max_id, id);
+    }
+
+    std::vector<uint32_t> columns(vocabulary.empty() ? 0 : max_id + 1, no_column);
+    for (size_t c = 0; c < vocabulary.size(); ++c) {
+        columns[vocabulary[c]] = static_cast<uint32_t>(c);
+    }
+    return columns;
+}
@@ -0,0 +1,217 @@
+/******************************************************************************
+ * Filename: dictionary.h
+ * Author: Zachary Colbert
+ * Contact: zcolbert@sfsu.edu
+ *
+ * Description:
+ *      Interface of the token dictionary, which assigns each distinct
+ *      ngram a dense integer ID.
+ *****************************************************************************/
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "arena.h"
+
+/** A token ID and the number of times it occurs in a document. */
+using TokenCount = std::pair<uint32_t, unsigned int>;
+
+/** The token counts of a single document, sorted by token ID. */
+using TokenCounts = std::vector<TokenCount>;
+
+
+/** The token counts of a single document, held in memory owned by a DocumentTokenCounts. */
+struct TokenCountSpan
+{
+    TokenCount* first = nullptr;
+    size_t count = 0;
+
+    TokenCount* begin() { return first; }
+    TokenCount* end() { return first + count; }
+    const TokenCount* begin() const { return first; }
+    const TokenCount* end() const { return first + count; }
+    size_t size() const { return count; }
+    bool empty() const { return count == 0; }
+    TokenCount& operator[](size_t i) { return first[i]; }
+    const TokenCount& operator[](size_t i) const { return first[i]; }
+};
+
+
+/**
+ * The token counts of a set of documents, each sorted by token ID.
+ *
+ * The counts of all documents are allocated from a few arenas rather than one
+ * vector per document, so a corpus costs a handful of large allocations and is
+ * freed in one operation. Separate arenas let threads fill disjoint documents
+ * without sharing an allocator.
+ */
+class DocumentTokenCounts
+{
+public:
+    DocumentTokenCounts() = default;
+
+    /**
+     * @param documents The number of documents, each initially empty.
+     * @param arenas The number of arenas to allocate from.
+     */
+    DocumentTokenCounts(size_t documents, size_t arenas)
+        : docs(documents), arenas(arenas)
+    {
+    }
+
+    /**
+     * Allocate room for the counts of a document. Any previous counts of the document are abandoned.
+     *
+     * @param doc The index of the document.
+     * @param arena The arena to allocate from. Only one thread may use an arena at a time.
+     * @param count The number of distinct tokens in the document.
+     * @return The uninitialized counts of the document.
+     */
+    TokenCountSpan& allocate(size_t doc, size_t arena, size_t count)
+    {
+        docs[doc].first = arenas[arena].allocate<TokenCount>(count);
+        docs[doc].count = count;
+        return docs[doc];
+    }
+
+    /** Remove every document and free the memory of their counts. */
+    void clear()
+    {
+        docs.clear();
+        arenas.clear();
+    }
+
+    /** @return The number of blocks obtained by all arenas. */
+    size_t blocks() const
+    {
+        size_t total = 0;
+        for (const Arena& arena: arenas) {
+            total += arena.blocks();
+        }
+        return total;
+    }
+
+    /** @return The total size of the arena blocks, in bytes. */
+    size_t reserved() const
+    {
+        size_t total = 0;
+        for (const Arena& arena: arenas) {
+            total += arena.reserved();
+        }
+        return total;
+    }
+
+    size_t size() const { return docs.size(); }
+    bool empty() const { return docs.empty(); }
+    TokenCountSpan& operator[](size_t i) { return docs[i]; }
+    const TokenCountSpan& operator[](size_t i) const { return docs[i]; }
+    std::vector<TokenCountSpan>::const_iterator begin() const { return docs.begin(); }
+    std::vector<TokenCountSpan>::const_iterator end() const { return docs.end(); }
+
+private:
+    std::vector<TokenCountSpan> docs;
+    std::vector<Arena> arenas;
+};
+
+
+/**
+ * Maps each distinct ngram to a dense integer ID, assigned in order of first appearance.
+ *
+ * Ngrams of up to 8 characters are packed into a 64-bit integer key, so they are
+ * stored and hashed without ever constructing a string. Longer ngrams fall back
+ * to string keys. Text is assumed not to contain NUL characters: a NUL byte packs
+ * to the same key as an absent character.
+ */
+class TokenDictionary
+{
+public:
+    /** The longest ngram which can be packed into a 64-bit key. */
+    static constexpr size_t max_packed_len = 8;
+
+    /**
+     * @param ngram_len The length of the ngrams this dictionary will hold.
+     */
+    explicit TokenDictionary(size_t ngram_len);
+
+    /**
+     * Pack up to 8 characters into a 64-bit key, first character in the most significant byte used.
+     *
+     * @param token The characters to pack.
+     * @return The packed key.
+     */
+    static uint64_t pack(std::string_view token);
+
+    /**
+     * Get the ID of a token, assigning the next ID if it has not been seen before.
+     *
+     * @param token The token characters. Should not be longer than the ngram length.
+     * @return The ID of the token.
+     */
+    uint32_t intern(std::string_view token);
+
+    /**
+     * Get the ID of a packed token, assigning the next ID if it has not been seen before.
+     * Only valid when the ngram length is at most max_packed_len.
+     *
+     * @param key The token packed with pack().
+     * @return The ID of the token.
+     */
+    uint32_t internPacked(uint64_t key);
+
+    /**
+     * Get the text of the token with the given ID.
+     *
+     * @param id A previously assigned ID.
+     * @return The token as a string.
+     */
+    std::string token(uint32_t id) const;
+
+    /**
+     * Get the packed key of the token with the given ID.
+     * Only valid when the ngram length is at most max_packed_len.
+     *
+     * @param id A previously assigned ID.
+     * @return The packed key.
+     */
+    uint64_t packedKey(uint32_t id) const { return packed_tokens[id]; }
+
+    /** @return True if tokens are stored as packed integer keys. */
+    bool packed() const { return ngram_len <= max_packed_len; }
+
+    /** @return The number of distinct tokens, which is also the next ID to be assigned. */
+    size_t size() const { return packed() ? packed_tokens.size() : string_tokens.size(); }
+
+    /** @return The length of the ngrams held by this dictionary. */
+    size_t ngramLength() const { return ngram_len; }
+
+private:
+    void growPackedSlots();
+
+    size_t ngram_len;
+
+    // Open addressing over the packed keys: each slot holds an ID + 1, or zero if empty.
+    // The key of an ID is read back from packed_tokens, so a slot is only 4 bytes.
+    std::vector<uint32_t> packed_slots;
+    std::vector<uint64_t> packed_tokens;
+
+    std::unordered_map<std::string, uint32_t> string_ids;
+    std::vector<std::string> string_tokens;
+};
+
+
+/** Column index of token IDs which are not part of a vocabulary. */
+constexpr uint32_t no_column = UINT32_MAX;
+
+/**
+ * Map each token ID to the column it occupies in a term frequency matrix.
+ *
+ * @param vocabulary The token IDs defining the column space, in column order.
+ * @return A vector indexed by token ID holding its column, or no_column.
+ */
+std::vector<uint32_t> getColumnMap(const std::vector<uint32_t>& vocabulary);
@@ -0,0 +1,397 @@
+/******************************************************************************
+ * Filename: gemm.cpp
+ * Author: Zachary Colbert
+ * Contact: zcolbert@sfsu.edu
+ *
+ * Description: Implementation of the packed-panel matrix multiply (GEMM).
+ *
+ *      The loop structure follows the usual GotoBLAS/BLIS layering: a KC x NC
+ *      panel of B is packed once and shared by all threads, each thread packs
+ *      an MC x KC block of A, and the micro-kernel accumulates an MR x NR tile
+ *      of C held entirely in registers.
+ *****************************************************************************/
+
+#include "gemm.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define LTS_GEMM_X86 1
+#endif
+
+
+// Blocking parameters. MC is a multiple of every kernel's MR, and NC of every kernel's NR.
+static const size_t gemm_kc = 256;
+static const size_t gemm_mc = 96;
+static const size_t gemm_nc = 2048;
+
+// Largest register tile of any kernel, used to size the edge buffer
+static const size_t max_mr = 12;
+static const size_t max_nr = 32;
+
+/**
+ * A micro-kernel computes C[MR x NR] += A_panel x B_panel over kc steps, where the
+ * A panel holds MR elements per step and the B panel holds NR elements per step.
+ */
+using MicroKernel = void (*)(size_t kc, const float* a, const float* b, float* c, size_t ldc);
+
+struct GemmKernel
+{
+    const char* name;
+    size_t mr;
+    size_t nr;
+    MicroKernel run;
+};
+
+
+/************************** Micro-kernels *******************************/
+
+static void kernelGeneric(size_t kc, const float* a, const float* b, float* c, size_t ldc)
+{
+    float acc[4][8] = {};
+    for (size_t k = 0; k < kc; ++k, a += 4, b += 8) {
+        for (int i = 0; i < 4; ++i) {
+            for (int j = 0; j < 8; ++j) {
+                acc[i][j] += a[i] * b[j];
+            }
+        }
+    }
+    for (int i = 0; i < 4; ++i) {
+        for (int j = 0; j < 8; ++j) {
+            c[i * ldc + j] += acc[i][j];
+        }
+    }
+}
+
+#ifdef LTS_GEMM_X86
+
+__attribute__((target("sse2")))
+static void kernelSse2(size_t kc, const float* a, const float* b, float* c, size_t ldc)
+{
+    __m128 acc[4][2];
+    for (int i = 0; i < 4; ++i) {
+        acc[i][0] = _mm_setzero_ps();
+        acc[i][1] = _mm_setzero_ps();
+    }
+    for (size_t k = 0; k < kc; ++k, a += 4, b += 8)
+    {
+        const __m128 b0 = _mm_load_ps(b);
+        const __m128 b1 = _mm_load_ps(b + 4);
+        for (int i = 0; i < 4; ++i)
+        {
+            const __m128 ai = _mm_set1_ps(a[i]);
+            acc[i][0] = _mm_add_ps(acc[i][0], _mm_mul_ps(ai, b0));
+            acc[i][1] = _mm_add_ps(acc[i][1], _mm_mul_ps(ai, b1));
+        }
+    }
+    for (int i = 0; i < 4; ++i)
+    {
+        float* row = c + i * ldc;
+        _mm_storeu_ps(row, _mm_add_ps(_mm_loadu_ps(row), acc[i][0]));
+        _mm_storeu_ps(row + 4, _mm_add_ps(_mm_loadu_ps(row + 4), acc[i][1]));
+    }
+}
+
+__attribute__((target("avx2,fma")))
+static void kernelAvx2(size_t kc, const float* a, const float* b, float* c, size_t ldc)
+{
+    __m256 acc[6][2];
+    for (int i = 0; i < 6; ++i) {
+        acc[i][0] = _mm256_setzero_ps();
+        acc[i][1] = _mm256_setzero_ps();
+    }
+    for (size_t k = 0; k < kc; ++k, a += 6, b += 16)
+    {
+        const __m256 b0 = _mm256_load_ps(b);
+        const __m256 b1 = _mm256_load_ps(b + 8);
+        for (int i = 0; i < 6; ++i)
+        {
+            const __m256 ai = _mm256_broadcast_ss(a + i);
+            acc[i][0] = _mm256_fmadd_ps(ai, b0, acc[i][0]);
+            acc[i][1] = _mm256_fmadd_ps(ai, b1, acc[i][1]);
+        }
+    }
+    for (int i = 0; i < 6; ++i)
+    {
+        float* row = c + i * ldc;
+        _mm256_storeu_ps(row, _mm256_add_ps(_mm256_loadu_ps(row), acc[i][0]));
+        _mm256_storeu_ps(row + 8, _mm256_add_ps(_mm256_loadu_ps(row + 8), acc[i][1]));
+    }
+}
+
+__attribute__((target("avx512f")))
+static void kernelAvx512(size_t kc, const float* a, const float* b, float* c, size_t ldc)
+{
+    __m512 acc[12][2];
+    for (int i = 0; i < 12; ++i) {
+        acc[i][0] = _mm512_setzero_ps();
+        acc[i][1] = _mm512_setzero_ps();
+    }
+    for (size_t k = 0; k < kc; ++k, a += 12, b += 32)
+    {
+        const __m512 b0 = _mm512_load_ps(b);
+        const __m512 b1 = _mm512_load_ps(b + 16);
+        for (int i = 0; i < 12; ++i)
+        {
+            const __m512 ai = _mm512_set1_ps(a[i]);
+            acc[i][0] = _mm512_fmadd_ps(ai, b0, acc[i][0]);
+            acc[i][1] = _mm512_fmadd_ps(ai, b1, acc[i][1]);
+        }
+    }
+    for (int i = 0; i < 12; ++i)
+    {
+        float* row = c + i * ldc;
+        _mm512_storeu_ps(row, _mm512_add_ps(_mm512_loadu_ps(row), acc[i][0]));
+        _mm512_storeu_ps(row + 16, _mm512_add_ps(_mm512_loadu_ps(row + 16), acc[i][1]));
+    }
+}
+
+#endif  // LTS_GEMM_X86
+
+static const GemmKernel generic_kernel = {"generic", 4, 8, &kernelGeneric};
+#ifdef LTS_GEMM_X86
+static const GemmKernel sse2_kernel = {"sse2", 4, 8, &kernelSse2};
+static const GemmKernel avx2_kernel = {"avx2", 6, 16, &kernelAvx2};
+static const GemmKernel avx512_kernel = {"avx512", 12, 32, &kernelAvx512};
+#endif
+
+
+/************************** Runtime dispatch *******************************/
+
+/**
+ * Find the widest kernel supported by this CPU, as reported by CPUID.
+ */
+static const GemmKernel* detectKernel()
+{
+#ifdef LTS_GEMM_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) {
+        return &avx512_kernel;
+    }
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+        return &avx2_kernel;
+    }
+    if (__builtin_cpu_supports("sse2")) {
+        return &sse2_kernel;
+    }
+#endif
+    return &generic_kernel;
+}
+
+// Selected once at startup, before main() runs
+static const GemmKernel* active_kernel = detectKernel();
+
+/**
+ * Select a micro-kernel by name: "generic", "sse2", "avx2" or "avx512".
+ * "best" selects the widest kernel supported by this CPU, which is also the
+ * kernel chosen automatically on first use.
+ *
+ * @param name The kernel name.
+ * @return False if the name is unknown or the CPU does not support the kernel.
+ */
+bool selectGemmKernel(const std::string& name)
+{
+    if (name == "best") {
+        active_kernel = detectKernel();
+        return true;
+    }
+    if (name == "generic") {
+        active_kernel = &generic_kernel;
+        return true;
+    }
+#ifdef LTS_GEMM_X86
+    if (name == "sse2" && __builtin_cpu_supports("sse2")) {
+        active_kernel = &sse2_kernel;
+        return true;
+    }
+    if (name == "avx2" && __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+        active_kernel = &avx2_kernel;
+        return true;
+    }
+    if (name == "avx512" && __builtin_cpu_supports("avx512f")) {
+        active_kernel = &avx512_kernel;
+        return true;
+    }
+#endif
+    return false;
+}
+
+/** @return The name of the active micro-kernel. */
+std::string gemmKernelName()
+{
+    return active_kernel->name;
+}
+
+
+/************************** Packing *******************************/
+
+/**
+ * Pack a rows x kc block of A into panels of mr rows, stored step by step:
+ * panel p holds A[p*mr .. p*mr+mr)[k] at offset (p * kc + k) * mr. Rows past the
+ * end of the block are zero-filled, so the micro-kernel always runs full tiles.
+ */
+static void packA(const float* a, size_t lda, size_t rows, size_t kc, size_t mr, float* dest)
+{
+    for (size_t p = 0; p < rows; p += mr)
+    {
+        const size_t valid = std::min(mr, rows - p);
+        for (size_t k = 0; k < kc; ++k)
+        {
+            for (size_t i = 0; i < valid; ++i) {
+                dest[i] = a[(p + i) * lda + k];
+            }
+            for (size_t i = valid; i < mr; ++i) {
+                dest[i] = 0.0f;
+            }
+            dest += mr;
+        }
+    }
+}
+
+/**
+ * Pack a kc x cols block of B into panels of nr columns, stored step by step:
+ * panel p holds B[k][p*nr .. p*nr+nr) at offset (p * kc + k) * nr. Columns past the
+ * end of the block are zero-filled.
+ */
+static void packB(const float* b, size_t ldb, size_t kc, size_t cols, size_t nr, float* dest, size_t first_panel,
+                  size_t last_panel)
+{
+    for (size_t p = first_panel; p < last_panel; ++p)
+    {
+        const size_t j0 = p * nr;
+        const size_t valid = std::min(nr, cols - j0);
+        float* panel = dest + p * kc * nr;
+        for (size_t k = 0; k < kc; ++k)
+        {
+            std::memcpy(panel, b + k * ldb + j0, valid * sizeof(float));
+            std::fill(panel + valid, panel + nr, 0.0f);
+            panel += nr;
+        }
+    }
+}
+
+/**
+ * A vector of floats aligned to 64 bytes, for the aligned loads of the packed panels.
+ */
+struct AlignedBuffer
+{
+    explicit AlignedBuffer(size_t count)
+        : storage(count + 16)
+    {
+        auto addr = reinterpret_cast<uintptr_t>(storage.data());
+        data = storage.data() + ((64 - addr % 64) % 64) / sizeof(float);
+    }
+
+    std::vector<float> storage;
+    float* data;
+};
+
+
+/************************** Driver *******************************/
+
+/**
+ * Accumulate the product of two row-major matrices into a third: C += A x B.
+ *
+ * Blocks of A and B are packed into contiguous panels which match the register
+ * tile of the active micro-kernel, so the innermost loop only performs broadcasts,
+ * aligned loads and multiply-adds. Row blocks of C are computed in parallel.
+ *
+ * @param rows The number of rows of A and C.
+ * @param cols The number of columns of B and C.
+ * @param depth The number of columns of A and rows of B.
+ * @param a The first element of A.
+ * @param lda The distance between consecutive rows of A.
+ * @param b The first element of B.
+ * @param ldb The distance between consecutive rows of B.
+ * @param c The first element of C.
+ * @param ldc The distance between consecutive rows of C.
+ */
+void gemm(size_t rows, size_t cols, size_t depth,
+          const float* a, size_t lda,
+          const float* b, size_t ldb,
+          float* c, size_t ldc)
+{
+    if (rows == 0 || cols == 0 || depth == 0) {
+        return;
+    }
+
+    const GemmKernel kernel = *active_kernel;
+    const size_t nc_max = std::min(gemm_nc, (cols + kernel.nr - 1) / kernel.nr * kernel.nr);
+    AlignedBuffer packed_b(gemm_kc * nc_max);
+
+    for (size_t jc = 0; jc < cols; jc += gemm_nc)
+    {
+        const size_t nc = std::min(gemm_nc, cols - jc);
+        const size_t b_panels = (nc + kernel.nr - 1) / kernel.nr;
+
+        for (size_t pc = 0; pc < depth; pc += gemm_kc)
+        {
+            const size_t kc = std::min(gemm_kc, depth - pc);
+
+            #pragma omp parallel
+            {
+                // The B panel is packed once, cooperatively, and shared by every thread
+                #pragma omp for schedule(static)
+                for (size_t p = 0; p < b_panels; ++p) {
+                    packB(b + pc * ldb + jc, ldb, kc, nc, kernel.nr, packed_b.data, p, p + 1);
+                }
+
+                AlignedBuffer packed_a(gemm_mc * kc);
+                alignas(64) float edge[max_mr * max_nr];
+
+                #pragma omp for schedule(dynamic)
+                for (size_t ic = 0; ic < rows; ic += gemm_mc)
+                {
+                    const size_t mc = std::min(gemm_mc, rows - ic);
+                    packA(a + ic * lda + pc, lda, mc, kc, kernel.mr, packed_a.data);
+
+                    for (size_t jr = 0; jr < nc; jr += kernel.nr)
+                    {
+                        const float* b_panel = packed_b.data + (jr / kernel.nr) * kc * kernel.nr;
+                        const size_t nr = std::min(kernel.nr, nc - jr);
+
+                        for (size_t ir = 0; ir < mc; ir += kernel.mr)
+                        {
+                            const float* a_panel = packed_a.data + (ir / kernel.mr) * kc * kernel.mr;
+                            const size_t mr = std::min(kernel.mr, mc - ir);
+                            float* c_tile = c + (ic + ir) * ldc + (jc + jr);
+
+                            if (mr == kernel.mr && nr == kernel.nr) {
+                                kernel.run(kc, a_panel, b_panel, c_tile, ldc);
+                            }
+                            else
+                            {
+                                // Ragged edge: compute the full tile aside and add the valid part
+                                std::fill(edge, edge + kernel.mr * kernel.nr, 0.0f);
+                                kernel.run(kc, a_panel, b_panel, edge, kernel.nr);
+                                for (size_t i = 0; i < mr; ++i) {
+                                    for (size_t j = 0; j < nr; ++j) {
+                                        c_tile[i * ldc + j] += edge[i * kernel.nr + j];
+                                    }
+                                }
+                            }
+                        }
+                    }
+                }
+            }
+        }
+    }
+}
+
+/**
+ * Matrix multiply through the packed-panel GEMM, with the same interface as the
+ * matrixMultiply_<order> functions: result += lhs x rhs.
+ *
+ * @param lhs The left-hand operand matrix, with dimensions N x M.
+ * @param rhs The right-hand operand matrix, with dimensions M x N.
+ * @param result The N x N result matrix.
+ * @param n The number of rows in the left matrix, columns in the right matrix.
+ * @param m The number of columns in the left matrix, rows in the right matrix.
+ */
+void matrixMultiply_simd(const std::vector<float>& lhs, const std::vector<float>& rhs, std::vector<float>& result, size_t n, size_t m)
+{
+    gemm(n, n, m, lhs.data(), m, rhs.data(), n, result.data(), n);
+}
@@ -0,0 +1,60 @@
+/******************************************************************************
+ * Filename: gemm.h
+ * Author: Zachary Colbert
+ * Contact: zcolbert@sfsu.edu
+ *
+ * Description: Interface of the packed-panel matrix multiply (GEMM), with
+ *              register-tiled SIMD micro-kernels selected at runtime.
+ *****************************************************************************/
+#pragma once
+
+#include <string>
+#include <vector>
+
+
+/**
+ * Accumulate the product of two row-major matrices into a third: C += A x B.
+ *
+ * Blocks of A and B are packed into contiguous panels which match the register
+ * tile of the active micro-kernel, so the innermost loop only performs broadcasts,
+ * aligned loads and multiply-adds. Row blocks of C are computed in parallel.
+ *
+ * @param rows The number of rows of A and C.
+ * @param cols The number of columns of B and C.
+ * @param depth The number of columns of A and rows of B.
+ * @param a The first element of A.
+ * @param lda The distance between consecutive rows of A.
+ * @param b The first element of B.
+ * @param ldb The distance between consecutive rows of B.
+ * @param c The first element of C.
+ * @param ldc The distance between consecutive rows of C.
+ */
+void gemm(size_t rows, size_t cols, size_t depth,
+          const float* a, size_t lda,
+          const float* b, size_t ldb,
+          float* c, size_t ldc);
+
+/**
+ * Matrix multiply through the packed-panel GEMM, with the same interface as the
+ * matrixMultiply_<order> functions: result += lhs x rhs.
+ *
+ * @param lhs The left-hand operand matrix, with dimensions N x M.
+ * @param rhs The right-hand operand matrix, with dimensions M x N.
+ * @param result The N x N result matrix.
+ * @param n The number of rows in the left matrix, columns in the right matrix.
+ * @param m The number of columns in the left matrix, rows in the right matrix.
+ */
+void matrixMultiply_simd(const std::vector<float>& lhs, const std::vector<float>& rhs, std::vector<float>& result, size_t n, size_t m);
+
+/**
+ * Select a micro-kernel by name: "generic", "sse2", "avx2" or "avx512".
+ * "best" selects the widest kernel supported by this CPU, which is also the
+ * kernel chosen automatically on first use.
+ *
+ * @param name The kernel name.
+ * @return False if the name is unknown or the CPU does not support the kernel.
+ */
+bool selectGemmKernel(const std::string& name);
+
+/** @return The name of the active micro-kernel. */
+std::string gemmKernelName();
@@ -0,0 +1,127 @@
+/******************************************************************************
+ * Filename: hashing.cpp
+ * Author: Zachary Colbert
+ * Contact: zcolbert@sfsu.edu
+ *
+ * Description: Implementation of the feature-hashing vectorizer.
+ *****************************************************************************/
+
+#include "hashing.h"
+
+#include <algorithm>
+#include <omp.h>
+
+#include "tokenize.h"
+
+
+/**
+ * Append the hashed term frequencies of one document as a new row of a matrix.
+ *
+ * @param keys The distinct packed ngrams of the document.
+ * @param counts The number of times each ngram occurs.
+ * @param count The number of distinct ngrams.
+ * @param config The number of columns and whether to use signs.
+ * @param scratch A buffer reused between calls.
+ * @param matrix The matrix receiving the row.
+ */
+void appendHashedRow(const uint64_t* keys, const unsigned int* counts, size_t count, const HashingConfig& config,
+                     std::vector<std::pair<uint32_t, float>>& scratch, CsrMatrix& matrix)
+{
+    scratch.clear();
+    for (size_t p = 0; p < count; ++p)
+    {
+        const float sign = config.use_sign ? hashedSign(keys[p]) : 1.0f;
+        scratch.emplace_back(hashedColumn(keys[p], config.bits), sign * static_cast<float>(counts[p]));
+    }
+    std::sort(scratch.begin(), scratch.end());
+
+    const size_t row_start = matrix.values.size();
+    for (const auto& elem: scratch)
+    {
+        if (matrix.values.size() > row_start && matrix.col_idx.back() == elem.first) {
+            matrix.values.back() += elem.second;
+        } else {
+            matrix.col_idx.push_back(elem.first);
+            matrix.values.push_back(elem.second);
+        }
+    }
+
+    // Counts are integers, so opposite signs cancel to exactly zero
+    size_t kept = row_start;
+    for (size_t p = row_start; p < matrix.values.size(); ++p)
+    {
+        if (matrix.values[p] != 0.0f) {
+            matrix.col_idx[kept] = matrix.col_idx[p];
+            matrix.values[kept] = matrix.values[p];
+            ++kept;
+        }
+    }
+    matrix.col_idx.resize(kept);
+    matrix.values.resize(kept);
+    matrix.row_ptr.push_back(kept);
+    ++matrix.rows;
+}
+
+/**
+ * Construct a sparse term frequency matrix with one row per line and 2^bits columns.
+ *
+ * @param lines The text of each document.
+ * @param ngram_len The length of each ngram, from 1 to TokenDictionary::max_packed_len.
+ * @param ignorecase If true, ignore case sensitivity.
+ * @param config The number of columns and whether to use signs.
+ * @return A (documents x 2^bits) sparse matrix of hashed term frequencies.
+ */
+CsrMatrix hashTermFrequencies(const std::vector<std::string_view>& lines, size_t ngram_len, bool ignorecase,
+                              const HashingConfig& config)
+{
+    // Each chunk of consecutive lines is vectorized into a matrix of its own, then the chunks are joined
+    const size_t chunk_count = std::max<size_t>(1, std::min(lines.size(), static_cast<size_t>(omp_get_max_threads()) * 4));
+    std::vector<CsrMatrix> chunks(chunk_count);
+
+    #pragma omp parallel for schedule(dynamic, 1)
+    for (size_t c = 0; c < chunk_count; ++c)
+    {
+        NgramCounter counter(ngram_len, ignorecase);
+        std::vector<uint64_t> keys;
+        std::vector<unsigned int> counts;
+        std::vector<std::pair<uint32_t, float>> scratch;
+        CsrMatrix& chunk = chunks[c];
+        chunk.row_ptr.push_back(0);
+
+        for (size_t i = lines.size() * c / chunk_count; i < lines.size() * (c + 1) / chunk_count; ++i)
+        {
+            counter.count(lines[i]);
+            keys.clear();
+            counts.clear();
+            counter.forEach([&](uint64_t key, unsigned int count) {
+                keys.push_back(key);
+                counts.push_back(count);
+            });
+            counter.clear();
+            appendHashedRow(keys.data(), counts.data(), keys.size(), config, scratch, chunk);
+        }
+    }
+
+    CsrMatrix matrix;
+    matrix.rows = lines.size();
+    matrix.cols = size_t(1) << config.bits;
+    size_t nnz = 0;
+    for (const CsrMatrix& chunk: chunks) {
+        nnz += chunk.nonZeros();
+    }
+    matrix.row_ptr.reserve(matrix.rows + 1);
+    matrix.row_ptr.push_back(0);
+    matrix.col_idx.reserve(nnz);
+    matrix.values.reserve(nnz);
+    for (CsrMatrix& chunk: chunks)
+    {
+        const size_t base = matrix.values.size();
+        for (size_t r = 1; r < chunk.row_ptr.size(); ++r) {
+            matrix.row_ptr.push_back(base + chunk.row_ptr[r]);
+        }
+        matrix.col_idx.insert(matrix.col_idx.end(), chunk.col_idx.begin(), chunk.col_idx.end());
+        matrix.values.insert(matrix.values.end(), chunk.values.begin(), chunk.values.end());
+        chunk = CsrMatrix();
+    }
+    return matrix;
+}
@@ -0,0 +1,81 @@
+/******************************************************************************
+ * Filename: hashing.h
+ * Author: Zachary Colbert
+ * Contact: zcolbert@sfsu.edu
+ *
+ * Description: Interface of the feature-hashing vectorizer, which maps each
+ *              ngram straight to one of 2^bits columns. No vocabulary is
+ *              built, so every document is vectorized on its own, in a single
+ *              pass, and the column space is known before any text is read.
+ *****************************************************************************/
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "sparse.h"
+
+
+/** Settings of the feature-hashing vectorizer. */
+struct HashingConfig
+{
+    unsigned bits = 18;     // The vectors have 2^bits columns, from 1 to 30
+    bool use_sign = true;   // Give each ngram a hashed sign of +1 or -1
+};
+
+/**
+ * Map a packed ngram to a column by multiplicative hashing.
+ *
+ * @param key The ngram, packed as by TokenDictionary::pack().
+ * @param bits The number of bits in the column index.
+ * @return The column, below 2^bits.
+ */
+inline uint32_t hashedColumn(uint64_t key, unsigned bits)
+{
+    return static_cast<uint32_t>((key * 0x9E3779B97F4A7C15ULL) >> (64 - bits));
+}
+
+/**
+ * Choose the sign of a packed ngram from a hash independent of its column.
+ *
+ * Colliding ngrams with opposite signs cancel instead of adding, so the expected
+ * dot product of two hashed vectors equals the dot product of the exact vectors.
+ *
+ * @param key The ngram, packed as by TokenDictionary::pack().
+ * @return +1 or -1.
+ */
+inline float hashedSign(uint64_t key)
+{
+    return ((key * 0xC2B2AE3D27D4EB4FULL) >> 63) ? -1.0f : 1.0f;
+}
+
+/**
+ * Append the hashed term frequencies of one document as a new row of a matrix.
+ * Ngrams hashing to the same column add together, and columns which cancel to zero are dropped.
+ *
+ * @param keys The distinct packed ngrams of the document.
+ * @param counts The number of times each ngram occurs.
+ * @param count The number of distinct ngrams.
+ * @param config The number of columns and whether to use signs.
+ * @param scratch A buffer reused between calls.
+ * @param matrix The matrix receiving the row.
+ */
+void appendHashedRow(const uint64_t* keys, const unsigned int* counts, size_t count, const HashingConfig& config,
+                     std::vector<std::pair<uint32_t, float>>& scratch, CsrMatrix& matrix);
+
+/**
+ * Construct a sparse term frequency matrix with one row per line and 2^bits columns,
+ * hashing the ngrams of each line as tokenize() would count them. Lines are
+ * vectorized in parallel.
+ *
+ * @param lines The text of each document.
+ * @param ngram_len The length of each ngram, from 1 to TokenDictionary::max_packed_len.
+ * @param ignorecase If true, ignore case sensitivity.
+ * @param config The number of columns and whether to use signs.
+ * @return A (documents x 2^bits) sparse matrix of hashed term frequencies.
+ */
+CsrMatrix hashTermFrequencies(const std::vector<std::string_view>& lines, size_t ngram_len, bool ignorecase,
+                              const HashingConfig& config);
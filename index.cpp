@@ -0,0 +1,234 @@
+/******************************************************************************
+ * Filename: index.cpp
+ * Author: Zachary Colbert
+ * Contact: zcolbert@sfsu.edu
+ *
+ * Description: Implementation of the binary corpus index.
+ *****************************************************************************/
+
+#include "index.h"
+
+#include <cstdio>   // rename
+#include <cstring>
+#include <fstream>
+
+
+static_assert(sizeof(size_t) == sizeof(uint64_t), "CSR row offsets are stored as 64-bit integers");
+
+/**
+ * Round an offset up to the next section boundary.
+ */
+static uint64_t alignOffset(uint64_t offset)
+{
+    return (offset + index_alignment - 1) / index_alignment * index_alignment;
+}
+
+/**
+ * Write a section at its offset, padding the file with zeros up to it.
+ *
+ * @return False if the stream has failed.
+ */
+static bool writeSection(std::ofstream& outfile, uint64_t offset, const void* data, size_t bytes)
+{
+    static const char zeros[index_alignment] = {};
+    const uint64_t pos = static_cast<uint64_t>(outfile.tellp());
+    outfile.write(zeros, static_cast<std::streamsize>(offset - pos));
+    outfile.write(static_cast<const char*>(data), static_cast<std::streamsize>(bytes));
+    return static_cast<bool>(outfile);
+}
+
+/**
+ * Write an index of a normalized term frequency matrix.
+ *
+ * The file is written to a temporary path and renamed, so a concurrent reader
+ * never maps half a file.
+ *
+ * @param path The path of the index file.
+ * @param dictionary The dictionary which assigned the token IDs. Must hold packed ngrams.
+ * @param vocabulary The token IDs of the columns, in column order.
+ * @param matrix The row-normalized term frequency matrix.
+ * @param norms The length of each row before normalization.
+ * @return False if the file could not be written.
+ */
+bool writeIndex(const std::string& path, const TokenDictionary& dictionary, const std::vector<uint32_t>& vocabulary,
+                const CsrMatrix& matrix, const std::vector<float>& norms)
+{
+    if (!dictionary.packed()) {
+        return false;
+    }
+
+    std::vector<uint64_t> keys(vocabulary.size());
+    for (size_t c = 0; c < vocabulary.size(); ++c) {
+        keys[c] = dictionary.packedKey(vocabulary[c]);
+    }
+    return writeIndex(path, dictionary.ngramLength(), keys, matrix, norms);
+}
+
+/**
+ * Write an index of a normalized term frequency matrix whose vocabulary is given as packed ngrams.
+ *
+ * @param path The path of the index file.
+ * @param ngram_len The ngram length of the vocabulary.
+ * @param keys The packed ngram of each column.
+ * @param matrix The row-normalized term frequency matrix.
+ * @param norms The length of each row before normalization.
+ * @return False if the file could not be written.
+ */
+bool writeIndex(const std::string& path, size_t ngram_len, const std::vector<uint64_t>& keys,
+                const CsrMatrix& matrix, const std::vector<float>& norms)
+{
+    const CsrMatrix postings = transpose(matrix);
+
+    IndexHeader header{};
+    std::memcpy(header.magic, index_magic, sizeof(index_magic));
+    header.version = index_version;
+    header.ngram_len = static_cast<uint32_t>(ngram_len);
+    header.rows = matrix.rows;
+    header.cols = matrix.cols;
+    header.nnz = matrix.nonZeros();
+
+    // Lay out the sections one after another, each on a section boundary
+    const size_t nnz = matrix.nonZeros();
+    header.vocabulary = alignOffset(sizeof(IndexHeader));
+    header.norms = alignOffset(header.vocabulary + keys.size() * sizeof(uint64_t));
+    header.row_ptr = alignOffset(header.norms + norms.size() * sizeof(float));
+    header.col_idx = alignOffset(header.row_ptr + matrix.row_ptr.size() * sizeof(uint64_t));
+    header.values = alignOffset(header.col_idx + nnz * sizeof(uint32_t));
+    header.post_ptr = alignOffset(header.values + nnz * sizeof(float));
+    header.post_idx = alignOffset(header.post_ptr + postings.row_ptr.size() * sizeof(uint64_t));
+    header.post_values = alignOffset(header.post_idx + nnz * sizeof(uint32_t));
+
+    const std::string tmp_path = path + ".tmp";
+    {
+        std::ofstream outfile(tmp_path, std::ios::binary | std::ios::trunc);
+        if (!outfile) {
+            return false;
+        }
+        outfile.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        bool ok = writeSection(outfile, header.vocabulary, keys.data(), keys.size() * sizeof(uint64_t))
+               && writeSection(outfile, header.norms, norms.data(), norms.size() * sizeof(float))
+               && writeSection(outfile, header.row_ptr, matrix.row_ptr.data(), matrix.row_ptr.size() * sizeof(uint64_t))
+               && writeSection(outfile, header.col_idx, matrix.col_idx.data(), nnz * sizeof(uint32_t))
+               && writeSection(outfile, header.values, matrix.values.data(), nnz * sizeof(float))
+               && writeSection(outfile, header.post_ptr, postings.row_ptr.data(), postings.row_ptr.size() * sizeof(uint64_t))
+               && writeSection(outfile, header.post_idx, postings.col_idx.data(), nnz * sizeof(uint32_t))
+               && writeSection(outfile, header.post_values, postings.values.data(), nnz * sizeof(float));
+        if (!ok) {
+            return false;
+        }
+    }
+    return std::rename(tmp_path.c_str(), path.c_str()) == 0;
+}
+
+/**
+ * Check that the row offsets of a mapped CSR section run from 0 to the number of non-zeros
+ * without decreasing, and that every column index is below the number of columns.
+ *
+ * @param v The mapped matrix.
+ * @param nnz The number of non-zero elements in the header.
+ * @return False if reading the matrix through its offsets would leave its sections.
+ */
+static bool validCsr(const CsrView& v, uint64_t nnz)
+{
+    if (v.row_ptr[0] != 0 || v.row_ptr[v.rows] != nnz) {
+        return false;
+    }
+    for (size_t i = 0; i < v.rows; ++i) {
+        if (v.row_ptr[i] > v.row_ptr[i + 1]) {
+            return false;
+        }
+    }
+    for (size_t p = 0; p < nnz; ++p) {
+        if (v.col_idx[p] >= v.cols) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * Map and validate the index file at the given path.
+ * @param path The path of the index file.
+ */
+CorpusIndex::CorpusIndex(const std::string& path)
+    : file(path)
+{
+    if (!file.isOpen()) {
+        message = "cannot open '" + path + "'";
+        return;
+    }
+    if (file.size() < sizeof(IndexHeader) || std::memcmp(file.data(), index_magic, sizeof(index_magic)) != 0) {
+        message = "'" + path + "' is not an index file";
+        return;
+    }
+
+    const auto* h = reinterpret_cast<const IndexHeader*>(file.data());
+    if (h->version != index_version) {
+        message = "'" + path + "' has index version " + std::to_string(h->version) + ", expected "
+                  + std::to_string(index_version);
+        return;
+    }
+
+    // Every section must be aligned and lie within the file. The counts are compared with the
+    // elements that fit in the file before any size is computed, so a corrupt count cannot overflow.
+    const uint64_t size = file.size();
+    if (h->rows >= size / sizeof(uint64_t) || h->cols >= size / sizeof(uint64_t)) {
+        message = "'" + path + "' is truncated or corrupt";
+        return;
+    }
+    struct Section { uint64_t offset; uint64_t count; uint64_t element; };
+    const Section sections[] = {
+        {h->vocabulary, h->cols, sizeof(uint64_t)},
+        {h->norms, h->rows, sizeof(float)},
+        {h->row_ptr, h->rows + 1, sizeof(uint64_t)},
+        {h->col_idx, h->nnz, sizeof(uint32_t)},
+        {h->values, h->nnz, sizeof(float)},
+        {h->post_ptr, h->cols + 1, sizeof(uint64_t)},
+        {h->post_idx, h->nnz, sizeof(uint32_t)},
+        {h->post_values, h->nnz, sizeof(float)},
+    };
+    for (const Section& s: sections)
+    {
+        if (s.offset % index_alignment != 0 || s.offset > size || s.count > (size - s.offset) / s.element) {
+            message = "'" + path + "' is truncated or corrupt";
+            return;
+        }
+    }
+
+    // The offsets and indices are read without bounds checks later, so they are checked once here
+    header = h;
+    if (!validCsr(matrix(), h->nnz) || !validCsr(postings(), h->nnz)) {
+        header = nullptr;
+        message = "'" + path + "' is truncated or corrupt";
+    }
+}
+
+/** @return The row-normalized documents x vocabulary matrix. */
+CsrView CorpusIndex::matrix() const
+{
+    CsrView v;
+    v.rows = header->rows;
+    v.cols = header->cols;
+    v.row_ptr = section<size_t>(header->row_ptr);
+    v.col_idx = section<uint32_t>(header->col_idx);
+    v.values = section<float>(header->values);
+    return v;
+}
+
+/** @return The transpose of matrix(): for each column, the documents containing it. */
+CsrView CorpusIndex::postings() const
+{
+    CsrView v;
+    v.rows = header->cols;
+    v.cols = header->rows;
+    v.row_ptr = section<size_t>(header->post_ptr);
+    v.col_idx = section<uint32_t>(header->post_idx);
+    v.values = section<float>(header->post_values);
+    return v;
+}
+
+/** @return The normalized matrix expanded to a dense row-wise matrix. */
+std::vector<float> CorpusIndex::denseMatrix() const
+{
+    return toDense(matrix());
+}
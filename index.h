@@ -0,0 +1,145 @@
+/******************************************************************************
+ * Filename: index.h
+ * Author: Zachary Colbert
+ * Contact: zcolbert@sfsu.edu
+ *
+ * Description: Interface of the binary corpus index, which stores the
+ *              vocabulary, the normalized document vectors, their postings
+ *              and the original vector norms, so later runs can map the file
+ *              instead of re-tokenizing the corpus.
+ *
+ *              File layout, all integers little-endian:
+ *                  IndexHeader (magic, version, shape, section offsets)
+ *                  vocabulary  uint64[cols]        packed ngram of each column
+ *                  norms       float[rows]         length of each raw TF row
+ *                  row_ptr     uint64[rows + 1]    CSR rows of the normalized matrix
+ *                  col_idx     uint32[nnz]
+ *                  values      float[nnz]
+ *                  post_ptr    uint64[cols + 1]    CSR rows of its transpose
+ *                  post_idx    uint32[nnz]
+ *                  post_values float[nnz]
+ *              Every section starts on a 64-byte boundary.
+ *****************************************************************************/
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "dictionary.h"
+#include "mapped_file.h"
+#include "sparse.h"
+
+
+/** The first 8 bytes of an index file. */
+constexpr char index_magic[8] = {'L', 'T', 'S', 'I', 'N', 'D', 'E', 'X'};
+
+/** Incremented whenever the file layout changes. */
+constexpr uint32_t index_version = 1;
+
+/** Alignment of every section in an index file. */
+constexpr size_t index_alignment = 64;
+
+/** The fixed-size header at the start of an index file. */
+struct IndexHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t ngram_len;
+    uint64_t rows;              // Documents
+    uint64_t cols;              // Vocabulary size
+    uint64_t nnz;               // Non-zero elements of the matrix
+    uint64_t vocabulary;        // Byte offset of each section
+    uint64_t norms;
+    uint64_t row_ptr;
+    uint64_t col_idx;
+    uint64_t values;
+    uint64_t post_ptr;
+    uint64_t post_idx;
+    uint64_t post_values;
+};
+
+/**
+ * Write an index of a normalized term frequency matrix.
+ *
+ * The file is written to a temporary path and renamed, so a concurrent reader
+ * never maps half a file.
+ *
+ * @param path The path of the index file.
+ * @param dictionary The dictionary which assigned the token IDs. Must hold packed ngrams.
+ * @param vocabulary The token IDs of the columns, in column order.
+ * @param matrix The row-normalized term frequency matrix.
+ * @param norms The length of each row before normalization.
+ * @return False if the file could not be written.
+ */
+bool writeIndex(const std::string& path, const TokenDictionary& dictionary, const std::vector<uint32_t>& vocabulary,
+                const CsrMatrix& matrix, const std::vector<float>& norms);
+
+/**
+ * Write an index of a normalized term frequency matrix whose vocabulary is given as packed ngrams.
+ *
+ * @param path The path of the index file.
+ * @param ngram_len The ngram length of the vocabulary.
+ * @param keys The packed ngram of each column.
+ * @param matrix The row-normalized term frequency matrix.
+ * @param norms The length of each row before normalization.
+ * @return False if the file could not be written.
+ */
+bool writeIndex(const std::string& path, size_t ngram_len, const std::vector<uint64_t>& keys,
+                const CsrMatrix& matrix, const std::vector<float>& norms);
+
+/**
+ * A read-only, memory-mapped index file.
+ *
+ * The accessors point straight into the mapping, so nothing is copied on load.
+ * The header, the section bounds, the row offsets and the column indices are validated
+ * when the file is opened.
+ */
+class CorpusIndex
+{
+public:
+    /**
+     * Map and validate the index file at the given path.
+     * @param path The path of the index file.
+     */
+    explicit CorpusIndex(const std::string& path);
+
+    /** @return True if the file was mapped and is a valid index. */
+    bool isOpen() const { return header != nullptr; }
+
+    /** @return A description of why the file could not be opened. */
+    const std::string& error() const { return message; }
+
+    /** @return The number of documents. */
+    size_t rows() const { return header->rows; }
+
+    /** @return The number of vocabulary columns. */
+    size_t cols() const { return header->cols; }
+
+    /** @return The ngram length of the vocabulary. */
+    size_t ngramLength() const { return header->ngram_len; }
+
+    /** @return The packed ngram of each column. */
+    const uint64_t* vocabulary() const { return section<uint64_t>(header->vocabulary); }
+
+    /** @return The length of each document vector before normalization. */
+    const float* norms() const { return section<float>(header->norms); }
+
+    /** @return The row-normalized documents x vocabulary matrix. */
+    CsrView matrix() const;
+
+    /** @return The transpose of matrix(): for each column, the documents containing it. */
+    CsrView postings() const;
+
+    /** @return The normalized matrix expanded to a dense row-wise matrix. */
+    std::vector<float> denseMatrix() const;
+
+private:
+    template <typename T>
+    const T* section(uint64_t offset) const { return reinterpret_cast<const T*>(file.data() + offset); }
+
+    MappedFile file;
+    const IndexHeader* header = nullptr;
+    std::string message;
+};
@@ -0,0 +1,261 @@
+/******************************************************************************
+ * Filename: join.cpp
+ * Author: Zachary Colbert
+ * Contact: zcolbert@sfsu.edu
+ *
+ * Description: Implementation of the exact threshold similarity join.
+ *
+ *      For a vector y whose features are ordered from most to least frequent,
+ *      let y' be its longest prefix whose bound
+ *          min(sum y'[f] * maxweight[f], |y'|)
+ *      is below the threshold t, where maxweight[f] is the largest weight of
+ *      feature f in any vector. Both terms bound the dot product of y' with
+ *      any unit vector. Only the features after y' are indexed, so a pair
+ *      which shares no indexed feature of y scores less than t.
+ *
+ *      Each vector x probes the index from its rarest feature down. Once the
+ *      bound of the features it has left falls below t, no pair which has not
+ *      met yet can reach t, so only existing candidates are accumulated. Where
+ *      x and y meet at feature f, every shared feature ranked above f has been
+ *      counted, so the rest of their dot product is at most the product of the
+ *      lengths of x and y before f. Each posting stores that length of y, and
+ *      a candidate whose partial score plus the product falls below t is
+ *      dropped at once. A surviving candidate is dropped if its partial score
+ *      plus the bound of y' is below t, and otherwise its score is completed
+ *      from y' against a dense copy of x.
+ *****************************************************************************/
+
+#include "join.h"
+
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+
+#include <omp.h>
+
+
+/** States of a document while a vector is matched against the index. */
+static constexpr uint8_t unseen = 0;
+static constexpr uint8_t live = 1;
+static constexpr uint8_t pruned = 2;
+
+/**
+ * The dot product bound of a prefix, from its weights times the largest weights of its features
+ * and from its Euclidean length.
+ */
+static double prefixBound(double weighted, double squared)
+{
+    return std::min(weighted, std::sqrt(std::max(0.0, squared)));
+}
+
+/**
+ * Find every pair of rows i < j whose dot product is at least the threshold.
+ *
+ * @param matrix The N x M sparse matrix of row-normalized document vectors.
+ * @param threshold The smallest score reported. Must be greater than zero, as pairs
+ *                  without a shared feature are never considered.
+ * @param stats Receives the amount of work pruned at each stage.
+ * @return The pairs at or above the threshold, sorted by row and then column.
+ */
+std::vector<ScorePair> thresholdJoin(const CsrView& matrix, float threshold, JoinStats& stats)
+{
+    const size_t n = matrix.rows;
+    const size_t m = matrix.cols;
+    const size_t nnz = matrix.nonZeros();
+    stats = JoinStats{};
+    stats.pairs = static_cast<uint64_t>(n) * (n > 0 ? n - 1 : 0) / 2;
+    stats.nonzeros = nnz;
+
+    // Rank the features from most to least frequent, so the unindexed prefixes hold the common ngrams
+    std::vector<size_t> frequency(m, 0);
+    for (size_t p = 0; p < nnz; ++p) {
+        ++frequency[matrix.col_idx[p]];
+    }
+    std::vector<uint32_t> order(m);
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) { return frequency[a] > frequency[b]; });
+    std::vector<uint32_t> rank(m);
+    for (size_t r = 0; r < m; ++r) {
+        rank[order[r]] = static_cast<uint32_t>(r);
+    }
+
+    // Reorder each row by rank, and find the largest weight of each feature
+    std::vector<uint32_t> features(nnz);
+    std::vector<float> weights(nnz);
+    std::vector<float> max_weight(m, 0.0f);
+    #pragma omp parallel
+    {
+        std::vector<std::pair<uint32_t, float>> row;
+        #pragma omp for schedule(dynamic, 64)
+        for (size_t i = 0; i < n; ++i)
+        {
+            row.clear();
+            for (size_t p = matrix.row_ptr[i]; p < matrix.row_ptr[i + 1]; ++p) {
+                row.emplace_back(rank[matrix.col_idx[p]], matrix.values[p]);
+            }
+            std::sort(row.begin(), row.end());
+            for (size_t e = 0; e < row.size(); ++e)
+            {
+                features[matrix.row_ptr[i] + e] = row[e].first;
+                weights[matrix.row_ptr[i] + e] = row[e].second;
+            }
+        }
+    }
+    for (size_t p = 0; p < nnz; ++p) {
+        max_weight[features[p]] = std::max(max_weight[features[p]], std::fabs(weights[p]));
+    }
+
+    // Split each row into its unindexed prefix and its indexed remainder
+    std::vector<size_t> split(n);
+    std::vector<float> prefix_bound(n);
+    std::vector<size_t> post_ptr(m + 1, 0);
+    for (size_t i = 0; i < n; ++i)
+    {
+        double weighted = 0.0;
+        double squared = 0.0;
+        size_t p = matrix.row_ptr[i];
+        for (; p < matrix.row_ptr[i + 1]; ++p)
+        {
+            const double w = std::fabs(weights[p]);
+            if (prefixBound(weighted + w * max_weight[features[p]], squared + w * w) >= threshold) {
+                break;
+            }
+            weighted += w * max_weight[features[p]];
+            squared += w * w;
+        }
+        split[i] = p;
+        prefix_bound[i] = static_cast<float>(prefixBound(weighted, squared));
+        for (; p < matrix.row_ptr[i + 1]; ++p) {
+            ++post_ptr[features[p] + 1];
+        }
+    }
+    std::partial_sum(post_ptr.begin(), post_ptr.end(), post_ptr.begin());
+    stats.indexed = post_ptr[m];
+
+    // The postings of each feature list their documents in increasing order, with the length
+    // of each document's vector before the feature
+    std::vector<uint32_t> post_doc(post_ptr[m]);
+    std::vector<float> post_weight(post_ptr[m]);
+    std::vector<float> post_norm(post_ptr[m]);
+    {
+        std::vector<size_t> next(post_ptr.begin(), post_ptr.end() - 1);
+        for (size_t i = 0; i < n; ++i)
+        {
+            double squared = 0.0;
+            for (size_t p = matrix.row_ptr[i]; p < matrix.row_ptr[i + 1]; ++p)
+            {
+                if (p >= split[i])
+                {
+                    const size_t q = next[features[p]]++;
+                    post_doc[q] = static_cast<uint32_t>(i);
+                    post_weight[q] = weights[p];
+                    post_norm[q] = static_cast<float>(std::sqrt(squared));
+                }
+                squared += static_cast<double>(weights[p]) * weights[p];
+            }
+        }
+    }
+
+    // Each row is matched against the rows before it, so every pair is found once
+    const size_t threads = static_cast<size_t>(omp_get_max_threads());
+    std::vector<std::vector<ScorePair>> found(threads);
+    uint64_t candidates = 0;
+    uint64_t bound_pruned = 0;
+    uint64_t verified = 0;
+
+    #pragma omp parallel reduction(+:candidates, bound_pruned, verified)
+    {
+        std::vector<ScorePair>& local = found[static_cast<size_t>(omp_get_thread_num())];
+        std::vector<float> score(n, 0.0f);
+        std::vector<uint8_t> state(n, unseen);
+        std::vector<uint32_t> touched;
+        std::vector<double> remaining;
+        std::vector<float> before;     // Length of x before each of its features
+        std::vector<float> dense(m, 0.0f);
+
+        #pragma omp for schedule(dynamic, 16)
+        for (size_t x = 0; x < n; ++x)
+        {
+            const size_t first = matrix.row_ptr[x];
+            const size_t last = matrix.row_ptr[x + 1];
+
+            // remaining[e] bounds the dot product of the first e + 1 features of x with any vector
+            remaining.resize(last - first);
+            before.resize(last - first);
+            double weighted = 0.0;
+            double squared = 0.0;
+            for (size_t p = first; p < last; ++p)
+            {
+                const double w = std::fabs(weights[p]);
+                before[p - first] = static_cast<float>(std::sqrt(squared));
+                weighted += w * max_weight[features[p]];
+                squared += w * w;
+                remaining[p - first] = prefixBound(weighted, squared);
+                dense[features[p]] = weights[p];
+            }
+
+            for (size_t p = last; p-- > first; )
+            {
+                const bool admit = remaining[p - first] >= threshold;
+                const float w = weights[p];
+                const float x_before = before[p - first];
+                const uint32_t f = features[p];
+                for (size_t q = post_ptr[f]; q < post_ptr[f + 1] && post_doc[q] < x; ++q)
+                {
+                    const uint32_t y = post_doc[q];
+                    if (state[y] != live)
+                    {
+                        if (state[y] == pruned || !admit) {
+                            continue;
+                        }
+                        state[y] = live;
+                        touched.push_back(y);
+                    }
+                    score[y] += w * post_weight[q];
+                    if (score[y] + x_before * post_norm[q] < threshold) {
+                        state[y] = pruned;
+                    }
+                }
+            }
+
+            candidates += touched.size();
+            for (uint32_t y: touched)
+            {
+                float s = score[y];
+                const bool alive = state[y] == live;
+                score[y] = 0.0f;
+                state[y] = unseen;
+                if (!alive || s + prefix_bound[y] < threshold) {
+                    ++bound_pruned;
+                    continue;
+                }
+
+                // Complete the score with the unindexed prefix of y
+                ++verified;
+                for (size_t q = matrix.row_ptr[y]; q < split[y]; ++q) {
+                    s += dense[features[q]] * weights[q];
+                }
+                if (s >= threshold) {
+                    local.push_back({y, static_cast<uint32_t>(x), s});
+                }
+            }
+            touched.clear();
+            for (size_t p = first; p < last; ++p) {
+                dense[features[p]] = 0.0f;
+            }
+        }
+    }
+    stats.candidates = candidates;
+    stats.bound_pruned = bound_pruned;
+    stats.verified = verified;
+
+    std::vector<ScorePair> pairs;
+    for (const auto& local: found) {
+        pairs.insert(pairs.end(), local.begin(), local.end());
+    }
+    std::sort(pairs.begin(), pairs.end(), [](const ScorePair& lhs, const ScorePair& rhs) {
+        return lhs.row < rhs.row || (lhs.row == rhs.row && lhs.col < rhs.col);
+    });
+    stats.results = pairs.size();
+    return pairs;
+}
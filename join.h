@@ -0,0 +1,55 @@
+/******************************************************************************
+ * Filename: join.h
+ * Author: Zachary Colbert
+ * Contact: zcolbert@sfsu.edu
+ *
+ * Description: Interface of the exact threshold similarity join, which finds
+ *              every pair of documents whose cosine similarity reaches a
+ *              threshold without scoring all N^2 pairs.
+ *
+ *              The join follows All-Pairs (Bayardo, Ma and Srikant) with the
+ *              L2 bounds of L2AP (Anastasiu and Karypis). Features are ordered
+ *              from most to least frequent. The leading features of each
+ *              vector, up to where they could first contribute the threshold,
+ *              are left out of the index, so the long posting lists of common
+ *              ngrams are mostly never built. A pair can only reach the
+ *              threshold if it meets in the index, and each candidate is
+ *              dropped when its partial score plus the norm of the unindexed
+ *              prefix still falls short.
+ *****************************************************************************/
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "sparse.h"
+#include "stream.h"
+
+
+/** What a threshold join did. */
+struct JoinStats
+{
+    uint64_t pairs = 0;         // N (N - 1) / 2, the pairs a full computation scores
+    uint64_t nonzeros = 0;      // Non-zero elements of the vectors
+    uint64_t indexed = 0;       // Non-zero elements placed in the index
+    uint64_t candidates = 0;    // Pairs which met in the index and were accumulated
+    uint64_t bound_pruned = 0;  // Candidates dropped by a norm bound before their score was completed
+    uint64_t verified = 0;      // Candidates whose dot product was completed
+    uint64_t results = 0;       // Pairs at or above the threshold
+};
+
+/**
+ * Find every pair of rows i < j whose dot product is at least the threshold.
+ *
+ * The result is exact: no pair at or above the threshold is pruned. Its scores are
+ * summed in a different order from the multiply kernels, so they may differ from
+ * theirs by float rounding.
+ *
+ * @param matrix The N x M sparse matrix of row-normalized document vectors.
+ * @param threshold The smallest score reported. Must be greater than zero, as pairs
+ *                  without a shared feature are never considered.
+ * @param stats Receives the amount of work pruned at each stage.
+ * @return The pairs at or above the threshold, sorted by row and then column.
+ */
+std::vector<ScorePair> thresholdJoin(const CsrView& matrix, float threshold, JoinStats& stats);
@@ -9,7 +9,9 @@
 
 #include "linear.h"
 
+#include <algorithm>
 #include <cmath>    // sqrt
+#include <fstream>
 #include <iostream>
 #include <iomanip>
 #include <omp.h>
@@ -35,6 +37,7 @@ float magnitude(const std::vector<float>& elements, size_t start, size_t end)
 
 /**
  * Normalize a vector row in the given matrix existing at [start, end).
+ * A row of zeros is left unchanged, so it scores 0 against every row.
  *
  * @param matrix A row-wise matrix of vector elements.
  * @param start The starting index of this row.
@@ -43,6 +46,9 @@ float magnitude(const std::vector<float>& elements, size_t start, size_t end)
 void normalizeRow(std::vector<float>& matrix, size_t start, size_t end)
 {
     float mag = magnitude(matrix, start, end);
+    if (mag == 0.0f) {
+        return;
+    }
     for (size_t i = start; i < end; ++i) {
         matrix[i] = matrix[i] / mag;
     }
@@ -120,6 +126,36 @@ std::vector<float> getTermFrequencyMatrix(
     return matrix;
 }
 
+/**
+ * Construct a dense term frequency matrix from token counts indexed by token ID.
+ *
+ * @param docs The token counts of each document.
+ * @param vocabulary The token IDs defining the column space, in column order.
+ * @param rows The number of rows in the matrix (documents).
+ * @param cols The number of columns in the matrix (vocabulary size).
+ * @return A row-wise rows x cols matrix of term frequencies.
+ */
+std::vector<float> getTermFrequencyMatrix(
+        const DocumentTokenCounts& docs,
+        const std::vector<uint32_t>& vocabulary,
+        size_t rows, size_t cols)
+{
+    std::vector<float> matrix(rows * cols, 0);
+    const std::vector<uint32_t> columns = getColumnMap(vocabulary);
+
+    // Only the tokens present in each document are visited
+    for (size_t i = 0; i < docs.size() && i < rows; ++i)
+    {
+        for (const auto& tc: docs[i])
+        {
+            if (tc.first < columns.size() && columns[tc.first] != no_column) {
+                matrix[i * cols + columns[tc.first]] = static_cast<float>(tc.second);
+            }
+        }
+    }
+    return matrix;
+}
+
 void printRow(const std::vector<float>& matrix, size_t start, size_t end)
 {
     std::cout << std::setprecision(2) << std::fixed;
@@ -140,6 +176,39 @@ void printMatrix(const std::vector<float>& matrix, size_t rows, size_t cols)
     }
 }
 
+/**
+ * Write a matrix to a CSV file at full precision, in the layout written by pandas
+ * DataFrame.to_csv(): a header row of column indices, then each row prefixed by its index.
+ *
+ * @param path The path of the file to write.
+ * @param matrix The row-wise matrix.
+ * @param rows The number of rows in the matrix.
+ * @param cols The number of columns in each row.
+ * @return False if the file could not be written.
+ */
+bool writeMatrixCsv(const std::string& path, const std::vector<float>& matrix, size_t rows, size_t cols)
+{
+    std::ofstream outfile(path);
+    if (!outfile) {
+        return false;
+    }
+    // Enough digits to read every float back exactly
+    outfile << std::setprecision(9);
+    for (size_t j = 0; j < cols; ++j) {
+        outfile << ',' << j;
+    }
+    outfile << '\n';
+    for (size_t i = 0; i < rows; ++i)
+    {
+        outfile << i;
+        for (size_t j = 0; j < cols; ++j) {
+            outfile << ',' << matrix[i * cols + j];
+        }
+        outfile << '\n';
+    }
+    return static_cast<bool>(outfile);
+}
+
 std::vector<float> matrixMultiply_ijk(const std::vector<float>& lhs, const std::vector<float>& rhs, size_t n, size_t m)
 {
     std::vector<float> result(n * n, 0);
@@ -270,100 +339,342 @@ void matrixMultiply_kij(const std::vector<float>& lhs, const std::vector<float>&
 {
     #pragma omp parallel
     {
-        // omp_get_num_threads() binds inside of the innermost closing parallel region.
-        // Usage outside of a parallel region will indicate only a single thread
-        if (omp_get_num_threads() > 1)
-        {
-            // Create thread-local storage to hold results of computation in each thread
-            // Each thread will have its own copy of this vector, producing a partial result
-            std::vector<float> tls(result.size(), 0);
+        // Partition the rows of the result between the threads. Each thread keeps the k-i-j
+        // loop order over its own rows, so no two threads ever write the same element and
+        // no reduction or thread-local copy of the result is needed.
+        const size_t nthreads = omp_get_num_threads();
+        const size_t tid = omp_get_thread_num();
+        const size_t i_begin = n * tid / nthreads;
+        const size_t i_end = n * (tid + 1) / nthreads;
 
-            #pragma omp for
-            for (int k = 0; k < m; ++k) {
-                for (int i = 0; i < n; ++i) {
-                    for (int j = 0; j < n; ++j) {
-                        tls[i * n + j] += lhs[i * m + k] * rhs[k * n + j];
-                    }
+        for (size_t k = 0; k < m; ++k) {
+            for (size_t i = i_begin; i < i_end; ++i) {
+                for (size_t j = 0; j < n; ++j) {
+                    result[i * n + j] += lhs[i * m + k] * rhs[k * n + j];
+                }
+            }
+        }
+    }
+}
+void matrixMultiply_kji(const std::vector<float>& lhs, const std::vector<float>& rhs, std::vector<float>& result, size_t n, size_t m)
+{
+    #pragma omp parallel
+    {
+        // Partition the columns of the result between the threads, keeping the k-j-i
+        // loop order over each thread's own columns.
+        const size_t nthreads = omp_get_num_threads();
+        const size_t tid = omp_get_thread_num();
+        const size_t j_begin = n * tid / nthreads;
+        const size_t j_end = n * (tid + 1) / nthreads;
+
+        for (size_t k = 0; k < m; ++k) {
+            for (size_t j = j_begin; j < j_end; ++j) {
+                for (size_t i = 0; i < n; ++i) {
+                    result[i * n + j] += lhs[i * m + k] * rhs[k * n + j];
                 }
             }
-            // Consolidate the thread local results into the shared result vector
-            for (size_t i = 0; i < tls.size(); ++i) {
-                #pragma omp atomic
-                result[i] += tls[i];
+        }
+    }
+}
+
+/************************** Symmetric self-multiplication *******************************/
+
+// Rows per tile of the result, and columns of the operand consumed per pass over a tile
+static const size_t syrk_tile = 64;
+static const size_t syrk_depth = 256;
+
+/**
+ * Accumulate the dot products of MI rows of a with MJ rows of b over len columns.
+ * Each dot product is split across 8 independent lanes so the compiler can vectorize
+ * the loop without reordering any single sum.
+ *
+ * @param a The first of MI rows, each separated by stride elements.
+ * @param b The first of MJ rows, each separated by stride elements.
+ * @param stride The distance between consecutive rows.
+ * @param len The number of columns to include.
+ * @param out The MI x MJ output, with rows separated by ldo elements.
+ * @param ldo The distance between consecutive output rows.
+ */
+template <int MI, int MJ>
+static void dotRows(const float* a, const float* b, size_t stride, size_t len, float* out, size_t ldo)
+{
+    float acc[MI][MJ][8] = {};
+    size_t k = 0;
+    for (; k + 8 <= len; k += 8) {
+        for (int x = 0; x < MI; ++x) {
+            for (int y = 0; y < MJ; ++y) {
+                for (int l = 0; l < 8; ++l) {
+                    acc[x][y][l] += a[x * stride + k + l] * b[y * stride + k + l];
+                }
             }
         }
-        else  // Thread local storage is not necessary. Perform operations directly into result.
+    }
+    for (int x = 0; x < MI; ++x) {
+        for (int y = 0; y < MJ; ++y)
         {
-            for (int k = 0; k < m; ++k) {
-                for (int i = 0; i < n; ++i) {
-                    for (int j = 0; j < n; ++j) {
-                        result[i * n + j] += lhs[i * m + k] * rhs[k * n + j];
-                    }
-                }
+            float sum = 0.0f;
+            for (int l = 0; l < 8; ++l) {
+                sum += acc[x][y][l];
+            }
+            for (size_t r = k; r < len; ++r) {
+                sum += a[x * stride + r] * b[y * stride + r];
             }
+            out[x * ldo + y] += sum;
         }
     }
 }
-void matrixMultiply_kji(const std::vector<float>& lhs, const std::vector<float>& rhs, std::vector<float>& result, size_t n, size_t m)
+
+/**
+ * Compute one tile of lhs x transpose(rhs) for row-major operands.
+ *
+ * @param lhs The first row of the tile's lhs rows.
+ * @param rows The number of lhs rows in the tile.
+ * @param rhs The first row of the tile's rhs rows.
+ * @param cols The number of rhs rows in the tile.
+ * @param m The number of columns of both operands.
+ * @param tile The rows x cols output, with rows separated by ldt elements. Must be zeroed.
+ * @param ldt The distance between consecutive rows of the tile.
+ * @param upper_only If true, skip the micro-tiles entirely below the diagonal of a square tile.
+ */
+static void multiplyTileTransposed(const float* lhs, size_t rows, const float* rhs, size_t cols, size_t m,
+                                   float* tile, size_t ldt, bool upper_only)
+{
+    for (size_t kb = 0; kb < m; kb += syrk_depth)
+    {
+        const size_t len = std::min(syrk_depth, m - kb);
+        size_t i = 0;
+        for (; i + 4 <= rows; i += 4)
+        {
+            size_t j = upper_only ? i : 0;
+            for (; j + 2 <= cols; j += 2) {
+                dotRows<4, 2>(lhs + i * m + kb, rhs + j * m + kb, m, len, tile + i * ldt + j, ldt);
+            }
+            for (; j < cols; ++j) {
+                dotRows<4, 1>(lhs + i * m + kb, rhs + j * m + kb, m, len, tile + i * ldt + j, ldt);
+            }
+        }
+        for (; i < rows; ++i) {
+            for (size_t j = upper_only ? i : 0; j < cols; ++j) {
+                dotRows<1, 1>(lhs + i * m + kb, rhs + j * m + kb, m, len, tile + i * ldt + j, ldt);
+            }
+        }
+    }
+}
+
+/**
+ * Compute every tile on and above the diagonal of matrix x transpose(matrix), and pass
+ * each finished tile to the store function.
+ *
+ * @param matrix The row-wise N x M operand.
+ * @param n The number of rows in the matrix.
+ * @param m The number of columns in the matrix.
+ * @param store Called as store(tile, i0, j0, rows, cols) with the tile rows separated by syrk_tile.
+ */
+template <typename Store>
+static void forEachUpperTile(const std::vector<float>& matrix, size_t n, size_t m, Store store)
 {
+    // Enumerate the tile pairs (bi, bj) with bj >= bi so they can be scheduled together
+    const size_t blocks = (n + syrk_tile - 1) / syrk_tile;
+    std::vector<std::pair<size_t, size_t>> pairs;
+    pairs.reserve(blocks * (blocks + 1) / 2);
+    for (size_t bi = 0; bi < blocks; ++bi) {
+        for (size_t bj = bi; bj < blocks; ++bj) {
+            pairs.emplace_back(bi, bj);
+        }
+    }
+
     #pragma omp parallel
     {
-        // omp_get_num_threads() binds inside of the innermost closing parallel region.
-        // Usage outside of a parallel region will indicate only a single thread
-        if (omp_get_num_threads() > 1)
+        std::vector<float> tile(syrk_tile * syrk_tile);
+
+        #pragma omp for schedule(dynamic)
+        for (size_t p = 0; p < pairs.size(); ++p)
         {
-            // Create thread-local storage to hold results of computation in each thread
-            // Each thread will have its own copy of this vector, producing a partial result
-            std::vector<float> tls(result.size(), 0);
+            const size_t i0 = pairs[p].first * syrk_tile;
+            const size_t j0 = pairs[p].second * syrk_tile;
+            const size_t rows = std::min(syrk_tile, n - i0);
+            const size_t cols = std::min(syrk_tile, n - j0);
 
-            #pragma omp for
-            for (int k = 0; k < m; ++k) {
-                for (int j = 0; j < n; ++j) {
-                    for (int i = 0; i < n; ++i) {
-                        tls[i * n + j] += lhs[i * m + k] * rhs[k * n + j];
-                    }
+            std::fill(tile.begin(), tile.end(), 0.0f);
+            multiplyTileTransposed(&matrix[i0 * m], rows, &matrix[j0 * m], cols, m,
+                                   tile.data(), syrk_tile, i0 == j0);
+            store(tile.data(), i0, j0, rows, cols);
+        }
+    }
+}
+
+/**
+ * Accumulate matrix x transpose(matrix) into a full N x N result, reading the rows of the
+ * row-major matrix directly. Only the tiles on and above the diagonal are computed.
+ *
+ * @param matrix The row-wise N x M operand.
+ * @param result The N x N result. The upper triangle (j >= i) receives the sum of the products.
+ * @param n The number of rows in the matrix.
+ * @param m The number of columns in the matrix.
+ * @param mirror If true, also write each computed element to its mirrored position below the diagonal.
+ */
+void matrixSelfMultiply(const std::vector<float>& matrix, std::vector<float>& result, size_t n, size_t m, bool mirror)
+{
+    forEachUpperTile(matrix, n, m, [&](const float* tile, size_t i0, size_t j0, size_t rows, size_t cols) {
+        for (size_t i = 0; i < rows; ++i)
+        {
+            // Within a diagonal tile, only the elements on and above the diagonal are valid
+            for (size_t j = (i0 == j0 ? i : 0); j < cols; ++j)
+            {
+                const float value = tile[i * syrk_tile + j];
+                result[(i0 + i) * n + (j0 + j)] += value;
+                if (mirror && (i0 + i) != (j0 + j)) {
+                    result[(j0 + j) * n + (i0 + i)] += value;
                 }
             }
-            // Consolidate the thread local results into the shared result vector
-            for (size_t i = 0; i < tls.size(); ++i) {
-                #pragma omp atomic
-                result[i] += tls[i];
-            }
         }
-        else  // Thread local storage is not necessary. Perform operations directly into result.
+    });
+}
+
+/**
+ * Compute matrix x transpose(matrix) and store it as a packed upper triangle (see packedIndex()).
+ *
+ * @param matrix The row-wise N x M operand.
+ * @param n The number of rows in the matrix.
+ * @param m The number of columns in the matrix.
+ * @return The N * (N + 1) / 2 elements of the upper triangle.
+ */
+std::vector<float> matrixSelfMultiplyPacked(const std::vector<float>& matrix, size_t n, size_t m)
+{
+    std::vector<float> packed(n * (n + 1) / 2, 0);
+
+    forEachUpperTile(matrix, n, m, [&](const float* tile, size_t i0, size_t j0, size_t rows, size_t cols) {
+        for (size_t i = 0; i < rows; ++i)
         {
-            for (int k = 0; k < m; ++k) {
-                for (int j = 0; j < n; ++j) {
-                    for (int i = 0; i < n; ++i) {
-                        result[i * n + j] += lhs[i * m + k] * rhs[k * n + j];
-                    }
-                }
+            const size_t first = (i0 == j0 ? i : 0);
+            float* dest = &packed[packedIndex(i0 + i, j0 + first, n)];
+            for (size_t j = first; j < cols; ++j) {
+                *dest++ = tile[i * syrk_tile + j];
             }
         }
+    });
+    return packed;
+}
+
+/**
+ * Accumulate a horizontal stripe of lhs x transpose(rhs), for row-major operands which
+ * share the same number of columns. Uses the same tiled kernel as matrixSelfMultiply().
+ *
+ * @param lhs The row-wise left-hand operand, with M columns.
+ * @param first The first lhs row of the stripe.
+ * @param count The number of lhs rows in the stripe.
+ * @param rhs The row-wise right-hand operand before transposition, with dimensions P x M.
+ * @param p The number of rows in rhs.
+ * @param m The number of columns in both operands.
+ * @param result The row-wise count x P stripe which receives the sum of the products.
+ */
+void matrixMultiplyTransposed(const std::vector<float>& lhs, size_t first, size_t count,
+                              const std::vector<float>& rhs, size_t p, size_t m,
+                              std::vector<float>& result)
+{
+    const size_t row_blocks = (count + syrk_tile - 1) / syrk_tile;
+    const size_t col_blocks = (p + syrk_tile - 1) / syrk_tile;
+
+    // Each tile of the stripe is written by exactly one thread
+    #pragma omp parallel for collapse(2) schedule(dynamic)
+    for (size_t bi = 0; bi < row_blocks; ++bi) {
+        for (size_t bj = 0; bj < col_blocks; ++bj)
+        {
+            const size_t i0 = bi * syrk_tile;
+            const size_t j0 = bj * syrk_tile;
+            multiplyTileTransposed(&lhs[(first + i0) * m], std::min(syrk_tile, count - i0),
+                                   &rhs[j0 * m], std::min(syrk_tile, p - j0), m,
+                                   &result[i0 * p + j0], p, false);
+        }
     }
 }
 
+/**
+ * Expand a packed upper triangle into a full symmetric N x N matrix.
+ *
+ * @param packed The packed upper triangle.
+ * @param n The number of rows and columns of the full matrix.
+ * @return The full row-wise matrix.
+ */
+std::vector<float> unpackSymmetric(const std::vector<float>& packed, size_t n)
+{
+    std::vector<float> full(n * n);
+    for (size_t i = 0; i < n; ++i) {
+        for (size_t j = i; j < n; ++j) {
+            full[i * n + j] = full[j * n + i] = packed[packedIndex(i, j, n)];
+        }
+    }
+    return full;
+}
+
 /************************** Block/Copy optimization *******************************/
-void readBlock(std::vector<float>& dest, const std::vector<float>& src, size_t start_row, size_t start_col, size_t n, size_t blocksize)
+
+/**
+ * Copy a blocksize x blocksize block out of a row-wise matrix. Elements of the block which
+ * fall outside of the matrix are set to zero, so edge blocks can be processed like full blocks.
+ *
+ * @param dest The blocksize x blocksize destination block.
+ * @param src The row-wise source matrix.
+ * @param start_row The first row of the block within the matrix.
+ * @param start_col The first column of the block within the matrix.
+ * @param rows The number of rows of the source matrix.
+ * @param cols The number of columns of the source matrix.
+ * @param blocksize The number of rows and columns in a block.
+ */
+void readBlock(std::vector<float>& dest, const std::vector<float>& src, size_t start_row, size_t start_col,
+               size_t rows, size_t cols, size_t blocksize)
 {
-    std::vector<float> block;
-    block.reserve(blocksize * blocksize);
+    const size_t valid_rows = std::min(blocksize, rows - start_row);
+    const size_t valid_cols = std::min(blocksize, cols - start_col);
 
     for (size_t i = 0; i < blocksize; ++i) {
         for (size_t j = 0; j < blocksize; ++j) {
-            dest[i * blocksize + j] = src[(i + start_row) * n + (j + start_col)];
+            dest[i * blocksize + j] = (i < valid_rows && j < valid_cols)
+                    ? src[(i + start_row) * cols + (j + start_col)] : 0.0f;
         }
     }
 }
 
-void writeBlock(std::vector<float>& dest, const std::vector<float>& src, size_t start_row, size_t start_col, size_t n, size_t blocksize)
+/**
+ * Copy a block into a row-wise matrix. Elements of the block which fall outside of the
+ * matrix are discarded.
+ *
+ * @param dest The row-wise destination matrix.
+ * @param src The blocksize x blocksize source block.
+ * @param start_row The first row of the block within the matrix.
+ * @param start_col The first column of the block within the matrix.
+ * @param rows The number of rows of the destination matrix.
+ * @param cols The number of columns of the destination matrix.
+ * @param blocksize The number of rows and columns in a block.
+ */
+void writeBlock(std::vector<float>& dest, const std::vector<float>& src, size_t start_row, size_t start_col,
+                size_t rows, size_t cols, size_t blocksize)
 {
-    for (size_t i = 0; i < blocksize; ++i) {
-        for (size_t j = 0; j < blocksize; ++j) {
-            dest[(i + start_row) * n + (j + start_col)] = src[i * blocksize + j];
+    const size_t valid_rows = std::min(blocksize, rows - start_row);
+    const size_t valid_cols = std::min(blocksize, cols - start_col);
+
+    for (size_t i = 0; i < valid_rows; ++i) {
+        for (size_t j = 0; j < valid_cols; ++j) {
+            dest[(i + start_row) * cols + (j + start_col)] = src[i * blocksize + j];
         }
     }
 }
+
+/**
+ * Perform the matrix multiplication lhs x rhs one block at a time, accumulating into result.
+ *
+ * Every block of lhs and rhs is copied once into its own contiguous, zero-padded buffer,
+ * so matrices of any size can be used and no block is copied again for each pair of
+ * output blocks. The output blocks are computed in parallel, each by a single thread.
+ *
+ * @param mmfunc The multiply kernel applied to each pair of blocks.
+ * @param lhs The left-hand operand matrix, with dimensions N x M.
+ * @param rhs The right-hand operand matrix, with dimensions M x N.
+ * @param result The N x N result matrix.
+ * @param n The number of rows in the left matrix, columns in the right matrix.
+ * @param m The number of columns in the left matrix, rows in the right matrix.
+ * @param blocksize The number of rows and columns in a block.
+ */
 void matrixMultiply_bco(
         void(*mmfunc)(const std::vector<float>&, const std::vector<float>&, std::vector<float>&, size_t, size_t),
         const std::vector<float>& lhs,
@@ -371,22 +682,45 @@ void matrixMultiply_bco(
         std::vector<float>& result,
         size_t n, size_t m, size_t blocksize)
 {
-    std::vector<float> ablock(blocksize * blocksize);
-    std::vector<float> bblock(blocksize * blocksize);
-    std::vector<float> cblock(blocksize * blocksize);
+    if (blocksize == 0) {
+        mmfunc(lhs, rhs, result, n, m);
+        return;
+    }
 
-    for (size_t i = 0; i < n; i += blocksize)
+    const size_t n_blocks = (n + blocksize - 1) / blocksize;
+    const size_t m_blocks = (m + blocksize - 1) / blocksize;
+    const size_t block_len = blocksize * blocksize;
+
+    // Pack every block of both operands once: lhs blocks are indexed (i, k), rhs blocks (k, j)
+    std::vector<std::vector<float>> a_blocks(n_blocks * m_blocks);
+    std::vector<std::vector<float>> b_blocks(m_blocks * n_blocks);
+
+    #pragma omp parallel for collapse(2)
+    for (size_t bi = 0; bi < n_blocks; ++bi) {
+        for (size_t bk = 0; bk < m_blocks; ++bk)
+        {
+            a_blocks[bi * m_blocks + bk].resize(block_len);
+            readBlock(a_blocks[bi * m_blocks + bk], lhs, bi * blocksize, bk * blocksize, n, m, blocksize);
+            b_blocks[bk * n_blocks + bi].resize(block_len);
+            readBlock(b_blocks[bk * n_blocks + bi], rhs, bk * blocksize, bi * blocksize, m, n, blocksize);
+        }
+    }
+
+    #pragma omp parallel
     {
-        for (size_t j = 0; j < n; j += blocksize)
+        std::vector<float> cblock(block_len);
+
+        #pragma omp for collapse(2) schedule(dynamic)
+        for (size_t bi = 0; bi < n_blocks; ++bi)
         {
-            readBlock(cblock, result, i, j, n, blocksize);
-            for (size_t k = 0; k < m; k += blocksize)
+            for (size_t bj = 0; bj < n_blocks; ++bj)
             {
-                readBlock(ablock, lhs, i, k, m, blocksize);
-                readBlock(bblock, rhs, k, j, n, blocksize);
-                mmfunc(ablock, bblock, cblock, blocksize, blocksize);
+                readBlock(cblock, result, bi * blocksize, bj * blocksize, n, n, blocksize);
+                for (size_t bk = 0; bk < m_blocks; ++bk) {
+                    mmfunc(a_blocks[bi * m_blocks + bk], b_blocks[bk * n_blocks + bj], cblock, blocksize, blocksize);
+                }
+                writeBlock(result, cblock, bi * blocksize, bj * blocksize, n, n, blocksize);
             }
-            writeBlock(result, cblock, i, j, n, blocksize);
         }
     }
 }
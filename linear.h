@@ -13,6 +13,8 @@
 #include <set>
 #include <string>
 
+#include "dictionary.h"
+
 
 /**
  * Calculate the magnitude of a vector from [start, end)
@@ -27,6 +29,7 @@ float magnitude(const std::vector<float>& elements, size_t start, size_t end);
 
 /**
  * Normalize a vector row in the given matrix existing at [start, end).
+ * A row of zeros is left unchanged, so it scores 0 against every row.
  *
  * @param matrix A row-wise matrix of vector elements.
  * @param start The starting index of this row.
@@ -82,8 +85,11 @@ void matrixMultiply_kij(const std::vector<float>& lhs, const std::vector<float>&
 void matrixMultiply_kji(const std::vector<float>& lhs, const std::vector<float>& rhs, std::vector<float>& result, size_t n, size_t m);
 
 /* Matrix multiply with block-copy optimization */
-void readBlock(std::vector<float>& dest, const std::vector<float>& src, size_t start_row, size_t start_col, size_t n, size_t blocksize);
-void writeBlock(std::vector<float>& dest, const std::vector<float>& src, size_t start_row, size_t start_col, size_t n, size_t blocksize);
+/* Blocks are zero-padded where they extend past the edge of the rows x cols matrix */
+void readBlock(std::vector<float>& dest, const std::vector<float>& src, size_t start_row, size_t start_col,
+               size_t rows, size_t cols, size_t blocksize);
+void writeBlock(std::vector<float>& dest, const std::vector<float>& src, size_t start_row, size_t start_col,
+                size_t rows, size_t cols, size_t blocksize);
 
 void matrixMultiply_bco(
         void(*mmfunc)(const std::vector<float>&, const std::vector<float>&, std::vector<float>&, size_t, size_t),
@@ -97,5 +103,95 @@ std::vector<float> getTermFrequencyMatrix(
         const std::set<std::string>& vocabulary,
         size_t rows, size_t cols);
 
+/* Symmetric self-multiplication: matrix x transpose(matrix) without a transposed copy */
+
+/**
+ * Index of element (i, j), i <= j, of a symmetric N x N matrix stored as a packed
+ * upper triangle: row i holds the N - i elements from the diagonal to the end of the row.
+ *
+ * @param i The row index.
+ * @param j The column index, no smaller than i.
+ * @param n The number of rows and columns of the full matrix.
+ * @return The offset of the element in the packed storage.
+ */
+inline size_t packedIndex(size_t i, size_t j, size_t n)
+{
+    return i * (2 * n - i + 1) / 2 + (j - i);
+}
+
+/**
+ * Accumulate matrix x transpose(matrix) into a full N x N result, reading the rows of the
+ * row-major matrix directly. Only the tiles on and above the diagonal are computed.
+ *
+ * @param matrix The row-wise N x M operand.
+ * @param result The N x N result. The upper triangle (j >= i) receives the sum of the products.
+ * @param n The number of rows in the matrix.
+ * @param m The number of columns in the matrix.
+ * @param mirror If true, also write each computed element to its mirrored position below the diagonal.
+ */
+void matrixSelfMultiply(const std::vector<float>& matrix, std::vector<float>& result, size_t n, size_t m, bool mirror);
+
+/**
+ * Compute matrix x transpose(matrix) and store it as a packed upper triangle (see packedIndex()).
+ *
+ * @param matrix The row-wise N x M operand.
+ * @param n The number of rows in the matrix.
+ * @param m The number of columns in the matrix.
+ * @return The N * (N + 1) / 2 elements of the upper triangle.
+ */
+std::vector<float> matrixSelfMultiplyPacked(const std::vector<float>& matrix, size_t n, size_t m);
+
+/**
+ * Accumulate a horizontal stripe of lhs x transpose(rhs), for row-major operands which
+ * share the same number of columns. Uses the same tiled kernel as matrixSelfMultiply().
+ *
+ * @param lhs The row-wise left-hand operand, with M columns.
+ * @param first The first lhs row of the stripe.
+ * @param count The number of lhs rows in the stripe.
+ * @param rhs The row-wise right-hand operand before transposition, with dimensions P x M.
+ * @param p The number of rows in rhs.
+ * @param m The number of columns in both operands.
+ * @param result The row-wise count x P stripe which receives the sum of the products.
+ */
+void matrixMultiplyTransposed(const std::vector<float>& lhs, size_t first, size_t count,
+                              const std::vector<float>& rhs, size_t p, size_t m,
+                              std::vector<float>& result);
+
+/**
+ * Expand a packed upper triangle into a full symmetric N x N matrix.
+ *
+ * @param packed The packed upper triangle.
+ * @param n The number of rows and columns of the full matrix.
+ * @return The full row-wise matrix.
+ */
+std::vector<float> unpackSymmetric(const std::vector<float>& packed, size_t n);
+
+/**
+ * Construct a dense term frequency matrix from token counts indexed by token ID.
+ *
+ * @param docs The token counts of each document.
+ * @param vocabulary The token IDs defining the column space, in column order.
+ * @param rows The number of rows in the matrix (documents).
+ * @param cols The number of columns in the matrix (vocabulary size).
+ * @return A row-wise rows x cols matrix of term frequencies.
+ */
+std::vector<float> getTermFrequencyMatrix(
+        const DocumentTokenCounts& docs,
+        const std::vector<uint32_t>& vocabulary,
+        size_t rows, size_t cols);
+
 void printRow(const std::vector<float>& matrix, size_t start, size_t end);
 void printMatrix(const std::vector<float>& matrix, size_t rows, size_t cols);
+
+/**
+ * Write a matrix to a CSV file at full precision, in the layout written by pandas
+ * DataFrame.to_csv(): a header row of column indices, then each row prefixed by its index.
+ * This is the layout of the reference scores from scripts/generate_benchmark.py.
+ *
+ * @param path The path of the file to write.
+ * @param matrix The row-wise matrix.
+ * @param rows The number of rows in the matrix.
+ * @param cols The number of columns in each row.
+ * @return False if the file could not be written.
+ */
+bool writeMatrixCsv(const std::string& path, const std::vector<float>& matrix, size_t rows, size_t cols);
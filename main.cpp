@@ -16,9 +16,28 @@
 #include <set>
 #include <cstdlib>  // rand(), srand()
 #include <chrono>
+#include <memory>
+#include <omp.h>
 
+#include "autotune.h"
+#include "gemm.h"
+#include "hashing.h"
+#include "index.h"
+#include "join.h"
 #include "linear.h"
+#include "mapped_file.h"
+#include "minhash.h"
+#include "pipeline.h"
+#include "profiler.h"
+#include "projection.h"
+#include "quantize.h"
+#include "server.h"
+#include "shard.h"
+#include "sparse.h"
+#include "stream.h"
 #include "tokenize.h"
+#include "topk.h"
+#include "update.h"
 
 
 /**
@@ -42,17 +61,67 @@ std::vector<float> generateMatrix(size_t rows, size_t cols)
     return data;
 }
 
+/**
+ * Write the phase profile as JSON to a file, or to stderr if no path is given.
+ * @param profiler The profiler holding the measured phases.
+ * @param path The output path, or an empty string.
+ */
+void reportProfile(const PhaseProfiler& profiler, const std::string& path)
+{
+    if (path.empty()) {
+        profiler.writeJson(std::cerr);
+    } else {
+        std::ofstream profile_file(path);
+        profiler.writeJson(profile_file);
+    }
+}
+
 int main(int argc, char* argv[])
 {
     // Initialize feature flags
     bool print_result = false;
     bool use_bco = false;
+    bool use_tf = false;
+    bool use_sparse = false;
+    bool use_syrk = false;
+    bool syrk_packed = false;
+    bool use_autotune = false;
+    bool explicit_mmloop = false;
+    bool use_profile = false;
+    bool use_quantize = false;
+    bool use_lsh = false;
+    bool use_pipeline = false;
+    bool use_shards = false;
+    bool use_hashing = false;
+    bool use_projection = false;
+    bool use_join = false;
+    LshParams lsh_params;
+    QuantizedFormat quantize_format = QuantizedFormat::Int8;
 
     // Initialize operational parameters
     std::string datafile;
     size_t data_count = 0;
     size_t blocksize = 0;
+    size_t topk = 0;
+    const size_t topk_tile_rows = 256;
     const short ngram_len = 2;
+    std::string tuning_cache = "lts_tuning.cache";
+    std::string profile_path;
+    std::string scores_path;
+    std::string build_index_path;
+    std::string index_path;
+    std::string update_path;
+    std::string serve_endpoint;
+    ServerConfig server_config;
+    std::string output_path;
+    StreamConfig stream_config;
+    PipelineConfig pipeline_config;
+    HashingConfig hashing_config;
+    ProjectionConfig projection_config;
+    ShardConfig shard_config;
+    int worker_fd = -1;
+    const size_t autotune_rows = 256;
+    const size_t autotune_cols = 1024;
 
     // Create a function pointer for a specific permutation of the matrix multiply operation
     // This algorithm is used as a default, or can be chosen based on a command line argument like: "--mmloop ijk"
@@ -65,7 +134,39 @@ int main(int argc, char* argv[])
             {"bco", required_argument, NULL, 0 },
             {"data", required_argument, NULL, 0 },
             {"count", required_argument, NULL, 0 },
-            {"print", no_argument, NULL, 0 }
+            {"print", no_argument, NULL, 0 },
+            {"tf", no_argument, NULL, 0 },
+            {"sparse", no_argument, NULL, 0 },
+            {"syrk", optional_argument, NULL, 0 },
+            {"topk", required_argument, NULL, 0 },
+            {"autotune", no_argument, NULL, 0 },
+            {"tuning-cache", required_argument, NULL, 0 },
+            {"profile", optional_argument, NULL, 0 },
+            {"quantize", required_argument, NULL, 0 },
+            {"scores", required_argument, NULL, 0 },
+            {"lsh", required_argument, NULL, 0 },
+            {"lsh-threshold", required_argument, NULL, 0 },
+            {"lsh-shingle", required_argument, NULL, 0 },
+            {"build-index", required_argument, NULL, 0 },
+            {"index", required_argument, NULL, 0 },
+            {"update", required_argument, NULL, 0 },
+            {"join", no_argument, NULL, 0 },
+            {"serve", required_argument, NULL, 0 },
+            {"batch-window", required_argument, NULL, 0 },
+            {"output", required_argument, NULL, 0 },
+            {"memory-budget", required_argument, NULL, 0 },
+            {"threshold", required_argument, NULL, 0 },
+            {"pipeline", no_argument, NULL, 0 },
+            {"hash-bits", required_argument, NULL, 0 },
+            {"hash-unsigned", no_argument, NULL, 0 },
+            {"project", required_argument, NULL, 0 },
+            {"project-density", required_argument, NULL, 0 },
+            {"pipeline-batch", required_argument, NULL, 0 },
+            {"shards", required_argument, NULL, 0 },
+            {"workers", required_argument, NULL, 0 },
+            {"worker", required_argument, NULL, 0 },
+            {"worker-threads", required_argument, NULL, 0 },
+            {NULL, 0, NULL, 0 }
     };
 
     // Parse the command line arguments
@@ -79,11 +180,12 @@ int main(int argc, char* argv[])
     {
         // Store the char* values in a std::string for convenience
         opt_name = long_options[opt_idx].name;
-        if (optarg) { opt_val = optarg; }
+        opt_val = optarg ? optarg : "";
 
         // Select the function for the indicated matrix multiplication loop permutation
         if (opt_name == "mmloop")
         {
+            explicit_mmloop = true;
             if (opt_val == "ijk") {
                 mmfunc_ptr = &matrixMultiply_ijk;
             } else if (opt_val == "ikj") {
@@ -96,6 +198,14 @@ int main(int argc, char* argv[])
                 mmfunc_ptr = &matrixMultiply_kji;
             } else if (opt_val == "kij") {
                 mmfunc_ptr = &matrixMultiply_kij;
+            } else if (opt_val.rfind("simd", 0) == 0) {
+                // "simd" uses the widest micro-kernel this CPU supports; "simd-<isa>" forces one
+                mmfunc_ptr = &matrixMultiply_simd;
+                std::string isa = opt_val.size() > 5 ? opt_val.substr(5) : "best";
+                if (!selectGemmKernel(isa)) {
+                    std::cout << "Unsupported SIMD kernel '" << isa << "'. Aborting." << std::endl;
+                    exit(1);
+                }
             }
         }
         // Enable block copy optimization and set the block size
@@ -115,43 +225,688 @@ int main(int argc, char* argv[])
         else if (opt_name == "print") {
             print_result = true;
         }
+        // Use the term frequency matrix of the input data instead of a generated matrix
+        else if (opt_name == "tf") {
+            use_tf = true;
+        }
+        // Compute the similarity from a sparse term frequency matrix
+        else if (opt_name == "sparse") {
+            use_sparse = true;
+        }
+        // Compute only the upper triangle of the symmetric result, without a transposed copy.
+        // "--syrk=packed" stores the triangle in packed form instead of mirroring it.
+        else if (opt_name == "syrk") {
+            use_syrk = true;
+            syrk_packed = (opt_val == "packed");
+        }
+        // Keep only the K most similar documents for each document
+        else if (opt_name == "topk") {
+            topk = stoull(opt_val);
+        }
+        // Time trial multiplies to choose the loop order, block size and thread count,
+        // and save the choice in the tuning cache for later runs on this host and shape
+        else if (opt_name == "autotune") {
+            use_autotune = true;
+        }
+        // Set the tuning cache file path
+        else if (opt_name == "tuning-cache") {
+            tuning_cache = opt_val;
+        }
+        // Report the time and hardware counters of each phase as JSON.
+        // "--profile=<path>" writes the report to a file instead of stderr.
+        else if (opt_name == "profile") {
+            use_profile = true;
+            profile_path = opt_val;
+        }
+        // Compute the similarity from int8 or bf16 document vectors: "--quantize int8" or "--quantize bf16".
+        // "<format>-<kernel>" forces the dot-product kernel, e.g. "int8-generic" for the plain C++ path.
+        else if (opt_name == "quantize")
+        {
+            use_quantize = true;
+            std::string format = opt_val.substr(0, opt_val.find('-'));
+            std::string kernel = opt_val.find('-') != std::string::npos ? opt_val.substr(opt_val.find('-') + 1) : "best";
+            if (format == "int8") {
+                quantize_format = QuantizedFormat::Int8;
+            } else if (format == "bf16") {
+                quantize_format = QuantizedFormat::Bf16;
+            } else {
+                std::cout << "Unknown quantized format '" << format << "'. Aborting." << std::endl;
+                exit(1);
+            }
+            if (!selectQuantizedKernel(kernel)) {
+                std::cout << "Unsupported quantized kernel '" << kernel << "'. Aborting." << std::endl;
+                exit(1);
+            }
+        }
+        // Write the full result matrix at full precision to a CSV file
+        else if (opt_name == "scores") {
+            scores_path = opt_val;
+        }
+        // Find near-duplicate pairs with MinHash/LSH instead of computing every pair: "--lsh <bands>x<rows>".
+        // More bands raise recall, more rows per band raise precision.
+        else if (opt_name == "lsh")
+        {
+            use_lsh = true;
+            size_t sep = opt_val.find('x');
+            if (sep == std::string::npos || stoull(opt_val.substr(0, sep)) == 0 || stoull(opt_val.substr(sep + 1)) == 0) {
+                std::cout << "Invalid LSH shape '" << opt_val << "', expected <bands>x<rows>. Aborting." << std::endl;
+                exit(1);
+            }
+            lsh_params.bands = stoull(opt_val.substr(0, sep));
+            lsh_params.rows = stoull(opt_val.substr(sep + 1));
+        }
+        // Set the smallest exact similarity reported by the LSH mode
+        else if (opt_name == "lsh-threshold") {
+            lsh_params.threshold = stof(opt_val);
+        }
+        // Set the shingle length of the LSH signatures, from 1 to 8 characters
+        else if (opt_name == "lsh-shingle")
+        {
+            lsh_params.shingle_len = stoull(opt_val);
+            if (lsh_params.shingle_len < 1 || lsh_params.shingle_len > TokenDictionary::max_packed_len) {
+                std::cout << "Invalid shingle length '" << opt_val << "'. Aborting." << std::endl;
+                exit(1);
+            }
+        }
+        // Tokenize the data file once and save its vocabulary, normalized vectors and norms to a binary index
+        else if (opt_name == "build-index") {
+            build_index_path = opt_val;
+        }
+        // Load the document vectors from an index written by --build-index instead of a data file
+        else if (opt_name == "index") {
+            index_path = opt_val;
+        }
+        // Add the documents of --data to an index written by --build-index, scoring only the new documents,
+        // and merge their scores into the --output file of an earlier --threshold or --topk run on the index
+        else if (opt_name == "update") {
+            update_path = opt_val;
+        }
+        // Find the pairs whose similarity is at least --threshold with an exact join, which prunes the pairs
+        // that cannot reach it instead of scoring every pair. --output writes the pairs to a score file.
+        else if (opt_name == "join") {
+            use_join = true;
+        }
+        // Keep the corpus loaded and answer queries, one document per line, with the --topk best matches
+        // (default 10): "--serve <socket path>" listens on a Unix domain socket, "--serve -" reads stdin
+        else if (opt_name == "serve") {
+            serve_endpoint = opt_val;
+        }
+        // Set how long the server waits after a query for others to score in the same batch, in microseconds
+        else if (opt_name == "batch-window") {
+            server_config.batch_window = std::chrono::microseconds(stoull(opt_val));
+        }
+        // Compute the result in row stripes and stream it to a binary score file instead of holding it in memory
+        else if (opt_name == "output") {
+            output_path = opt_val;
+        }
+        // Set the memory for the result stripes of --output, in MiB
+        else if (opt_name == "memory-budget") {
+            stream_config.memory_budget = stoull(opt_val) << 20;
+        }
+        // Only write the pairs of documents whose similarity is at least this score to --output
+        else if (opt_name == "threshold") {
+            stream_config.use_threshold = true;
+            stream_config.threshold = stof(opt_val);
+        }
+        // Read, tokenize, vectorize and score the documents in concurrent stages connected by bounded queues.
+        // Requires --output and --threshold, and uses hashed features instead of the exact vocabulary.
+        else if (opt_name == "pipeline") {
+            use_pipeline = true;
+        }
+        // Hash each ngram to one of 2^bits columns instead of building the vocabulary (--pipeline always hashes)
+        else if (opt_name == "hash-bits")
+        {
+            use_hashing = true;
+            hashing_config.bits = stoul(opt_val);
+            if (hashing_config.bits < 1 || hashing_config.bits > 30) {
+                std::cout << "Invalid number of hash bits '" << opt_val << "', expected 1 to 30. Aborting." << std::endl;
+                exit(1);
+            }
+        }
+        // Add the hashed features without signs, so colliding ngrams always add together
+        else if (opt_name == "hash-unsigned") {
+            hashing_config.use_sign = false;
+        }
+        // Reduce each normalized term frequency vector to k dense dimensions by a sparse random projection
+        // before the dense multiply, which approximates the cosine similarity
+        else if (opt_name == "project")
+        {
+            use_projection = true;
+            projection_config.dims = stoull(opt_val);
+            if (projection_config.dims == 0) {
+                std::cout << "The projection needs at least one dimension. Aborting." << std::endl;
+                exit(1);
+            }
+        }
+        // Set the fraction of non-zero entries in the projection matrix (default 1 / sqrt(vocabulary size))
+        else if (opt_name == "project-density") {
+            projection_config.density = stod(opt_val);
+            if (!(projection_config.density > 0.0 && projection_config.density <= 1.0)) {
+                std::cout << "The projection density must be greater than 0 and at most 1. Aborting." << std::endl;
+                exit(1);
+            }
+        }
+        // Set the number of documents passed between the stages of --pipeline at once
+        else if (opt_name == "pipeline-batch")
+        {
+            pipeline_config.batch_documents = stoull(opt_val);
+            if (pipeline_config.batch_documents == 0) {
+                std::cout << "The pipeline batch must hold at least one document. Aborting." << std::endl;
+                exit(1);
+            }
+        }
+        // Split the documents into this many shards and compute the shard-pair blocks in worker processes
+        else if (opt_name == "shards")
+        {
+            use_shards = true;
+            use_sparse = true;
+            shard_config.shards = stoull(opt_val);
+            if (shard_config.shards == 0) {
+                std::cout << "There must be at least one shard. Aborting." << std::endl;
+                exit(1);
+            }
+        }
+        // Set the number of worker processes of --shards (default one per shard)
+        else if (opt_name == "workers") {
+            shard_config.workers = stoull(opt_val);
+        }
+        // Internal: run as a worker of --shards, connected to the coordinator on this descriptor
+        else if (opt_name == "worker") {
+            worker_fd = stoi(opt_val);
+        }
+        // Internal: set the OpenMP threads of a worker
+        else if (opt_name == "worker-threads") {
+            omp_set_num_threads(std::max(1, stoi(opt_val)));
+        }
+    }
+
+    // A worker receives its documents from the coordinator
+    if (worker_fd >= 0) {
+        return runShardWorker(worker_fd);
     }
 
-    // Verify that a data file was supplied
-    if (datafile.empty()) {
+    // Verify that a data file or an index was supplied
+    if (!index_path.empty())
+    {
+        if (use_lsh || !build_index_path.empty()) {
+            std::cout << "--lsh and --build-index read the data file, not an index. Aborting." << std::endl;
+            exit(1);
+        }
+        if (data_count > 0) {
+            std::cerr << "The index holds a fixed set of documents. Ignoring --count." << std::endl;
+        }
+    }
+    else if (datafile.empty()) {
         std::cout << "Missing data file. Aborting." << std::endl;
         exit(1);
     }
-    if (data_count <= 0) {
+    else if (data_count <= 0) {
         std::cout << "Data count unspecified. Reading all records in the supplied file." << std::endl;
     }
 
-    // Get the token counts for each document
-    auto doc_freq_maps = tokenizeFile(datafile, ngram_len, data_count, true);
+    // An update only scores the new documents, and merges them into the index and the earlier result
+    if (!update_path.empty())
+    {
+        if (!index_path.empty() || use_hashing || use_pipeline || use_shards) {
+            std::cout << "--update grows the index with the documents of --data. It cannot be combined with "
+                         "--index, --hash-bits, --pipeline or --shards. Aborting." << std::endl;
+            exit(1);
+        }
+
+        MappedFile file(datafile);
+        if (!file.isOpen()) {
+            std::cout << "Could not read '" << datafile << "'. Aborting." << std::endl;
+            exit(1);
+        }
+        std::vector<std::string_view> lines = splitLines(file.view(), data_count);
+        UpdateStats stats;
+        std::string error;
+        if (!updateCorpus(update_path, output_path, lines, true, stats, error)) {
+            std::cout << "Could not update: " << error << ". Aborting." << std::endl;
+            exit(1);
+        }
+        std::cout << "Added " << stats.new_documents << " documents and " << stats.new_columns << " tokens to "
+                  << stats.old_documents << " documents x " << stats.old_columns << " tokens in '" << update_path << "'";
+        if (!output_path.empty()) {
+            std::cout << ", and " << stats.added << " scores to '" << output_path << "'";
+        }
+        std::cout << std::endl;
+        std::cout << "Seconds: vectorize " << stats.vectorize_seconds << ", score " << stats.score_seconds
+                  << ", write " << stats.write_seconds << std::endl;
+        return 0;
+    }
+
+    if (use_join && (!stream_config.use_threshold || stream_config.threshold <= 0.0f || use_pipeline || use_shards
+                     || use_projection || topk > 0))
+    {
+        std::cout << "--join needs a --threshold above zero, and cannot be combined with --pipeline, --shards, "
+                     "--project or --topk. Aborting." << std::endl;
+        exit(1);
+    }
+
+    // With --topk, --output receives the neighbour lists instead of the streamed matrix
+    const bool use_stream = !output_path.empty() && topk == 0;
+    if (use_stream && (use_syrk || use_quantize))
+    {
+        std::cerr << "--output computes the full fp32 matrix in stripes. Ignoring --syrk and --quantize." << std::endl;
+        use_syrk = syrk_packed = use_quantize = false;
+    }
+    if (use_sparse && !use_shards && use_syrk)
+    {
+        std::cerr << "--sparse multiplies the sparse vectors by their postings. Ignoring --syrk." << std::endl;
+        use_syrk = syrk_packed = false;
+    }
+    if (!output_path.empty() && topk > 0 && (use_sparse || use_pipeline))
+    {
+        std::cout << "--topk writes the neighbours of the dense top-k search to --output. It cannot be combined with "
+                     "--sparse, --shards or --pipeline. Aborting." << std::endl;
+        exit(1);
+    }
+    if (topk > 0 && use_sparse && !use_shards)
+    {
+        std::cout << "--topk selects the neighbours from the dense matrix and cannot be combined with --sparse. "
+                     "Aborting." << std::endl;
+        exit(1);
+    }
+
+    if (use_projection && (use_sparse || (!use_tf && index_path.empty())))
+    {
+        std::cout << "--project reduces the term frequency vectors for the dense kernels. It needs --tf or --index "
+                     "and cannot be combined with --sparse or --shards. Aborting." << std::endl;
+        exit(1);
+    }
+
+    if (use_shards && use_stream) {
+        std::cout << "--shards gathers the full matrix and cannot stream it to --output. Aborting." << std::endl;
+        exit(1);
+    }
+    if (use_shards && (use_syrk || use_quantize || topk > 0))
+    {
+        std::cerr << "--shards computes the full matrix from the sparse vectors. Ignoring --syrk, --quantize and --topk." << std::endl;
+        use_syrk = syrk_packed = use_quantize = false;
+        topk = 0;
+    }
+
+    if (use_hashing && !use_pipeline && (!index_path.empty() || !build_index_path.empty() || !serve_endpoint.empty())) {
+        std::cout << "--hash-bits replaces the vocabulary, which --index, --build-index and --serve need. Aborting." << std::endl;
+        exit(1);
+    }
+
+    // The pipeline reads the data file itself and writes the pairs as each batch is scored
+    if (use_pipeline)
+    {
+        if (!index_path.empty() || !use_stream || !stream_config.use_threshold) {
+            std::cout << "--pipeline reads a data file and requires --output and --threshold. Aborting." << std::endl;
+            exit(1);
+        }
+        pipeline_config.ngram_len = ngram_len;
+        pipeline_config.hashing = hashing_config;
+        pipeline_config.max_documents = data_count;
+        pipeline_config.threshold = stream_config.threshold;
+
+        PipelineStats stats;
+        auto start = std::chrono::steady_clock::now();
+        if (!runPipeline(datafile, output_path, pipeline_config, stats)) {
+            std::cout << "Could not read '" << datafile << "' or write '" << output_path << "'. Aborting." << std::endl;
+            exit(1);
+        }
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        std::cout << "Wrote " << stats.pairs << " pairs of " << stats.documents << " documents to '" << output_path
+                  << "' in " << elapsed.count() << " seconds" << std::endl;
+        std::cout << "Stage busy seconds: read " << stats.read_busy << ", tokenize " << stats.tokenize_busy
+                  << ", vectorize " << stats.vectorize_busy << ", compute " << stats.compute_busy << std::endl;
+        std::cout << "Backpressure stalls: reader " << stats.read_stalls << ", vectorizer " << stats.vectorize_stalls << std::endl;
+        return 0;
+    }
+
+    // Opened before the first parallel region, so the counters follow the OpenMP threads
+    PhaseProfiler profiler(use_profile);
+
+    TokenDictionary dictionary(ngram_len);
+    DocumentTokenCounts doc_freq_maps;
+    std::vector<uint32_t> unique_tokens;
+    CsrMatrix hashed_matrix;
+    std::unique_ptr<CorpusIndex> index;
+
+    if (!index_path.empty())
+    {
+        // The vocabulary and normalized vectors are used straight from the mapped index
+        profiler.begin("load_index");
+        index = std::make_unique<CorpusIndex>(index_path);
+        profiler.end();
+        if (!index->isOpen()) {
+            std::cout << "Could not load index: " << index->error() << ". Aborting." << std::endl;
+            exit(1);
+        }
+    }
+    else
+    {
+        // Map the input file and find the line of each document
+        profiler.begin("ingest");
+        MappedFile file(datafile);
+        std::vector<std::string_view> lines = splitLines(file.view(), data_count);
+        profiler.end();
+
+        // The LSH mode only builds term frequency vectors for the candidate pairs
+        if (use_lsh)
+        {
+            std::chrono::time_point<std::chrono::high_resolution_clock> start_time = std::chrono::high_resolution_clock::now();
+
+            profiler.begin("signatures");
+            std::vector<uint32_t> signatures = minhashSignatures(lines, lsh_params);
+            profiler.end();
+            profiler.begin("candidates");
+            auto candidates = lshCandidates(signatures, lines.size(), lsh_params);
+            profiler.end();
+            profiler.begin("verify");
+            std::vector<SimilarPair> pairs = verifyCandidates(lines, candidates, ngram_len, true, lsh_params.threshold);
+            profiler.end();
+
+            std::chrono::time_point<std::chrono::high_resolution_clock> end_time = std::chrono::high_resolution_clock::now();
+            std::chrono::duration<double> elapsed = end_time - start_time;
+            std::cout << elapsed.count() << std::endl;
+            std::cerr << candidates.size() << " candidate pairs, " << pairs.size() << " at or above "
+                      << lsh_params.threshold << std::endl;
+
+            if (use_profile) {
+                reportProfile(profiler, profile_path);
+            }
+            if (print_result) {
+                std::cout << "Similar pairs: " << std::endl;
+                printPairs(pairs);
+            }
+            return 0;
+        }
+
+        // Hashed features need no vocabulary, so each document is vectorized in a single pass
+        if (use_hashing)
+        {
+            profiler.begin("hash_vectorize");
+            hashed_matrix = hashTermFrequencies(lines, ngram_len, true, hashing_config);
+            profiler.end();
+        }
+        else
+        {
+            // Get the token counts for each document, keyed by the token IDs assigned by the dictionary
+            profiler.begin("tokenize");
+            doc_freq_maps = tokenizeLines(lines, ngram_len, true, dictionary);
+            profiler.end();
+
+            // Construct the set of unique token IDs across all documents
+            // This set will define the vector space used for constructing the term frequency matrix.
+            profiler.begin("vocabulary");
+            unique_tokens = extractUniqueKeys(doc_freq_maps);
+            profiler.end();
+        }
+
+        // Save the normalized vectors so later runs can skip tokenizing
+        if (!build_index_path.empty())
+        {
+            profiler.begin("build_index");
+            CsrMatrix tf_matrix = getSparseTermFrequencyMatrix(doc_freq_maps, unique_tokens);
+            std::vector<float> norms = sparseRowNorms(tf_matrix);
+            normalizeSparseMatrix(tf_matrix);
+            bool written = writeIndex(build_index_path, dictionary, unique_tokens, tf_matrix, norms);
+            profiler.end();
+
+            if (!written) {
+                std::cout << "Could not write index '" << build_index_path << "'. Aborting." << std::endl;
+                exit(1);
+            }
+            std::cout << "Wrote index of " << tf_matrix.rows << " documents x " << tf_matrix.cols
+                      << " tokens to '" << build_index_path << "'" << std::endl;
+            if (use_profile) {
+                reportProfile(profiler, profile_path);
+            }
+            return 0;
+        }
+    }
+
+    // Serve queries against the normalized corpus vectors, mapped from the index or built from the data file
+    if (!serve_endpoint.empty())
+    {
+        CsrMatrix postings;
+        std::vector<uint64_t> vocabulary;
+        if (!index)
+        {
+            CsrMatrix tf_matrix = getSparseTermFrequencyMatrix(doc_freq_maps, unique_tokens);
+            normalizeSparseMatrix(tf_matrix);
+            postings = transpose(tf_matrix);
+            for (uint32_t id: unique_tokens) {
+                vocabulary.push_back(dictionary.packedKey(id));
+            }
+        }
+        QueryEngine engine(index ? index->postings() : view(postings),
+                           index ? index->vocabulary() : vocabulary.data(),
+                           index ? index->ngramLength() : ngram_len);
+        server_config.k = topk > 0 ? topk : server_config.k;
+        return serveQueries(serve_endpoint, engine, server_config) ? 0 : 1;
+    }
+
+    // The join finds the pairs above the threshold from the sparse vectors, without the full result
+    if (use_join)
+    {
+        CsrMatrix tf_matrix;
+        if (!index)
+        {
+            profiler.begin("tf_matrix");
+            tf_matrix = use_hashing ? std::move(hashed_matrix) : getSparseTermFrequencyMatrix(doc_freq_maps, unique_tokens);
+            doc_freq_maps.clear();
+            normalizeSparseMatrix(tf_matrix);
+            profiler.end();
+        }
+        const CsrView tf_view = index ? index->matrix() : view(tf_matrix);
+
+        JoinStats join_stats;
+        profiler.begin("join");
+        auto start = std::chrono::high_resolution_clock::now();
+        std::vector<ScorePair> pairs = thresholdJoin(tf_view, stream_config.threshold, join_stats);
+        std::chrono::duration<double> elapsed = std::chrono::high_resolution_clock::now() - start;
+        profiler.end();
 
-    // Construct the set of unique tokens across all documents
-    // This set will define the vector space used for constructing the term frequency matrix.
-    std::set<std::string> unique_tokens = extractUniqueKeys(doc_freq_maps);
+        std::cout << elapsed.count() << std::endl;
+        std::cerr << "Indexed " << join_stats.indexed << " of " << join_stats.nonzeros << " non-zeros; "
+                  << join_stats.candidates << " candidates of " << join_stats.pairs << " pairs, "
+                  << join_stats.bound_pruned << " pruned by the prefix bound, " << join_stats.verified << " verified, "
+                  << join_stats.results << " at or above " << stream_config.threshold << std::endl;
 
-    //const size_t rows = doc_freq_maps.size();
-    //const size_t cols = unique_tokens.size();
+        if (use_profile) {
+            reportProfile(profiler, profile_path);
+        }
+        if (!output_path.empty() && !writePairFile(pairs, tf_view.rows, stream_config.threshold, output_path)) {
+            std::cout << "Could not write '" << output_path << "'. Aborting." << std::endl;
+            exit(1);
+        }
+        if (print_result)
+        {
+            std::cout << "Similar pairs: " << std::endl;
+            std::cout << std::setprecision(4) << std::fixed;
+            for (const ScorePair& pair: pairs) {
+                std::cout << pair.row << ' ' << pair.col << ' ' << pair.score << std::endl;
+            }
+        }
+        return 0;
+    }
 
     // Choose a matrix containing enough elements to be larger than the L3 cache
     // Haswell L3 cache size is 6MB. Floats are 4 bytes each,
-    const size_t rows = 2048;
-    const size_t cols = 2048;
+    size_t rows = 2048;
+    size_t cols = 2048;
 
-    //auto matrix = getTermFrequencyMatrix(doc_freq_maps, unique_tokens, rows, cols);
-    //normalizeMatrix(matrix, rows,cols);
-    auto matrix = generateMatrix(rows, cols);
-    auto m_T = transpose(matrix, rows, cols);
+    std::vector<float> matrix;
+    std::vector<float> m_T;
+    CsrMatrix sparse_matrix;
 
-    std::vector<float> result(rows * rows, 0);
+    if (use_sparse && index)
+    {
+        // The mapped matrix and its postings are multiplied in place
+        rows = index->rows();
+        cols = index->cols();
+    }
+    else if (use_sparse)
+    {
+        // Only the non-zero term frequencies are stored, and no transpose copy is needed
+        profiler.begin("tf_matrix");
+        sparse_matrix = use_hashing ? std::move(hashed_matrix) : getSparseTermFrequencyMatrix(doc_freq_maps, unique_tokens);
+        doc_freq_maps.clear();  // The counts are no longer needed, and their arenas are freed at once
+        profiler.end();
+        profiler.begin("normalize");
+        normalizeSparseMatrix(sparse_matrix);
+        profiler.end(3.0 * sparse_matrix.nonZeros());
+        rows = sparse_matrix.rows;
+        cols = sparse_matrix.cols;
+    }
+    else
+    {
+        if (use_projection)
+        {
+            // The normalized vectors are projected straight from their sparse form, without the N x M dense matrix
+            CsrMatrix tf_matrix;
+            if (!index)
+            {
+                profiler.begin("tf_matrix");
+                tf_matrix = use_hashing ? std::move(hashed_matrix) : getSparseTermFrequencyMatrix(doc_freq_maps, unique_tokens);
+                doc_freq_maps.clear();
+                normalizeSparseMatrix(tf_matrix);
+                profiler.end();
+            }
+            const CsrView tf_view = index ? index->matrix() : view(tf_matrix);
+
+            profiler.begin("project");
+            RandomProjection projection = makeRandomProjection(tf_view.cols, projection_config);
+            matrix = projectRows(tf_view, projection);
+            rows = tf_view.rows;
+            cols = projection.dims;
+            profiler.end(2.0 * tf_view.nonZeros() * projection.out_idx.size() / std::max<size_t>(1, tf_view.cols));
+
+            // The projected vectors are normalized again, so their dot products estimate the cosine similarity
+            profiler.begin("normalize");
+            normalizeMatrix(matrix, rows, cols);
+            profiler.end(3.0 * rows * cols);
+        } else if (index) {
+            rows = index->rows();
+            cols = index->cols();
+            profiler.begin("tf_matrix");
+            matrix = index->denseMatrix();
+            profiler.end();
+        } else if (use_tf) {
+            rows = use_hashing ? hashed_matrix.rows : doc_freq_maps.size();
+            cols = use_hashing ? hashed_matrix.cols : unique_tokens.size();
+            profiler.begin("tf_matrix");
+            matrix = use_hashing ? toDense(view(hashed_matrix)) : getTermFrequencyMatrix(doc_freq_maps, unique_tokens, rows, cols);
+            doc_freq_maps.clear();
+            hashed_matrix = CsrMatrix();
+            profiler.end();
+            profiler.begin("normalize");
+            normalizeMatrix(matrix, rows, cols);
+            profiler.end(3.0 * rows * cols);
+        } else {
+            profiler.begin("generate");
+            matrix = generateMatrix(rows, cols);
+            profiler.end();
+        }
+        if (!use_syrk && !use_quantize && topk == 0 && !use_stream) {
+            profiler.begin("transpose");
+            m_T = transpose(matrix, rows, cols);
+            profiler.end();
+        }
+    }
+
+    if (use_quantize && use_sparse) {
+        std::cerr << "Quantization only applies to the dense matrix. Ignoring --quantize." << std::endl;
+        use_quantize = false;
+    }
+    QuantizedMatrix quantized;
+    if (use_quantize)
+    {
+        profiler.begin("quantize");
+        quantized = quantizeMatrix(matrix, rows, cols, quantize_format);
+        profiler.end();
+    }
+
+    // Choose the configuration of the dense multiply: run the autotuner, or reuse the configuration
+    // it chose earlier for this host and shape unless the loop order or block size was given explicitly
+    if (!use_sparse && !use_syrk && !use_quantize && topk == 0 && !use_stream)
+    {
+        const std::string tuning_key = tuningKey(rows, cols);
+        TuningConfig config;
+        bool tuned = false;
+
+        if (use_autotune)
+        {
+            config = autotune(matrix, m_T, rows, cols, autotune_rows, autotune_cols, true);
+            tuned = true;
+            if (!saveTuning(tuning_cache, tuning_key, config)) {
+                std::cerr << "Could not write tuning cache '" << tuning_cache << "'." << std::endl;
+            }
+        }
+        else if (!explicit_mmloop && !use_bco) {
+            tuned = loadTuning(tuning_cache, tuning_key, config);
+        }
+
+        if (tuned)
+        {
+            std::cerr << "Tuned configuration for " << tuning_key << ": mmloop=" << config.mmloop
+                      << " bco=" << config.blocksize << " threads=" << config.threads << std::endl;
+            mmfunc_ptr = findMultiplyKernel(config.mmloop);
+            use_bco = config.blocksize > 0;
+            blocksize = config.blocksize;
+            omp_set_num_threads(config.threads);
+        }
+    }
+    else if (use_autotune) {
+        std::cerr << "Autotuning only applies to the dense multiply. Ignoring --autotune." << std::endl;
+    }
+
+    // The packed triangle and the top-k lists are allocated by their own kernels, and streamed stripes by the writer
+    std::vector<float> result((syrk_packed || topk > 0 || use_stream) ? 0 : rows * rows, 0);
+    std::vector<Neighbor> neighbors;
+    StreamStats stream_stats;
+    bool streamed = true;
+    ShardStats shard_stats;
+    bool sharded = true;
 
     // Execute the selected algorithm
+    profiler.begin("multiply");
     std::chrono::time_point<std::chrono::high_resolution_clock> start_time = std::chrono::high_resolution_clock::now();
 
-    if (mmfunc_ptr != nullptr) {
+    if (use_shards)
+    {
+        // Share the cores between the workers unless each was given its own host
+        const size_t workers = shard_config.workers > 0 ? shard_config.workers : shard_config.shards;
+        shard_config.worker_threads = std::max(1, omp_get_max_threads() / static_cast<int>(std::max<size_t>(1, workers)));
+        sharded = shardedSimilarity(index ? index->matrix() : view(sparse_matrix), shard_config, result, shard_stats);
+    }
+    else if (use_stream && use_sparse && index) {
+        streamed = streamSparseSimilarity(index->matrix(), index->postings(), output_path, stream_config, stream_stats);
+    }
+    else if (use_stream && use_sparse) {
+        const CsrMatrix postings = transpose(sparse_matrix);
+        streamed = streamSparseSimilarity(view(sparse_matrix), view(postings), output_path, stream_config, stream_stats);
+    }
+    else if (use_stream) {
+        streamed = streamDenseSimilarity(matrix, rows, cols, output_path, stream_config, stream_stats);
+    }
+    else if (use_sparse && index) {
+        sparseMultiplyPostings(index->matrix(), index->postings(), result);
+    }
+    else if (use_sparse) {
+        sparseMultiplyTranspose(sparse_matrix, sparse_matrix, result);
+    }
+    else if (topk > 0) {
+        neighbors = topKSimilar(matrix, rows, cols, topk, topk_tile_rows);
+    }
+    else if (use_quantize) {
+        quantizedSelfMultiply(quantized, result);
+    }
+    else if (use_syrk) {
+        if (syrk_packed) {
+            result = matrixSelfMultiplyPacked(matrix, rows, cols);
+        } else {
+            matrixSelfMultiply(matrix, result, rows, cols, true);
+        }
+    }
+    else if (mmfunc_ptr != nullptr) {
         if (use_bco) {
             matrixMultiply_bco(mmfunc_ptr, matrix, m_T, result, rows, cols, blocksize);
         } else {
@@ -162,11 +917,63 @@ int main(int argc, char* argv[])
     std::chrono::time_point<std::chrono::high_resolution_clock> end_time = std::chrono::high_resolution_clock::now();
     std::chrono::duration<double> elapsed = end_time - start_time;
 
+    // The sparse multiply only performs the products of shared tokens, so its FLOP count is not known
+    const double multiply_flops = use_sparse ? 0.0 : ((use_syrk || use_quantize) ? 1.0 : 2.0) * rows * rows * cols;
+    profiler.end(multiply_flops);
+
     std::cout << elapsed.count() << std::endl;
 
-    if (print_result) {
+    if (use_profile) {
+        reportProfile(profiler, profile_path);
+    }
+
+    if (use_stream)
+    {
+        if (!streamed) {
+            std::cout << "Could not write '" << output_path << "'. Aborting." << std::endl;
+            exit(1);
+        }
+        std::cerr << "Streamed " << stream_stats.stripes << " stripes of " << stream_stats.stripe_rows << " rows, "
+                  << stream_stats.written << (stream_config.use_threshold ? " pairs" : " scores") << " to '"
+                  << output_path << "'; waited " << stream_stats.write_wait << " s for the writer" << std::endl;
+        if (print_result || !scores_path.empty()) {
+            std::cerr << "The result was streamed to --output. Ignoring --print and --scores." << std::endl;
+        }
+        return 0;
+    }
+
+    if (use_shards)
+    {
+        if (!sharded) {
+            std::cout << "Every shard worker was lost. Aborting." << std::endl;
+            exit(1);
+        }
+        std::cerr << "Computed " << shard_stats.blocks << " blocks of " << shard_config.shards << " shards; sent "
+                  << shard_stats.transfers << " shards (" << shard_stats.bytes_sent << " bytes), received "
+                  << shard_stats.bytes_received << " bytes; lost " << shard_stats.failed_workers << " workers" << std::endl;
+    }
+
+    if (topk > 0 && !output_path.empty() && !writeNeighborFile(neighbors, rows, topk, output_path)) {
+        std::cout << "Could not write '" << output_path << "'. Aborting." << std::endl;
+        exit(1);
+    }
+
+    if (print_result && topk > 0) {
+        std::cout << "Top " << topk << " neighbors: " << std::endl;
+        printNeighbors(neighbors, rows, topk);
+    }
+    else if (print_result) {
         std::cout << "Result matrix: " << std::endl;
-        printMatrix(result, rows, rows);
+        printMatrix(syrk_packed ? unpackSymmetric(result, rows) : result, rows, rows);
+    }
+
+    if (!scores_path.empty())
+    {
+        if (topk > 0) {
+            std::cerr << "The top-k mode has no full result matrix. Ignoring --scores." << std::endl;
+        } else if (!writeMatrixCsv(scores_path, syrk_packed ? unpackSymmetric(result, rows) : result, rows, rows)) {
+            std::cerr << "Could not write scores to '" << scores_path << "'." << std::endl;
+        }
     }
 
     return 0;
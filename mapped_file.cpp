@@ -0,0 +1,49 @@
+/******************************************************************************
+ * Filename: mapped_file.cpp
+ * Author: Zachary Colbert
+ * Contact: zcolbert@sfsu.edu
+ *
+ * Description:
+ *      Implementation of a read-only memory mapping of a file.
+ *****************************************************************************/
+
+#include "mapped_file.h"
+
+#include <fcntl.h>      // open
+#include <sys/mman.h>   // mmap, munmap, madvise
+#include <sys/stat.h>   // fstat
+#include <unistd.h>     // close
+
+
+/**
+ * Map the file at the given path.
+ * @param path The path of the file to map.
+ */
+MappedFile::MappedFile(const std::string& path)
+{
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return;
+    }
+
+    struct stat st{};
+    if (fstat(fd, &st) == 0 && st.st_size > 0)
+    {
+        void* mapping = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapping != MAP_FAILED)
+        {
+            addr = static_cast<const char*>(mapping);
+            length = static_cast<size_t>(st.st_size);
+            madvise(mapping, length, MADV_SEQUENTIAL);
+        }
+    }
+    // The mapping remains valid after the descriptor is closed
+    close(fd);
+}
+
+MappedFile::~MappedFile()
+{
+    if (addr != nullptr) {
+        munmap(const_cast<char*>(addr), length);
+    }
+}
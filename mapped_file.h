@@ -0,0 +1,50 @@
+/******************************************************************************
+ * Filename: mapped_file.h
+ * Author: Zachary Colbert
+ * Contact: zcolbert@sfsu.edu
+ *
+ * Description:
+ *      Interface of a read-only memory mapping of a file.
+ *****************************************************************************/
+
+#pragma once
+
+#include <string>
+#include <string_view>
+
+
+/**
+ * A read-only, private memory mapping of an entire file.
+ *
+ * The mapping is released when the object is destroyed. A file which cannot be
+ * opened, or which is empty, produces an empty mapping.
+ */
+class MappedFile
+{
+public:
+    /**
+     * Map the file at the given path.
+     * @param path The path of the file to map.
+     */
+    explicit MappedFile(const std::string& path);
+    ~MappedFile();
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    /** @return A pointer to the first byte of the file, or nullptr if nothing is mapped. */
+    const char* data() const { return addr; }
+
+    /** @return The size of the mapping in bytes. */
+    size_t size() const { return length; }
+
+    /** @return True if the file was mapped. */
+    bool isOpen() const { return addr != nullptr; }
+
+    /** @return The whole file as a string_view. */
+    std::string_view view() const { return std::string_view(addr, length); }
+
+private:
+    const char* addr = nullptr;
+    size_t length = 0;
+};
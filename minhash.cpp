@@ -0,0 +1,268 @@
+/******************************************************************************
+ * Filename: minhash.cpp
+ * Author: Zachary Colbert
+ * Contact: zcolbert@sfsu.edu
+ *
+ * Description: Implementation of the MinHash/LSH near-duplicate search.
+ *
+ *      Each shingle is hashed once to 32 bits, and hash function i of the
+ *      signature is (h ^ x_i) * m_i mod 2^32 with random x_i and odd m_i,
+ *      so a signature update is a short loop of xor, multiply and min which
+ *      the compiler vectorizes. Shingles come from NgramCounter, so every
+ *      distinct shingle of a document is visited exactly once.
+ *****************************************************************************/
+
+#include "minhash.h"
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <iomanip>
+#include <limits>
+
+#include "tokenize.h"
+
+
+/**
+ * The splitmix64 finalizer: a fast bijective mix of all 64 bits.
+ */
+static uint64_t mix64(uint64_t x)
+{
+    x ^= x >> 30;
+    x *= 0xBF58476D1CE4E5B9ULL;
+    x ^= x >> 27;
+    x *= 0x94D049BB133111EBULL;
+    x ^= x >> 31;
+    return x;
+}
+
+/**
+ * Lower the signature values to the hashes of one shingle where they are smaller.
+ * Compiled for AVX-512 and AVX2 as well as the baseline, and dispatched at load time.
+ */
+__attribute__((target_clones("avx512f", "avx2", "default")))
+static void updateSignature(uint32_t* signature, const uint32_t* xors, const uint32_t* mults, size_t len, uint32_t h)
+{
+    for (size_t i = 0; i < len; ++i)
+    {
+        const uint32_t v = (h ^ xors[i]) * mults[i];
+        signature[i] = v < signature[i] ? v : signature[i];
+    }
+}
+
+/**
+ * Compute the MinHash signature of each document in a single pass over its shingles.
+ *
+ * @param docs The text of each document.
+ * @param params The LSH parameters. The signature length is bands x rows.
+ * @return A documents x (bands x rows) row-wise matrix of signature values.
+ */
+std::vector<uint32_t> minhashSignatures(const std::vector<std::string_view>& docs, const LshParams& params)
+{
+    const size_t len = params.bands * params.rows;
+    std::vector<uint32_t> signatures(docs.size() * len, std::numeric_limits<uint32_t>::max());
+
+    // Draw the parameters of each hash function from the seed
+    std::vector<uint32_t> xors(len);
+    std::vector<uint32_t> mults(len);
+    uint64_t state = params.seed;
+    for (size_t i = 0; i < len; ++i)
+    {
+        state = mix64(state + 0x9E3779B97F4A7C15ULL);
+        xors[i] = static_cast<uint32_t>(state);
+        mults[i] = static_cast<uint32_t>(state >> 32) | 1;
+    }
+
+    #pragma omp parallel
+    {
+        NgramCounter counter(params.shingle_len, true, TrailingNgrams::Drop);
+
+        #pragma omp for schedule(dynamic, 256)
+        for (size_t d = 0; d < docs.size(); ++d)
+        {
+            uint32_t* signature = &signatures[d * len];
+            counter.count(docs[d]);
+            counter.forEach([&](uint64_t key, unsigned int) {
+                updateSignature(signature, xors.data(), mults.data(), len, static_cast<uint32_t>(mix64(key)));
+            });
+            counter.clear();
+        }
+    }
+    return signatures;
+}
+
+/**
+ * Find the candidate pairs whose signatures agree in all rows of at least one band.
+ *
+ * @param signatures The signatures returned by minhashSignatures().
+ * @param count The number of documents.
+ * @param params The LSH parameters.
+ * @return The distinct candidate pairs (first < second), sorted.
+ */
+std::vector<std::pair<uint32_t, uint32_t>> lshCandidates(const std::vector<uint32_t>& signatures, size_t count,
+                                                         const LshParams& params)
+{
+    const size_t len = params.bands * params.rows;
+    std::vector<uint64_t> candidates;
+
+    #pragma omp parallel
+    {
+        std::vector<std::pair<uint64_t, uint32_t>> buckets(count);
+        std::vector<uint64_t> local;
+
+        #pragma omp for schedule(dynamic, 1)
+        for (size_t band = 0; band < params.bands; ++band)
+        {
+            // Hash the rows of this band of every signature, then sort to group equal keys
+            for (size_t d = 0; d < count; ++d)
+            {
+                const uint32_t* rows = &signatures[d * len + band * params.rows];
+                uint64_t key = band;
+                for (size_t r = 0; r < params.rows; ++r) {
+                    key = mix64(key ^ rows[r]);
+                }
+                buckets[d] = {key, static_cast<uint32_t>(d)};
+            }
+            std::sort(buckets.begin(), buckets.end());
+
+            // Every pair within a bucket is a candidate, unless the bucket is too common to be useful
+            for (size_t start = 0; start < count;)
+            {
+                size_t end = start + 1;
+                while (end < count && buckets[end].first == buckets[start].first) {
+                    ++end;
+                }
+                if (end - start <= params.max_bucket) {
+                    for (size_t a = start; a < end; ++a) {
+                        for (size_t b = a + 1; b < end; ++b) {
+                            // Within a bucket the documents are in ascending order
+                            local.push_back(static_cast<uint64_t>(buckets[a].second) << 32 | buckets[b].second);
+                        }
+                    }
+                }
+                start = end;
+            }
+        }
+
+        #pragma omp critical
+        candidates.insert(candidates.end(), local.begin(), local.end());
+    }
+
+    // Pairs found in several bands are reported once
+    std::sort(candidates.begin(), candidates.end());
+    candidates.erase(std::unique(candidates.begin(), candidates.end()), candidates.end());
+
+    std::vector<std::pair<uint32_t, uint32_t>> pairs;
+    pairs.reserve(candidates.size());
+    for (uint64_t c: candidates) {
+        pairs.emplace_back(static_cast<uint32_t>(c >> 32), static_cast<uint32_t>(c));
+    }
+    return pairs;
+}
+
+/**
+ * Compute the exact cosine similarity of the ngram term frequency vectors of each
+ * candidate pair, the score of the full similarity matrix, and keep the pairs
+ * which reach the threshold.
+ *
+ * @param docs The text of each document.
+ * @param candidates The candidate pairs.
+ * @param ngram_len The ngram length of the term frequency vectors.
+ * @param ignorecase If true, ignore case sensitivity.
+ * @param threshold The smallest similarity kept.
+ * @return The pairs at or above the threshold, in candidate order.
+ */
+std::vector<SimilarPair> verifyCandidates(const std::vector<std::string_view>& docs,
+                                          const std::vector<std::pair<uint32_t, uint32_t>>& candidates,
+                                          size_t ngram_len, bool ignorecase, float threshold)
+{
+    // Only the documents which appear in a candidate pair are vectorized
+    const uint32_t none = std::numeric_limits<uint32_t>::max();
+    std::vector<uint32_t> slot(docs.size(), none);
+    std::vector<uint32_t> members;
+    for (const auto& c: candidates)
+    {
+        for (uint32_t d: {c.first, c.second})
+        {
+            if (slot[d] == none) {
+                slot[d] = static_cast<uint32_t>(members.size());
+                members.push_back(d);
+            }
+        }
+    }
+
+    // Normalized term frequency vector of each member, sorted by packed ngram key
+    std::vector<std::vector<std::pair<uint64_t, float>>> vectors(members.size());
+
+    #pragma omp parallel
+    {
+        NgramCounter counter(ngram_len, ignorecase);
+
+        #pragma omp for schedule(dynamic, 64)
+        for (size_t m = 0; m < members.size(); ++m)
+        {
+            auto& vec = vectors[m];
+            counter.count(docs[members[m]]);
+            vec.reserve(counter.size());
+            float sum = 0.0f;
+            counter.forEach([&](uint64_t key, unsigned int count) {
+                vec.emplace_back(key, static_cast<float>(count));
+                sum += static_cast<float>(count) * count;
+            });
+            counter.clear();
+
+            std::sort(vec.begin(), vec.end());
+            const float mag = std::sqrt(sum);
+            for (auto& elem: vec) {
+                elem.second /= mag;
+            }
+        }
+    }
+
+    std::vector<char> keep(candidates.size(), 0);
+    std::vector<float> scores(candidates.size(), 0.0f);
+
+    #pragma omp parallel for schedule(dynamic, 256)
+    for (size_t p = 0; p < candidates.size(); ++p)
+    {
+        // Merge the two sorted sparse vectors
+        const auto& a = vectors[slot[candidates[p].first]];
+        const auto& b = vectors[slot[candidates[p].second]];
+        float dot = 0.0f;
+        size_t i = 0;
+        size_t j = 0;
+        while (i < a.size() && j < b.size())
+        {
+            if (a[i].first < b[j].first) {
+                ++i;
+            } else if (b[j].first < a[i].first) {
+                ++j;
+            } else {
+                dot += a[i++].second * b[j++].second;
+            }
+        }
+        scores[p] = dot;
+        keep[p] = dot >= threshold;
+    }
+
+    std::vector<SimilarPair> pairs;
+    for (size_t p = 0; p < candidates.size(); ++p) {
+        if (keep[p]) {
+            pairs.push_back({candidates[p].first, candidates[p].second, scores[p]});
+        }
+    }
+    return pairs;
+}
+
+/**
+ * Print each pair as "first second score", one pair per line.
+ *
+ * @param pairs The pairs to print.
+ */
+void printPairs(const std::vector<SimilarPair>& pairs)
+{
+    std::cout << std::setprecision(4) << std::fixed;
+    for (const auto& pair: pairs) {
+        std::cout << pair.first << ' ' << pair.second << ' ' << pair.score << std::endl;
+    }
+}
@@ -0,0 +1,87 @@
+/******************************************************************************
+ * Filename: minhash.h
+ * Author: Zachary Colbert
+ * Contact: zcolbert@sfsu.edu
+ *
+ * Description: Interface of the approximate near-duplicate search: MinHash
+ *              signatures over the character n-gram shingles of each
+ *              document, banded locality-sensitive hashing (LSH) to find
+ *              candidate pairs, and exact verification of the candidates.
+ *****************************************************************************/
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+
+/**
+ * Parameters of the LSH search.
+ *
+ * A pair of documents with shingle Jaccard similarity s becomes a candidate with
+ * probability 1 - (1 - s^rows)^bands. More rows per band raise precision (fewer
+ * dissimilar candidates); more bands raise recall. The similarity at which the
+ * probability is one half is roughly (1 / bands)^(1 / rows).
+ */
+struct LshParams
+{
+    size_t bands = 20;          // Number of bands
+    size_t rows = 5;            // Signature values per band
+    size_t shingle_len = 5;     // Characters per shingle, at most TokenDictionary::max_packed_len
+    size_t max_bucket = 1000;   // Buckets with more documents are skipped, bounding the candidate count
+    float threshold = 0.8f;     // Smallest exact similarity reported
+    uint64_t seed = 1;          // Seed of the hash functions
+};
+
+/** A pair of documents and their exact similarity. */
+struct SimilarPair
+{
+    uint32_t first;
+    uint32_t second;
+    float score;
+};
+
+/**
+ * Compute the MinHash signature of each document in a single pass over its shingles.
+ *
+ * @param docs The text of each document.
+ * @param params The LSH parameters. The signature length is bands x rows.
+ * @return A documents x (bands x rows) row-wise matrix of signature values.
+ */
+std::vector<uint32_t> minhashSignatures(const std::vector<std::string_view>& docs, const LshParams& params);
+
+/**
+ * Find the candidate pairs whose signatures agree in all rows of at least one band.
+ *
+ * @param signatures The signatures returned by minhashSignatures().
+ * @param count The number of documents.
+ * @param params The LSH parameters.
+ * @return The distinct candidate pairs (first < second), sorted.
+ */
+std::vector<std::pair<uint32_t, uint32_t>> lshCandidates(const std::vector<uint32_t>& signatures, size_t count,
+                                                         const LshParams& params);
+
+/**
+ * Compute the exact cosine similarity of the ngram term frequency vectors of each
+ * candidate pair, the score of the full similarity matrix, and keep the pairs
+ * which reach the threshold.
+ *
+ * @param docs The text of each document.
+ * @param candidates The candidate pairs.
+ * @param ngram_len The ngram length of the term frequency vectors.
+ * @param ignorecase If true, ignore case sensitivity.
+ * @param threshold The smallest similarity kept.
+ * @return The pairs at or above the threshold, in candidate order.
+ */
+std::vector<SimilarPair> verifyCandidates(const std::vector<std::string_view>& docs,
+                                          const std::vector<std::pair<uint32_t, uint32_t>>& candidates,
+                                          size_t ngram_len, bool ignorecase, float threshold);
+
+/**
+ * Print each pair as "first second score", one pair per line.
+ *
+ * @param pairs The pairs to print.
+ */
+void printPairs(const std::vector<SimilarPair>& pairs);
@@ -0,0 +1,396 @@
+/******************************************************************************
+ * Filename: pipeline.cpp
+ * Author: Zachary Colbert
+ * Contact: zcolbert@sfsu.edu
+ *
+ * Description: Implementation of the pipelined similarity computation.
+ *
+ *      reader --> tokenizer 0 --\
+ *             \-> tokenizer 1 ---> vectorizer --> compute (OpenMP)
+ *             \-> ...         --/
+ *
+ *      The reader deals batches to the tokenizers in turn, and the vectorizer
+ *      collects them in the same turn, so every queue has one producer and one
+ *      consumer and the batches reach the compute stage in file order.
+ *****************************************************************************/
+
+#include "pipeline.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <omp.h>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "queue.h"
+#include "sparse.h"
+#include "stream.h"
+#include "tokenize.h"
+
+
+/** Bytes read from the data file at once. */
+static constexpr size_t read_block = size_t(1) << 20;
+
+/** The text of consecutive documents. Document i is text[ends[i - 1], ends[i]). */
+struct TextBatch
+{
+    size_t first = 0;
+    std::string text;
+    std::vector<size_t> ends;
+};
+
+/** The packed ngram counts of consecutive documents. Document i is [offsets[i], offsets[i + 1]). */
+struct CountBatch
+{
+    size_t first = 0;
+    std::vector<size_t> offsets;
+    std::vector<uint64_t> keys;
+    std::vector<unsigned int> counts;
+};
+
+/** The normalized hashed term frequencies of consecutive documents, one row each. */
+struct VectorBatch
+{
+    size_t first = 0;
+    CsrMatrix rows;
+};
+
+/** A document containing a column, and the value of the column in that document. */
+struct Posting
+{
+    uint32_t doc;
+    float weight;
+};
+
+using TextQueue = SpscQueue<std::unique_ptr<TextBatch>>;
+using CountQueue = SpscQueue<std::unique_ptr<CountBatch>>;
+using VectorQueue = SpscQueue<std::unique_ptr<VectorBatch>>;
+
+/** @return The seconds elapsed since start. */
+static double secondsSince(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+/**
+ * Read the data file in blocks and deal its lines, in batches, to the tokenizer queues in turn.
+ *
+ * @param infile The open data file.
+ * @param queues The input queue of each tokenizer.
+ * @param config The batch size and document limit.
+ * @param stats Receives the number of documents and batches, and the reader's time and stalls.
+ */
+static void readDocuments(std::ifstream& infile, std::vector<std::unique_ptr<TextQueue>>& queues,
+                          const PipelineConfig& config, PipelineStats& stats)
+{
+    auto start = std::chrono::steady_clock::now();
+    double waited = 0.0;
+    std::vector<char> block(read_block);
+    std::string partial;    // The start of a line continuing into the next block
+    auto batch = std::make_unique<TextBatch>();
+
+    auto deliver = [&]() {
+        batch->first = stats.documents - batch->ends.size();
+        auto push_start = std::chrono::steady_clock::now();
+        stats.read_stalls += queues[stats.batches % queues.size()]->push(std::move(batch));
+        waited += secondsSince(push_start);
+        ++stats.batches;
+        batch = std::make_unique<TextBatch>();
+    };
+    auto addLine = [&](const char* data, size_t length) {
+        batch->text.append(data, length);
+        batch->ends.push_back(batch->text.size());
+        ++stats.documents;
+        if (batch->ends.size() == config.batch_documents) {
+            deliver();
+        }
+    };
+    auto full = [&]() { return config.max_documents > 0 && stats.documents == config.max_documents; };
+
+    // Lines are split as splitLines() splits them
+    while (!full() && infile)
+    {
+        infile.read(block.data(), static_cast<std::streamsize>(block.size()));
+        const size_t length = static_cast<size_t>(infile.gcount());
+        size_t pos = 0;
+        while (pos < length && !full())
+        {
+            const void* nl = std::memchr(block.data() + pos, '\n', length - pos);
+            if (nl == nullptr) {
+                partial.append(block.data() + pos, length - pos);
+                break;
+            }
+            const size_t end = static_cast<const char*>(nl) - block.data();
+            if (partial.empty()) {
+                addLine(block.data() + pos, end - pos);
+            } else {
+                partial.append(block.data() + pos, end - pos);
+                addLine(partial.data(), partial.size());
+                partial.clear();
+            }
+            pos = end + 1;
+        }
+    }
+    if (!full() && !partial.empty()) {
+        addLine(partial.data(), partial.size());
+    }
+    if (!batch->ends.empty()) {
+        deliver();
+    }
+
+    for (auto& queue: queues) {
+        queue->close();
+    }
+    stats.read_busy = secondsSince(start) - waited;
+}
+
+/**
+ * Count the packed ngrams of each document in the batches of one queue.
+ *
+ * @param in The batches of text.
+ * @param out Receives the batches of counts, in the same order.
+ * @param config The ngram settings.
+ * @param busy Receives the seconds spent counting.
+ */
+static void tokenizeBatches(TextQueue& in, CountQueue& out, const PipelineConfig& config, double& busy)
+{
+    NgramCounter counter(config.ngram_len, config.ignorecase);
+    std::unique_ptr<TextBatch> text;
+    while (in.pop(text))
+    {
+        auto start = std::chrono::steady_clock::now();
+        auto counts = std::make_unique<CountBatch>();
+        counts->first = text->first;
+        counts->offsets.reserve(text->ends.size() + 1);
+        counts->offsets.push_back(0);
+
+        size_t begin = 0;
+        for (size_t end: text->ends)
+        {
+            counter.count(std::string_view(text->text).substr(begin, end - begin));
+            counter.forEach([&](uint64_t key, unsigned int count) {
+                counts->keys.push_back(key);
+                counts->counts.push_back(count);
+            });
+            counter.clear();
+            counts->offsets.push_back(counts->keys.size());
+            begin = end;
+        }
+        text.reset();
+        busy += secondsSince(start);
+
+        out.push(std::move(counts));
+    }
+    out.close();
+}
+
+/**
+ * Hash the ngram counts of each document to columns and normalize each row, collecting
+ * the batches from the tokenizer queues in the order the reader dealt them.
+ *
+ * @param in The output queue of each tokenizer.
+ * @param out Receives the batches of vectors, in file order.
+ * @param config The hashing settings.
+ * @param stats Receives the vectorizer's time and stalls.
+ */
+static void vectorizeBatches(std::vector<std::unique_ptr<CountQueue>>& in, VectorQueue& out,
+                             const PipelineConfig& config, PipelineStats& stats)
+{
+    std::vector<std::pair<uint32_t, float>> row;
+    std::unique_ptr<CountBatch> counts;
+
+    // A drained queue means the reader has stopped, as the batches are dealt in turn
+    for (size_t b = 0; in[b % in.size()]->pop(counts); ++b)
+    {
+        auto start = std::chrono::steady_clock::now();
+        auto vectors = std::make_unique<VectorBatch>();
+        vectors->first = counts->first;
+        CsrMatrix& matrix = vectors->rows;
+        matrix.cols = size_t(1) << config.hashing.bits;
+        matrix.row_ptr.reserve(counts->offsets.size());
+        matrix.row_ptr.push_back(0);
+        matrix.col_idx.reserve(counts->keys.size());
+        matrix.values.reserve(counts->keys.size());
+
+        for (size_t d = 0; d + 1 < counts->offsets.size(); ++d)
+        {
+            const size_t row_start = matrix.values.size();
+            const size_t first = counts->offsets[d];
+            appendHashedRow(counts->keys.data() + first, counts->counts.data() + first, counts->offsets[d + 1] - first,
+                            config.hashing, row, matrix);
+
+            // Normalize as normalizeSparseMatrix() does
+            float sum = 0.0f;
+            for (size_t p = row_start; p < matrix.values.size(); ++p) {
+                sum += matrix.values[p] * matrix.values[p];
+            }
+            if (sum > 0.0f)
+            {
+                float mag = std::sqrt(sum);
+                for (size_t p = row_start; p < matrix.values.size(); ++p) {
+                    matrix.values[p] = matrix.values[p] / mag;
+                }
+            }
+        }
+        counts.reset();
+        stats.vectorize_busy += secondsSince(start);
+
+        stats.vectorize_stalls += out.push(std::move(vectors));
+    }
+    out.close();
+}
+
+/**
+ * Compute the cosine similarity of every pair of documents in a file, one document
+ * per line, by hashed ngram term frequencies, and write the pairs above the threshold.
+ *
+ * @param data_path The path of the data file.
+ * @param output_path The path of the score file.
+ * @param config The pipeline settings.
+ * @param stats Receives the amount of work and the time spent by each stage.
+ * @return False if the data file could not be read or the score file could not be written.
+ */
+bool runPipeline(const std::string& data_path, const std::string& output_path,
+                 const PipelineConfig& config, PipelineStats& stats)
+{
+    std::ifstream infile(data_path, std::ios::binary);
+    std::ofstream outfile(output_path, std::ios::binary | std::ios::trunc);
+    if (!infile || !outfile) {
+        return false;
+    }
+
+    ScoreFileHeader header{};
+    std::memcpy(header.magic, score_magic, sizeof(score_magic));
+    header.version = score_version;
+    header.format = ScoreFormat::Pairs;
+    header.threshold = config.threshold;
+    outfile.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+    stats = PipelineStats{};
+    const size_t tokenizers = config.tokenizers > 0 ? config.tokenizers
+                                                    : std::max(1, omp_get_max_threads() / 2);
+    std::vector<std::unique_ptr<TextQueue>> text_queues;
+    std::vector<std::unique_ptr<CountQueue>> count_queues;
+    for (size_t t = 0; t < tokenizers; ++t)
+    {
+        text_queues.push_back(std::make_unique<TextQueue>(config.queue_depth));
+        count_queues.push_back(std::make_unique<CountQueue>(config.queue_depth));
+    }
+    VectorQueue vector_queue(config.queue_depth);
+
+    // Each thread writes only its own fields of the stats until it is joined
+    PipelineStats vectorize_stats;
+    std::vector<double> tokenize_busy(tokenizers, 0.0);
+    std::vector<std::thread> threads;
+    threads.emplace_back(readDocuments, std::ref(infile), std::ref(text_queues), std::cref(config), std::ref(stats));
+    for (size_t t = 0; t < tokenizers; ++t) {
+        threads.emplace_back(tokenizeBatches, std::ref(*text_queues[t]), std::ref(*count_queues[t]),
+                             std::cref(config), std::ref(tokenize_busy[t]));
+    }
+    threads.emplace_back(vectorizeBatches, std::ref(count_queues), std::ref(vector_queue),
+                         std::cref(config), std::ref(vectorize_stats));
+
+    // The postings grow by one batch at a time and always hold documents in ascending order
+    std::vector<std::vector<Posting>> postings(size_t(1) << config.hashing.bits);
+    const int team = omp_get_max_threads();
+    std::vector<std::vector<float>> scores(team);
+    std::vector<std::vector<uint32_t>> stamps(team);        // Document j + 1 once it has touched a score
+    std::vector<std::vector<uint32_t>> touched(team);
+    std::vector<std::vector<ScorePair>> found(team);
+    std::vector<ScorePair> pairs;
+    double compute_busy = 0.0;
+
+    std::unique_ptr<VectorBatch> batch;
+    while (vector_queue.pop(batch))
+    {
+        auto start = std::chrono::steady_clock::now();
+        const CsrMatrix& rows = batch->rows;
+        const size_t first = batch->first;
+        const size_t seen = first + rows.rows;
+        for (size_t r = 0; r < rows.rows; ++r) {
+            for (size_t p = rows.row_ptr[r]; p < rows.row_ptr[r + 1]; ++p) {
+                postings[rows.col_idx[p]].push_back({static_cast<uint32_t>(first + r), rows.values[p]});
+            }
+        }
+
+        // Score each document of the batch against every document before it
+        #pragma omp parallel
+        {
+            const int t = omp_get_thread_num();
+            std::vector<float>& score = scores[t];
+            std::vector<uint32_t>& stamp = stamps[t];
+            if (score.size() < seen) {
+                score.resize(seen, 0.0f);
+                stamp.resize(seen, 0);
+            }
+
+            #pragma omp for schedule(dynamic, 8)
+            for (size_t r = 0; r < rows.rows; ++r)
+            {
+                const uint32_t j = static_cast<uint32_t>(first + r);
+                for (size_t p = rows.row_ptr[r]; p < rows.row_ptr[r + 1]; ++p)
+                {
+                    const float w = rows.values[p];
+                    for (const Posting& posting: postings[rows.col_idx[p]])
+                    {
+                        if (posting.doc >= j) {
+                            break;
+                        }
+                        if (stamp[posting.doc] != j + 1) {
+                            stamp[posting.doc] = j + 1;
+                            touched[t].push_back(posting.doc);
+                        }
+                        score[posting.doc] += w * posting.weight;
+                    }
+                }
+                for (uint32_t i: touched[t])
+                {
+                    if (score[i] >= config.threshold) {
+                        found[t].push_back({i, j, score[i]});
+                    }
+                    score[i] = 0.0f;
+                }
+                touched[t].clear();
+            }
+        }
+
+        for (auto& list: found)
+        {
+            pairs.insert(pairs.end(), list.begin(), list.end());
+            list.clear();
+        }
+        std::sort(pairs.begin(), pairs.end(), [](const ScorePair& a, const ScorePair& b) {
+            return a.col != b.col ? a.col < b.col : a.row < b.row;
+        });
+        outfile.write(reinterpret_cast<const char*>(pairs.data()), static_cast<std::streamsize>(pairs.size() * sizeof(ScorePair)));
+        stats.pairs += pairs.size();
+        pairs.clear();
+        batch.reset();
+        compute_busy += secondsSince(start);
+    }
+
+    for (std::thread& thread: threads) {
+        thread.join();
+    }
+    for (double busy: tokenize_busy) {
+        stats.tokenize_busy += busy;
+    }
+    stats.vectorize_busy = vectorize_stats.vectorize_busy;
+    stats.vectorize_stalls = vectorize_stats.vectorize_stalls;
+    stats.compute_busy = compute_busy;
+
+    // The number of documents and pairs is only known at the end
+    header.rows = stats.documents;
+    header.cols = stats.documents;
+    header.count = stats.pairs;
+    outfile.seekp(0);
+    outfile.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    outfile.close();
+    return static_cast<bool>(outfile);
+}
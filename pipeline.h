@@ -0,0 +1,68 @@
+/******************************************************************************
+ * Filename: pipeline.h
+ * Author: Zachary Colbert
+ * Contact: zcolbert@sfsu.edu
+ *
+ * Description: Interface of the pipelined similarity computation. A reader,
+ *              tokenizer and vectorizer threads pass batches of documents
+ *              through bounded queues to the compute stage, so reading the
+ *              file overlaps the computation and only a few batches of text
+ *              and token counts are alive at any time.
+ *
+ *              The global vocabulary is only known after every document is
+ *              tokenized, so the pipeline uses hashed features instead: each
+ *              ngram maps straight to one of 2^bits columns (see hashing.h).
+ *****************************************************************************/
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "hashing.h"
+
+/** Settings of a pipelined computation. */
+struct PipelineConfig
+{
+    size_t ngram_len = 2;           // From 1 to TokenDictionary::max_packed_len
+    bool ignorecase = true;
+    HashingConfig hashing;          // The vectors have 2^hashing.bits columns
+    size_t max_documents = 0;       // Zero reads every line of the file
+    size_t batch_documents = 256;   // Documents passed between stages at once
+    size_t queue_depth = 4;         // Batches each queue holds before its producer waits
+    size_t tokenizers = 0;          // Tokenizer threads. Zero uses half of the OpenMP threads.
+    float threshold = 0.8f;         // Smallest score written
+};
+
+/** What a pipelined computation did. */
+struct PipelineStats
+{
+    size_t documents = 0;
+    size_t batches = 0;
+    uint64_t pairs = 0;             // Pairs written
+    double read_busy = 0.0;         // Seconds each stage spent working, excluding waits
+    double tokenize_busy = 0.0;     // Summed over the tokenizer threads
+    double vectorize_busy = 0.0;
+    double compute_busy = 0.0;
+    size_t read_stalls = 0;         // Batches the reader had to wait to queue, as the tokenizers were behind
+    size_t vectorize_stalls = 0;    // Batches the vectorizer had to wait to queue, as the compute stage was behind
+};
+
+/**
+ * Compute the cosine similarity of every pair of documents in a file, one document
+ * per line, by hashed ngram term frequencies. The pairs i < j whose score is at least
+ * the threshold are written to a score file in the Pairs format of stream.h, ordered
+ * by j and then i.
+ *
+ * Each batch is scored against the documents before it as it arrives, through postings
+ * which grow by one batch at a time. The text and token counts of a batch are freed as
+ * soon as the next stage has consumed them.
+ *
+ * @param data_path The path of the data file.
+ * @param output_path The path of the score file.
+ * @param config The pipeline settings.
+ * @param stats Receives the amount of work and the time spent by each stage.
+ * @return False if the data file could not be read or the score file could not be written.
+ */
+bool runPipeline(const std::string& data_path, const std::string& output_path,
+                 const PipelineConfig& config, PipelineStats& stats);
@@ -0,0 +1,201 @@
+/******************************************************************************
+ * Filename: profiler.cpp
+ * Author: Zachary Colbert
+ * Contact: zcolbert@sfsu.edu
+ *
+ * Description: Implementation of the per-phase profiler.
+ *****************************************************************************/
+
+#include "profiler.h"
+
+#include <cstring>  // memset
+#include <omp.h>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+
+static const char* counter_names[PhaseProfiler::counter_count] = {
+        "cycles", "instructions", "l1d_misses", "llc_misses"
+};
+
+#ifdef __linux__
+/**
+ * Open a counter for this process and the threads it creates from now on.
+ *
+ * @param type The perf event type.
+ * @param config The perf event configuration.
+ * @return The counter file descriptor, or -1 if the counter is unavailable.
+ */
+static int openCounter(uint32_t type, uint64_t config)
+{
+    perf_event_attr attr;
+    std::memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+    attr.inherit = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    // Counters which were multiplexed off the hardware are scaled up by enabled / running time
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+    long fd = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+    return fd < 0 ? -1 : static_cast<int>(fd);
+}
+#endif
+
+/**
+ * Open the hardware counters. Each counter which cannot be opened is left unavailable.
+ * Construct the profiler before the first OpenMP parallel region, so that the
+ * counters are inherited by the worker threads.
+ *
+ * @param use_counters False to record wall time only.
+ */
+PhaseProfiler::PhaseProfiler(bool use_counters)
+{
+    for (int& fd: fds) {
+        fd = -1;
+    }
+#ifdef __linux__
+    if (!use_counters) {
+        return;
+    }
+    const uint64_t l1d_read_miss = PERF_COUNT_HW_CACHE_L1D
+            | (PERF_COUNT_HW_CACHE_OP_READ << 8)
+            | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+
+    fds[Cycles] = openCounter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES);
+    fds[Instructions] = openCounter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS);
+    fds[L1dMisses] = openCounter(PERF_TYPE_HW_CACHE, l1d_read_miss);
+    fds[LlcMisses] = openCounter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES);
+#endif
+}
+
+PhaseProfiler::~PhaseProfiler()
+{
+#ifdef __linux__
+    for (int fd: fds) {
+        if (fd >= 0) {
+            close(fd);
+        }
+    }
+#endif
+}
+
+/**
+ * Read the current value of a counter, scaled for the time it was multiplexed off the hardware.
+ *
+ * @param counter The counter to read.
+ * @return The counter value, or 0 if it is unavailable.
+ */
+uint64_t PhaseProfiler::readCounter(Counter counter) const
+{
+#ifdef __linux__
+    uint64_t values[3] = {0, 0, 0};   // value, time enabled, time running
+    if (fds[counter] < 0 || read(fds[counter], values, sizeof(values)) != sizeof(values)) {
+        return 0;
+    }
+    if (values[2] > 0 && values[2] < values[1]) {
+        return static_cast<uint64_t>(static_cast<double>(values[0]) * values[1] / values[2]);
+    }
+    return values[0];
+#else
+    return 0;
+#endif
+}
+
+/**
+ * Start a phase. Ends the current phase first if one is active.
+ *
+ * @param name The name of the phase in the report.
+ */
+void PhaseProfiler::begin(const std::string& name)
+{
+    if (in_phase) {
+        end();
+    }
+    phases.emplace_back();
+    phases.back().name = name;
+    in_phase = true;
+
+    for (int c = 0; c < counter_count; ++c) {
+        start_counts[c] = readCounter(static_cast<Counter>(c));
+    }
+    start_time = std::chrono::high_resolution_clock::now();
+}
+
+/**
+ * End the current phase.
+ *
+ * @param flops The number of floating point operations the phase performed, or 0 if unknown.
+ */
+void PhaseProfiler::end(double flops)
+{
+    if (!in_phase) {
+        return;
+    }
+    std::chrono::duration<double> elapsed = std::chrono::high_resolution_clock::now() - start_time;
+
+    Phase& phase = phases.back();
+    for (int c = 0; c < counter_count; ++c) {
+        phase.counts[c] = readCounter(static_cast<Counter>(c)) - start_counts[c];
+    }
+    phase.seconds = elapsed.count();
+    phase.flops = flops;
+    in_phase = false;
+}
+
+/**
+ * Write the recorded phases as a JSON object. Counters which are unavailable,
+ * and rates which cannot be derived, are written as null.
+ *
+ * @param out The output stream.
+ */
+void PhaseProfiler::writeJson(std::ostream& out) const
+{
+    bool any_counter = false;
+    for (int fd: fds) {
+        any_counter = any_counter || fd >= 0;
+    }
+
+    out << "{\n";
+    out << "  \"hardware_counters\": " << (any_counter ? "true" : "false") << ",\n";
+    out << "  \"threads\": " << omp_get_max_threads() << ",\n";
+    out << "  \"phases\": [";
+    for (size_t p = 0; p < phases.size(); ++p)
+    {
+        const Phase& phase = phases[p];
+        out << (p == 0 ? "\n" : ",\n");
+        out << "    {\"name\": \"" << phase.name << "\", \"seconds\": " << phase.seconds;
+
+        for (int c = 0; c < counter_count; ++c)
+        {
+            out << ", \"" << counter_names[c] << "\": ";
+            if (hasCounter(static_cast<Counter>(c))) {
+                out << phase.counts[c];
+            } else {
+                out << "null";
+            }
+        }
+
+        out << ", \"ipc\": ";
+        if (hasCounter(Cycles) && hasCounter(Instructions) && phase.counts[Cycles] > 0) {
+            out << static_cast<double>(phase.counts[Instructions]) / phase.counts[Cycles];
+        } else {
+            out << "null";
+        }
+
+        out << ", \"gflops\": ";
+        if (phase.flops > 0.0 && phase.seconds > 0.0) {
+            out << phase.flops / phase.seconds / 1e9;
+        } else {
+            out << "null";
+        }
+        out << "}";
+    }
+    out << "\n  ]\n}" << std::endl;
+}
@@ -0,0 +1,60 @@
+/******************************************************************************
+ * Filename: profiler.h
+ * Author: Zachary Colbert
+ * Contact: zcolbert@sfsu.edu
+ *
+ * Description: Interface of the per-phase profiler, which records the wall
+ *              time and hardware performance counters of each phase of a run
+ *              and reports them as JSON.
+ *****************************************************************************/
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+
+
+/**
+ * Records the wall time and hardware counters of consecutive phases of the program.
+ *
+ * Counters are read through perf_event_open for the whole process, including the
+ * OpenMP threads created after the profiler. When the counters cannot be opened
+ * (no kernel support, or perf_event_paranoid forbids it) only wall time is recorded.
+ * Phases must not overlap.
+ */
+class PhaseProfiler
+{
+public:
+    /** The counters read for each phase, in the order they are opened. */
+    enum Counter { Cycles, Instructions, L1dMisses, LlcMisses, counter_count };
+
+    explicit PhaseProfiler(bool use_counters);
+    ~PhaseProfiler();
+    PhaseProfiler(const PhaseProfiler&) = delete;
+    PhaseProfiler& operator=(const PhaseProfiler&) = delete;
+
+    void begin(const std::string& name);
+    void end(double flops = 0.0);
+
+    bool hasCounter(Counter counter) const { return fds[counter] >= 0; }
+    void writeJson(std::ostream& out) const;
+
+private:
+    struct Phase
+    {
+        std::string name;
+        double seconds = 0.0;
+        double flops = 0.0;     // Floating point operations performed, if known
+        uint64_t counts[counter_count] = {};
+    };
+
+    uint64_t readCounter(Counter counter) const;
+
+    int fds[counter_count];
+    std::vector<Phase> phases;
+    uint64_t start_counts[counter_count] = {};
+    std::chrono::time_point<std::chrono::high_resolution_clock> start_time;
+    bool in_phase = false;
+};
@@ -0,0 +1,82 @@
+/******************************************************************************
+ * Filename: projection.cpp
+ * Author: Zachary Colbert
+ * Contact: zcolbert@sfsu.edu
+ *
+ * Description: Implementation of the sparse random projection.
+ *****************************************************************************/
+
+#include "projection.h"
+
+#include <algorithm>
+#include <cmath>
+#include <random>
+
+
+/**
+ * Draw a random projection matrix.
+ *
+ * @param input_dims M, the number of columns of the vectors to project.
+ * @param config The output dimensions, density and seed.
+ * @return The projection. The same seed always draws the same matrix.
+ */
+RandomProjection makeRandomProjection(size_t input_dims, const ProjectionConfig& config)
+{
+    RandomProjection projection;
+    projection.input_dims = input_dims;
+    projection.dims = config.dims;
+    projection.col_ptr.reserve(input_dims + 1);
+    projection.col_ptr.push_back(0);
+
+    const double density = config.density > 0.0 ? std::min(1.0, config.density)
+                                                 : 1.0 / std::sqrt(static_cast<double>(std::max<size_t>(1, input_dims)));
+    const float scale = static_cast<float>(std::sqrt(1.0 / (density * config.dims)));
+
+    // The gap to the next non-zero entry is geometric, so drawing costs time in the non-zeros, not M x k.
+    // The distribution needs a density below 1, and at 1 every entry is non-zero.
+    std::mt19937_64 rng(config.seed);
+    std::geometric_distribution<size_t> gap(density < 1.0 ? density : 0.5);
+    auto skip = [&]() -> size_t { return density < 1.0 ? gap(rng) : 0; };
+    std::bernoulli_distribution negative(0.5);
+    for (size_t j = 0; j < input_dims; ++j)
+    {
+        for (size_t c = skip(); c < config.dims; c += 1 + skip())
+        {
+            projection.out_idx.push_back(static_cast<uint32_t>(c));
+            projection.weights.push_back(negative(rng) ? -scale : scale);
+        }
+        projection.col_ptr.push_back(projection.out_idx.size());
+    }
+    return projection;
+}
+
+/**
+ * Project each row of a sparse matrix, computing matrix x projection.
+ *
+ * @param matrix The N x M sparse matrix.
+ * @param projection The M x k projection.
+ * @return The row-wise N x k dense matrix.
+ */
+std::vector<float> projectRows(const CsrView& matrix, const RandomProjection& projection)
+{
+    const size_t k = projection.dims;
+    std::vector<float> result(matrix.rows * k, 0.0f);
+
+    #pragma omp parallel for schedule(dynamic, 64)
+    for (size_t i = 0; i < matrix.rows; ++i)
+    {
+        float* out = &result[i * k];
+        for (size_t p = matrix.row_ptr[i]; p < matrix.row_ptr[i + 1]; ++p)
+        {
+            const uint32_t j = matrix.col_idx[p];
+            if (j >= projection.input_dims) {
+                continue;
+            }
+            const float v = matrix.values[p];
+            for (size_t q = projection.col_ptr[j]; q < projection.col_ptr[j + 1]; ++q) {
+                out[projection.out_idx[q]] += v * projection.weights[q];
+            }
+        }
+    }
+    return result;
+}
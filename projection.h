@@ -0,0 +1,61 @@
+/******************************************************************************
+ * Filename: projection.h
+ * Author: Zachary Colbert
+ * Contact: zcolbert@sfsu.edu
+ *
+ * Description: Interface of the sparse random projection, which reduces each
+ *              document vector to a few hundred dense dimensions so the dense
+ *              multiply kernels run on an N x k matrix instead of N x M.
+ *              Dot products, and so cosine similarities, are preserved in
+ *              expectation, with an error shrinking as 1 / sqrt(k).
+ *****************************************************************************/
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "sparse.h"
+
+
+/** Settings of a random projection. */
+struct ProjectionConfig
+{
+    size_t dims = 256;          // k, the dimensions after projection
+    double density = 0.0;       // Fraction of non-zero entries. Zero uses 1 / sqrt(M), as Li et al. suggest.
+    uint64_t seed = 1;
+};
+
+/**
+ * An M x k projection matrix whose entries are +sqrt(s / k), 0 or -sqrt(s / k), with
+ * probabilities 1 / 2s, 1 - 1 / s and 1 / 2s for s = 1 / density (Achlioptas; Li,
+ * Hastie and Church). Stored by input column: the non-zero entries of input column j
+ * are [col_ptr[j], col_ptr[j + 1]) of out_idx and weights.
+ */
+struct RandomProjection
+{
+    size_t input_dims = 0;
+    size_t dims = 0;
+    std::vector<size_t> col_ptr;
+    std::vector<uint32_t> out_idx;
+    std::vector<float> weights;
+};
+
+/**
+ * Draw a random projection matrix.
+ *
+ * @param input_dims M, the number of columns of the vectors to project.
+ * @param config The output dimensions, density and seed.
+ * @return The projection. The same seed always draws the same matrix.
+ */
+RandomProjection makeRandomProjection(size_t input_dims, const ProjectionConfig& config);
+
+/**
+ * Project each row of a sparse matrix, computing matrix x projection.
+ * Only the non-zero elements of each row are visited.
+ *
+ * @param matrix The N x M sparse matrix.
+ * @param projection The M x k projection.
+ * @return The row-wise N x k dense matrix.
+ */
+std::vector<float> projectRows(const CsrView& matrix, const RandomProjection& projection);
@@ -0,0 +1,595 @@
+/******************************************************************************
+ * Filename: quantize.cpp
+ * Author: Zachary Colbert
+ * Contact: zcolbert@sfsu.edu
+ *
+ * Description: Implementation of reduced-precision document vectors and the
+ *              self-similarity multiply over them.
+ *
+ *      The multiply computes one tile of 64 x 64 row pairs at a time, like
+ *      matrixSelfMultiply. Each kernel call forms the 4 x 4 dot products of two
+ *      groups of four rows, so every load is used four times.
+ *      Int8 elements are sign-extended to 16 bits and multiplied pairwise into
+ *      32-bit lanes (pmaddwd), which is exact for any int8 input. Bf16 elements
+ *      are widened to fp32 by a 16-bit shift and accumulated with FMA, or
+ *      multiplied directly with vdpbf16ps on CPUs with AVX512-BF16.
+ *****************************************************************************/
+
+#include "quantize.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define LTS_QUANTIZE_X86 1
+#endif
+
+
+// Rows are padded to whole 64-byte registers of either element type
+static const size_t int8_row_align = 64;
+static const size_t bf16_row_align = 32;
+
+// Row pairs computed per parallel task
+static const size_t quantized_tile = 64;
+
+// Each kernel call forms the dot_rows x dot_rows dot products of two groups of rows
+static const size_t dot_rows = 4;
+
+using DotInt8 = void (*)(const int8_t* const* a, const int8_t* const* b, size_t len, int32_t* out);
+using DotBf16 = void (*)(const uint16_t* const* a, const uint16_t* const* b, size_t len, float* out);
+
+struct QuantizedKernel
+{
+    const char* name;
+    DotInt8 int8;
+    DotBf16 bf16;
+};
+
+
+/************************** Conversions *******************************/
+
+/**
+ * Convert a float to bf16 by rounding to the nearest even upper half.
+ */
+static uint16_t toBf16(float value)
+{
+    uint32_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    if (std::isnan(value)) {
+        return static_cast<uint16_t>((bits >> 16) | 0x40);    // keep NaN a quiet NaN
+    }
+    bits += 0x7FFF + ((bits >> 16) & 1);
+    return static_cast<uint16_t>(bits >> 16);
+}
+
+/**
+ * Convert a bf16 value back to float.
+ */
+static float fromBf16(uint16_t value)
+{
+    uint32_t bits = static_cast<uint32_t>(value) << 16;
+    float result;
+    std::memcpy(&result, &bits, sizeof(result));
+    return result;
+}
+
+
+/************************** Dot-product kernels *******************************/
+
+static void dotInt8Generic(const int8_t* const* a, const int8_t* const* b, size_t len, int32_t* out)
+{
+    int32_t acc[dot_rows * dot_rows] = {};
+    for (size_t k = 0; k < len; ++k) {
+        for (size_t i = 0; i < dot_rows; ++i) {
+            for (size_t j = 0; j < dot_rows; ++j) {
+                acc[i * dot_rows + j] += static_cast<int32_t>(a[i][k]) * b[j][k];
+            }
+        }
+    }
+    std::copy(acc, acc + dot_rows * dot_rows, out);
+}
+
+static void dotBf16Generic(const uint16_t* const* a, const uint16_t* const* b, size_t len, float* out)
+{
+    float acc[dot_rows * dot_rows] = {};
+    for (size_t k = 0; k < len; ++k) {
+        for (size_t i = 0; i < dot_rows; ++i) {
+            for (size_t j = 0; j < dot_rows; ++j) {
+                acc[i * dot_rows + j] += fromBf16(a[i][k]) * fromBf16(b[j][k]);
+            }
+        }
+    }
+    std::copy(acc, acc + dot_rows * dot_rows, out);
+}
+
+#ifdef LTS_QUANTIZE_X86
+
+__attribute__((target("avx2")))
+static int32_t sumInt32(__m256i v)
+{
+    __m128i s = _mm_add_epi32(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1));
+    s = _mm_add_epi32(s, _mm_shuffle_epi32(s, 0x4E));
+    s = _mm_add_epi32(s, _mm_shuffle_epi32(s, 0xB1));
+    return _mm_cvtsi128_si32(s);
+}
+
+__attribute__((target("avx2,fma")))
+static float sumFloat(__m256 v)
+{
+    __m128 s = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+    s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+    s = _mm_add_ss(s, _mm_movehdup_ps(s));
+    return _mm_cvtss_f32(s);
+}
+
+__attribute__((target("avx2")))
+static __m256i loadInt8Avx2(const int8_t* p)
+{
+    return _mm256_cvtepi8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p)));
+}
+
+__attribute__((target("avx2")))
+static __m256 loadBf16Avx2(const uint16_t* p)
+{
+    return _mm256_castsi256_ps(_mm256_slli_epi32(
+            _mm256_cvtepu16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p))), 16));
+}
+
+// len is a multiple of 64. Two rows of a at a time keep the accumulators within the 16 ymm registers.
+__attribute__((target("avx2")))
+static void dotInt8Avx2(const int8_t* const* a, const int8_t* const* b, size_t len, int32_t* out)
+{
+    for (size_t i = 0; i < dot_rows; i += 2)
+    {
+        __m256i acc[2][dot_rows];
+        for (size_t j = 0; j < dot_rows; ++j) {
+            acc[0][j] = acc[1][j] = _mm256_setzero_si256();
+        }
+        for (size_t k = 0; k < len; k += 16)
+        {
+            const __m256i x0 = loadInt8Avx2(a[i] + k);
+            const __m256i x1 = loadInt8Avx2(a[i + 1] + k);
+            for (size_t j = 0; j < dot_rows; ++j)
+            {
+                const __m256i y = loadInt8Avx2(b[j] + k);
+                acc[0][j] = _mm256_add_epi32(acc[0][j], _mm256_madd_epi16(x0, y));
+                acc[1][j] = _mm256_add_epi32(acc[1][j], _mm256_madd_epi16(x1, y));
+            }
+        }
+        for (size_t j = 0; j < dot_rows; ++j)
+        {
+            out[i * dot_rows + j] = sumInt32(acc[0][j]);
+            out[(i + 1) * dot_rows + j] = sumInt32(acc[1][j]);
+        }
+    }
+}
+
+// len is a multiple of 32
+__attribute__((target("avx2,fma")))
+static void dotBf16Avx2(const uint16_t* const* a, const uint16_t* const* b, size_t len, float* out)
+{
+    for (size_t i = 0; i < dot_rows; i += 2)
+    {
+        __m256 acc[2][dot_rows];
+        for (size_t j = 0; j < dot_rows; ++j) {
+            acc[0][j] = acc[1][j] = _mm256_setzero_ps();
+        }
+        for (size_t k = 0; k < len; k += 8)
+        {
+            const __m256 x0 = loadBf16Avx2(a[i] + k);
+            const __m256 x1 = loadBf16Avx2(a[i + 1] + k);
+            for (size_t j = 0; j < dot_rows; ++j)
+            {
+                const __m256 y = loadBf16Avx2(b[j] + k);
+                acc[0][j] = _mm256_fmadd_ps(x0, y, acc[0][j]);
+                acc[1][j] = _mm256_fmadd_ps(x1, y, acc[1][j]);
+            }
+        }
+        for (size_t j = 0; j < dot_rows; ++j)
+        {
+            out[i * dot_rows + j] = sumFloat(acc[0][j]);
+            out[(i + 1) * dot_rows + j] = sumFloat(acc[1][j]);
+        }
+    }
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static __m512i loadInt8Avx512(const int8_t* p)
+{
+    return _mm512_cvtepi8_epi16(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(p)));
+}
+
+__attribute__((target("avx512f")))
+static __m512 loadBf16Avx512(const uint16_t* p)
+{
+    return _mm512_castsi512_ps(_mm512_slli_epi32(
+            _mm512_cvtepu16_epi32(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(p))), 16));
+}
+
+// len is a multiple of 64
+__attribute__((target("avx512f,avx512bw")))
+static void dotInt8Avx512(const int8_t* const* a, const int8_t* const* b, size_t len, int32_t* out)
+{
+    __m512i acc[dot_rows][dot_rows];
+    for (size_t i = 0; i < dot_rows; ++i) {
+        for (size_t j = 0; j < dot_rows; ++j) {
+            acc[i][j] = _mm512_setzero_si512();
+        }
+    }
+    for (size_t k = 0; k < len; k += 32)
+    {
+        __m512i x[dot_rows];
+        for (size_t i = 0; i < dot_rows; ++i) {
+            x[i] = loadInt8Avx512(a[i] + k);
+        }
+        for (size_t j = 0; j < dot_rows; ++j)
+        {
+            const __m512i y = loadInt8Avx512(b[j] + k);
+            for (size_t i = 0; i < dot_rows; ++i) {
+                acc[i][j] = _mm512_add_epi32(acc[i][j], _mm512_madd_epi16(x[i], y));
+            }
+        }
+    }
+    for (size_t i = 0; i < dot_rows; ++i) {
+        for (size_t j = 0; j < dot_rows; ++j) {
+            out[i * dot_rows + j] = _mm512_reduce_add_epi32(acc[i][j]);
+        }
+    }
+}
+
+// len is a multiple of 32
+__attribute__((target("avx512f")))
+static void dotBf16Avx512(const uint16_t* const* a, const uint16_t* const* b, size_t len, float* out)
+{
+    __m512 acc[dot_rows][dot_rows];
+    for (size_t i = 0; i < dot_rows; ++i) {
+        for (size_t j = 0; j < dot_rows; ++j) {
+            acc[i][j] = _mm512_setzero_ps();
+        }
+    }
+    for (size_t k = 0; k < len; k += 16)
+    {
+        __m512 x[dot_rows];
+        for (size_t i = 0; i < dot_rows; ++i) {
+            x[i] = loadBf16Avx512(a[i] + k);
+        }
+        for (size_t j = 0; j < dot_rows; ++j)
+        {
+            const __m512 y = loadBf16Avx512(b[j] + k);
+            for (size_t i = 0; i < dot_rows; ++i) {
+                acc[i][j] = _mm512_fmadd_ps(x[i], y, acc[i][j]);
+            }
+        }
+    }
+    for (size_t i = 0; i < dot_rows; ++i) {
+        for (size_t j = 0; j < dot_rows; ++j) {
+            out[i * dot_rows + j] = _mm512_reduce_add_ps(acc[i][j]);
+        }
+    }
+}
+
+// len is a multiple of 64. vpdpwssd fuses the pairwise multiply and the accumulation.
+__attribute__((target("avx512f,avx512bw,avx512vnni")))
+static void dotInt8Vnni(const int8_t* const* a, const int8_t* const* b, size_t len, int32_t* out)
+{
+    __m512i acc[dot_rows][dot_rows];
+    for (size_t i = 0; i < dot_rows; ++i) {
+        for (size_t j = 0; j < dot_rows; ++j) {
+            acc[i][j] = _mm512_setzero_si512();
+        }
+    }
+    for (size_t k = 0; k < len; k += 32)
+    {
+        __m512i x[dot_rows];
+        for (size_t i = 0; i < dot_rows; ++i) {
+            x[i] = loadInt8Avx512(a[i] + k);
+        }
+        for (size_t j = 0; j < dot_rows; ++j)
+        {
+            const __m512i y = loadInt8Avx512(b[j] + k);
+            for (size_t i = 0; i < dot_rows; ++i) {
+                acc[i][j] = _mm512_dpwssd_epi32(acc[i][j], x[i], y);
+            }
+        }
+    }
+    for (size_t i = 0; i < dot_rows; ++i) {
+        for (size_t j = 0; j < dot_rows; ++j) {
+            out[i * dot_rows + j] = _mm512_reduce_add_epi32(acc[i][j]);
+        }
+    }
+}
+
+// len is a multiple of 32. vdpbf16ps multiplies pairs of bf16 values directly, without widening.
+__attribute__((target("avx512f,avx512bf16")))
+static void dotBf16Native(const uint16_t* const* a, const uint16_t* const* b, size_t len, float* out)
+{
+    __m512 acc[dot_rows][dot_rows];
+    for (size_t i = 0; i < dot_rows; ++i) {
+        for (size_t j = 0; j < dot_rows; ++j) {
+            acc[i][j] = _mm512_setzero_ps();
+        }
+    }
+    for (size_t k = 0; k < len; k += 32)
+    {
+        __m512bh x[dot_rows];
+        for (size_t i = 0; i < dot_rows; ++i) {
+            x[i] = (__m512bh) _mm512_loadu_si512(a[i] + k);
+        }
+        for (size_t j = 0; j < dot_rows; ++j)
+        {
+            const __m512bh y = (__m512bh) _mm512_loadu_si512(b[j] + k);
+            for (size_t i = 0; i < dot_rows; ++i) {
+                acc[i][j] = _mm512_dpbf16_ps(acc[i][j], x[i], y);
+            }
+        }
+    }
+    for (size_t i = 0; i < dot_rows; ++i) {
+        for (size_t j = 0; j < dot_rows; ++j) {
+            out[i * dot_rows + j] = _mm512_reduce_add_ps(acc[i][j]);
+        }
+    }
+}
+
+#endif  // LTS_QUANTIZE_X86
+
+static const QuantizedKernel generic_kernel = {"generic", &dotInt8Generic, &dotBf16Generic};
+#ifdef LTS_QUANTIZE_X86
+static const QuantizedKernel avx2_kernel = {"avx2", &dotInt8Avx2, &dotBf16Avx2};
+static const QuantizedKernel avx512_kernel = {"avx512", &dotInt8Avx512, &dotBf16Avx512};
+static const QuantizedKernel avx512bf16_kernel = {"avx512bf16", &dotInt8Vnni, &dotBf16Native};
+#endif
+
+
+/************************** Runtime dispatch *******************************/
+
+static bool supportsAvx512Bf16()
+{
+#ifdef LTS_QUANTIZE_X86
+    return __builtin_cpu_supports("avx512bw") && __builtin_cpu_supports("avx512vnni")
+           && __builtin_cpu_supports("avx512bf16");
+#else
+    return false;
+#endif
+}
+
+static bool supportsAvx512()
+{
+#ifdef LTS_QUANTIZE_X86
+    return __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw");
+#else
+    return false;
+#endif
+}
+
+static bool supportsAvx2()
+{
+#ifdef LTS_QUANTIZE_X86
+    return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+#else
+    return false;
+#endif
+}
+
+/**
+ * Find the widest kernels supported by this CPU, as reported by CPUID.
+ */
+static const QuantizedKernel* detectKernel()
+{
+#ifdef LTS_QUANTIZE_X86
+    __builtin_cpu_init();
+    if (supportsAvx512Bf16()) {
+        return &avx512bf16_kernel;
+    }
+    if (supportsAvx512()) {
+        return &avx512_kernel;
+    }
+    if (supportsAvx2()) {
+        return &avx2_kernel;
+    }
+#endif
+    return &generic_kernel;
+}
+
+// Selected once at startup, before main() runs
+static const QuantizedKernel* active_kernel = detectKernel();
+
+/**
+ * Select the dot-product kernels by name: "generic" (plain C++), "avx2", "avx512", or
+ * "avx512bf16", which uses the AVX512-VNNI and AVX512-BF16 dot-product instructions.
+ * "best" selects the widest kernels supported by this CPU, which are also the
+ * kernels chosen automatically on first use.
+ *
+ * @param name The kernel name.
+ * @return False if the name is unknown or the CPU does not support the kernels.
+ */
+bool selectQuantizedKernel(const std::string& name)
+{
+    if (name == "best") {
+        active_kernel = detectKernel();
+        return true;
+    }
+    if (name == "generic") {
+        active_kernel = &generic_kernel;
+        return true;
+    }
+#ifdef LTS_QUANTIZE_X86
+    if (name == "avx2" && supportsAvx2()) {
+        active_kernel = &avx2_kernel;
+        return true;
+    }
+    if (name == "avx512" && supportsAvx512()) {
+        active_kernel = &avx512_kernel;
+        return true;
+    }
+    if (name == "avx512bf16" && supportsAvx512Bf16()) {
+        active_kernel = &avx512bf16_kernel;
+        return true;
+    }
+#endif
+    return false;
+}
+
+/** @return The name of the active quantized dot-product kernels. */
+std::string quantizedKernelName()
+{
+    return active_kernel->name;
+}
+
+
+/************************** Quantization *******************************/
+
+/**
+ * Quantize a row-wise float matrix.
+ *
+ * @param matrix The row-wise rows x cols matrix.
+ * @param rows The number of rows in the matrix.
+ * @param cols The number of columns in each row.
+ * @param format The storage format.
+ * @return The quantized matrix.
+ */
+QuantizedMatrix quantizeMatrix(const std::vector<float>& matrix, size_t rows, size_t cols, QuantizedFormat format)
+{
+    QuantizedMatrix q;
+    q.format = format;
+    q.rows = rows;
+    q.cols = cols;
+
+    if (format == QuantizedFormat::Int8)
+    {
+        q.stride = (cols + int8_row_align - 1) / int8_row_align * int8_row_align;
+        q.int8_values.assign(rows * q.stride, 0);
+        q.scales.assign(rows, 0.0f);
+
+        #pragma omp parallel for
+        for (size_t i = 0; i < rows; ++i)
+        {
+            const float* row = &matrix[i * cols];
+            float max_abs = 0.0f;
+            for (size_t j = 0; j < cols; ++j) {
+                max_abs = std::max(max_abs, std::fabs(row[j]));
+            }
+            if (max_abs == 0.0f) {
+                continue;
+            }
+            q.scales[i] = max_abs / 127.0f;
+            const float inv_scale = 127.0f / max_abs;
+            for (size_t j = 0; j < cols; ++j) {
+                q.int8_values[i * q.stride + j] = static_cast<int8_t>(std::lrint(row[j] * inv_scale));
+            }
+        }
+    }
+    else
+    {
+        q.stride = (cols + bf16_row_align - 1) / bf16_row_align * bf16_row_align;
+        q.bf16_values.assign(rows * q.stride, 0);
+
+        #pragma omp parallel for
+        for (size_t i = 0; i < rows; ++i) {
+            for (size_t j = 0; j < cols; ++j) {
+                q.bf16_values[i * q.stride + j] = toBf16(matrix[i * cols + j]);
+            }
+        }
+    }
+    return q;
+}
+
+
+/************************** Multiply *******************************/
+
+/**
+ * Compute the dot products of up to dot_rows consecutive rows with up to dot_rows others.
+ * Missing rows are replaced by the first row of their group and their products discarded.
+ *
+ * @param q The quantized matrix.
+ * @param i The first row of the first group.
+ * @param i_count The number of rows in the first group, at most dot_rows.
+ * @param j The first row of the second group.
+ * @param j_count The number of rows in the second group, at most dot_rows.
+ * @param out Receives the scaled dot products, dot_rows per row of the first group.
+ */
+static void dotBlock(const QuantizedMatrix& q, size_t i, size_t i_count, size_t j, size_t j_count, float* out)
+{
+    if (q.format == QuantizedFormat::Int8)
+    {
+        const int8_t* a[dot_rows];
+        const int8_t* b[dot_rows];
+        for (size_t r = 0; r < dot_rows; ++r)
+        {
+            a[r] = &q.int8_values[(r < i_count ? i + r : i) * q.stride];
+            b[r] = &q.int8_values[(r < j_count ? j + r : j) * q.stride];
+        }
+        int32_t acc[dot_rows * dot_rows];
+        active_kernel->int8(a, b, q.stride, acc);
+        for (size_t r = 0; r < i_count; ++r) {
+            for (size_t c = 0; c < j_count; ++c) {
+                out[r * dot_rows + c] = static_cast<float>(acc[r * dot_rows + c]) * q.scales[i + r] * q.scales[j + c];
+            }
+        }
+    }
+    else
+    {
+        const uint16_t* a[dot_rows];
+        const uint16_t* b[dot_rows];
+        for (size_t r = 0; r < dot_rows; ++r)
+        {
+            a[r] = &q.bf16_values[(r < i_count ? i + r : i) * q.stride];
+            b[r] = &q.bf16_values[(r < j_count ? j + r : j) * q.stride];
+        }
+        active_kernel->bf16(a, b, q.stride, out);
+    }
+}
+
+/**
+ * Compute the full N x N matrix x transpose(matrix) from quantized rows.
+ *
+ * Only the tiles on and above the diagonal are computed, and each element is mirrored.
+ * Int8 products are accumulated exactly in int32 and scaled once per element;
+ * bf16 products are accumulated in fp32.
+ *
+ * @param matrix The quantized N x M matrix.
+ * @param result The N x N result, overwritten with the similarity of each pair of rows.
+ */
+void quantizedSelfMultiply(const QuantizedMatrix& matrix, std::vector<float>& result)
+{
+    const size_t n = matrix.rows;
+    result.resize(n * n);
+
+    const size_t blocks = (n + quantized_tile - 1) / quantized_tile;
+    std::vector<std::pair<size_t, size_t>> pairs;
+    pairs.reserve(blocks * (blocks + 1) / 2);
+    for (size_t bi = 0; bi < blocks; ++bi) {
+        for (size_t bj = bi; bj < blocks; ++bj) {
+            pairs.emplace_back(bi, bj);
+        }
+    }
+
+    #pragma omp parallel for schedule(dynamic)
+    for (size_t p = 0; p < pairs.size(); ++p)
+    {
+        const size_t i0 = pairs[p].first * quantized_tile;
+        const size_t j0 = pairs[p].second * quantized_tile;
+        const size_t i_end = std::min(i0 + quantized_tile, n);
+        const size_t j_end = std::min(j0 + quantized_tile, n);
+
+        float dots[dot_rows * dot_rows];
+        for (size_t i = i0; i < i_end; i += dot_rows)
+        {
+            const size_t i_count = std::min(dot_rows, i_end - i);
+            // Within a diagonal tile, start at the block containing the diagonal
+            for (size_t j = (i0 == j0 ? i : j0); j < j_end; j += dot_rows)
+            {
+                const size_t j_count = std::min(dot_rows, j_end - j);
+                dotBlock(matrix, i, i_count, j, j_count, dots);
+                for (size_t r = 0; r < i_count; ++r) {
+                    for (size_t c = 0; c < j_count; ++c)
+                    {
+                        result[(i + r) * n + j + c] = dots[r * dot_rows + c];
+                        result[(j + c) * n + i + r] = dots[r * dot_rows + c];
+                    }
+                }
+            }
+        }
+    }
+}
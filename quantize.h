@@ -0,0 +1,75 @@
+/******************************************************************************
+ * Filename: quantize.h
+ * Author: Zachary Colbert
+ * Contact: zcolbert@sfsu.edu
+ *
+ * Description: Interface of reduced-precision document vectors (int8 with a
+ *              per-row scale, or bf16) and the self-similarity multiply over
+ *              them, which accumulates in int32 or fp32.
+ *****************************************************************************/
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+
+/** Storage formats of a quantized matrix. */
+enum class QuantizedFormat { Int8, Bf16 };
+
+/**
+ * A row-wise matrix stored in reduced precision.
+ *
+ * Rows are zero-padded to a stride of whole SIMD registers, so kernels never need
+ * a remainder loop. For Int8, row i holds round(x / scales[i]) where scales[i] is
+ * the largest magnitude of the row divided by 127. For Bf16, each element holds the
+ * upper 16 bits of the float, rounded to nearest even, and the scales are unused.
+ */
+struct QuantizedMatrix
+{
+    QuantizedFormat format = QuantizedFormat::Int8;
+    size_t rows = 0;
+    size_t cols = 0;
+    size_t stride = 0;                  // Elements between the starts of consecutive rows
+    std::vector<int8_t> int8_values;
+    std::vector<uint16_t> bf16_values;
+    std::vector<float> scales;
+};
+
+/**
+ * Quantize a row-wise float matrix.
+ *
+ * @param matrix The row-wise rows x cols matrix.
+ * @param rows The number of rows in the matrix.
+ * @param cols The number of columns in each row.
+ * @param format The storage format.
+ * @return The quantized matrix.
+ */
+QuantizedMatrix quantizeMatrix(const std::vector<float>& matrix, size_t rows, size_t cols, QuantizedFormat format);
+
+/**
+ * Compute the full N x N matrix x transpose(matrix) from quantized rows.
+ *
+ * Only the tiles on and above the diagonal are computed, and each element is mirrored.
+ * Int8 products are accumulated exactly in int32 and scaled once per element;
+ * bf16 products are accumulated in fp32.
+ *
+ * @param matrix The quantized N x M matrix.
+ * @param result The N x N result, overwritten with the similarity of each pair of rows.
+ */
+void quantizedSelfMultiply(const QuantizedMatrix& matrix, std::vector<float>& result);
+
+/**
+ * Select the dot-product kernels by name: "generic" (plain C++), "avx2", "avx512", or
+ * "avx512bf16", which uses the AVX512-VNNI and AVX512-BF16 dot-product instructions.
+ * "best" selects the widest kernels supported by this CPU, which are also the
+ * kernels chosen automatically on first use.
+ *
+ * @param name The kernel name.
+ * @return False if the name is unknown or the CPU does not support the kernels.
+ */
+bool selectQuantizedKernel(const std::string& name);
+
+/** @return The name of the active quantized dot-product kernels. */
+std::string quantizedKernelName();
@@ -0,0 +1,126 @@
+/******************************************************************************
+ * Filename: queue.h
+ * Author: Zachary Colbert
+ * Contact: zcolbert@sfsu.edu
+ *
+ * Description:
+ *      A bounded lock-free queue connecting one producer thread to one
+ *      consumer thread, used between the stages of the ingest pipeline.
+ *****************************************************************************/
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <thread>
+#include <utility>
+#include <vector>
+
+
+/**
+ * Waits with increasing patience: a short spin, then yielding the core, then sleeping.
+ * Stages which outnumber the cores give up their time slice instead of spinning it away.
+ */
+class Backoff
+{
+public:
+    void wait()
+    {
+        if (++rounds <= 64) {
+            return;
+        }
+        if (rounds <= 256) {
+            std::this_thread::yield();
+        } else {
+            std::this_thread::sleep_for(std::chrono::microseconds(50));
+        }
+    }
+
+private:
+    unsigned rounds = 0;
+};
+
+
+/**
+ * A single-producer, single-consumer ring buffer of fixed capacity.
+ *
+ * The producer only writes the tail and the consumer only writes the head, so
+ * neither needs a lock: each publishes its index with a release store which the
+ * other reads with an acquire load. A full queue makes push() wait, which holds
+ * back the producer until the consumer catches up.
+ */
+template <typename T>
+class SpscQueue
+{
+public:
+    /**
+     * @param capacity The most items the queue holds at once. Rounded up to a power of two.
+     */
+    explicit SpscQueue(size_t capacity)
+    {
+        size_t size = 1;
+        while (size < capacity) {
+            size *= 2;
+        }
+        slots.resize(size);
+        mask = size - 1;
+    }
+
+    SpscQueue(const SpscQueue&) = delete;
+    SpscQueue& operator=(const SpscQueue&) = delete;
+
+    /**
+     * Add an item, waiting while the queue is full. Only the producer may call this.
+     *
+     * @param item The item to move into the queue.
+     * @return True if the queue was full and the producer had to wait.
+     */
+    bool push(T item)
+    {
+        const size_t t = tail.load(std::memory_order_relaxed);
+        bool stalled = false;
+        Backoff backoff;
+        while (t - head.load(std::memory_order_acquire) > mask)
+        {
+            stalled = true;
+            backoff.wait();
+        }
+        slots[t & mask] = std::move(item);
+        tail.store(t + 1, std::memory_order_release);
+        return stalled;
+    }
+
+    /**
+     * Remove the oldest item, waiting while the queue is empty and open. Only the consumer may call this.
+     *
+     * @param item Receives the item.
+     * @return False if the queue is closed and every item has been removed.
+     */
+    bool pop(T& item)
+    {
+        const size_t h = head.load(std::memory_order_relaxed);
+        Backoff backoff;
+        while (h == tail.load(std::memory_order_acquire))
+        {
+            // The closing store follows the last push, so re-check the tail once closed is seen
+            if (closed.load(std::memory_order_acquire) && h == tail.load(std::memory_order_acquire)) {
+                return false;
+            }
+            backoff.wait();
+        }
+        item = std::move(slots[h & mask]);
+        head.store(h + 1, std::memory_order_release);
+        return true;
+    }
+
+    /** Mark that no more items will be pushed. Only the producer may call this. */
+    void close() { closed.store(true, std::memory_order_release); }
+
+private:
+    std::vector<T> slots;
+    size_t mask;
+    alignas(64) std::atomic<size_t> head{0};    // Next slot to pop, written by the consumer
+    alignas(64) std::atomic<size_t> tail{0};    // Next slot to push, written by the producer
+    alignas(64) std::atomic<bool> closed{false};
+};
@@ -0,0 +1,71 @@
+# ==============================================================================
+# Program:  accuracy.py
+# Author:   Zachary Colbert <zcolbert@sfsu.edu>
+# Purpose:  Shared helpers of the accuracy scripts.
+#
+# Description:
+#   Runs the LTS executable writing the full similarity matrix with --scores,
+#   loads score matrices, and compares a result against a reference score
+#   matrix. Used by quantize_accuracy.py, hashing_accuracy.py and
+#   projection_accuracy.py, which add only their mode-specific measurements.
+# ==============================================================================
+
+import collections
+import csv
+import math
+import subprocess
+
+
+# The errors of a result against a reference. bias and the percentiles cover the
+# off-diagonal scores, and the other errors cover every score.
+Comparison = collections.namedtuple('Comparison', ['bias', 'max_err', 'mean_err', 'rms_err', 'p50', 'p90', 'p99',
+                                                   'recall'])
+
+
+def load_scores(path):
+    """Load a square score matrix written by --scores or by DataFrame.to_csv()."""
+    with open(path, 'r') as infile:
+        reader = csv.reader(infile)
+        next(reader)  # column indices
+        return [[float(v) for v in row[1:]] for row in reader]
+
+
+def run(executable, data, count, extra, scores_path):
+    """Run LTS on the term frequency vectors, writing --scores, and return the multiply runtime it reports."""
+    cmd = [executable, '--data', data, '--count', str(count), '--tf', '--scores', scores_path] + extra
+    p = subprocess.run(cmd, capture_output=True, text=True, check=True)
+    return float(p.stdout.split()[-1])
+
+
+def top_neighbors(row, i, k):
+    """The indices of the k highest scores in a row, excluding the document itself."""
+    order = sorted((j for j in range(len(row)) if j != i), key=lambda j: -row[j])
+    return set(order[:k])
+
+
+def compare(scores, reference, k):
+    """Compare the leading square of two score matrices, with the top-k neighbour recall."""
+    n = min(len(scores), len(reference))
+    errors = []
+    bias = 0.0
+    max_err = 0.0
+    sum_err = 0.0
+    sum_sq = 0.0
+    recall = 0.0
+    for i in range(n):
+        for j in range(n):
+            err = scores[i][j] - reference[i][j]
+            if i != j:
+                bias += err
+                errors.append(abs(err))
+            max_err = max(max_err, abs(err))
+            sum_err += abs(err)
+            sum_sq += err * err
+        expected = top_neighbors(reference[i][:n], i, k)
+        if expected:
+            recall += len(top_neighbors(scores[i][:n], i, k) & expected) / len(expected)
+
+    errors.sort()
+    pct = [errors[min(len(errors) - 1, int(p / 100.0 * len(errors)))] if errors else 0.0 for p in (50, 90, 99)]
+    return Comparison(bias / max(1, len(errors)), max_err, sum_err / (n * n), math.sqrt(sum_sq / (n * n)),
+                      *pct, recall / n)
@@ -0,0 +1,101 @@
+# ==============================================================================
+# Program:  hashing_accuracy.py
+# Author:   Zachary Colbert <zcolbert@sfsu.edu>
+# Purpose:  Measure the collisions and error of the feature-hashing vectorizer.
+#
+# Description:
+#   Runs the LTS executable with the exact vocabulary (--sparse) and with
+#   --hash-bits at a range of sizes, with and without signed hashing, writing
+#   the full similarity matrix of each run with --scores. Each hashed result
+#   is compared against the exact result.
+#
+#   For each size the report gives the fraction of distinct ngrams which
+#   share their column with another ngram, the mean (signed) error of the
+#   off-diagonal scores, the maximum, mean and RMS absolute error, and the
+#   fraction of documents whose 10 nearest neighbours are unchanged. The
+#   collisions are computed here by hashing the ngrams as hashing.h does.
+# ==============================================================================
+
+import argparse
+import csv
+import os
+import tempfile
+
+from accuracy import compare, load_scores, run
+
+
+MASK64 = (1 << 64) - 1
+
+
+def parse_args():
+    parser = argparse.ArgumentParser()
+
+    parser.add_argument('executable', help='The LTS executable')
+    parser.add_argument('-d', '--data', default='../data/movie_reviews_combined.txt', help='The input data file')
+    parser.add_argument('-c', '--count', type=int, default=1000, help='Number of documents')
+    parser.add_argument('-b', '--bits', default='8,10,12,14,16,18', help='Comma-separated hash sizes')
+    parser.add_argument('-k', '--neighbors', type=int, default=10, help='Neighbourhood size for the recall metric')
+    parser.add_argument('-o', '--output', default='hashing_accuracy.csv', help='Output CSV file')
+
+    return parser.parse_args()
+
+
+def bigram_keys(data, count):
+    """The distinct packed bigrams of the first count lines, as the tokenizer counts them."""
+    keys = set()
+    with open(data, 'rb') as infile:
+        for _, line in zip(range(count), infile):
+            text = line.rstrip(b'\n').lower()
+            for i in range(len(text)):
+                keys.add((text[i] << 8) | text[i + 1] if i + 1 < len(text) else text[i])
+    return keys
+
+
+def collision_rate(keys, bits):
+    """The fraction of keys whose column is shared with another key."""
+    columns = {}
+    for key in keys:
+        column = ((key * 0x9E3779B97F4A7C15) & MASK64) >> (64 - bits)
+        columns[column] = columns.get(column, 0) + 1
+    return sum(n for n in columns.values() if n > 1) / len(keys)
+
+
+def main():
+    args = parse_args()
+    keys = bigram_keys(args.data, args.count)
+    print(f'{len(keys)} distinct bigrams')
+
+    rows = []
+    with tempfile.TemporaryDirectory() as tmp:
+        scores_path = os.path.join(tmp, 'scores.csv')
+        print('Running exact', end=' ', flush=True)
+        runtime = run(args.executable, args.data, args.count, ['--sparse'], scores_path)
+        print(f'({runtime} s)')
+        reference = load_scores(scores_path)
+
+        for bits in (int(b) for b in args.bits.split(',')):
+            collisions = collision_rate(keys, bits)
+            for name, extra in (('signed', []), ('unsigned', ['--hash-unsigned'])):
+                print(f'Running {bits} bits {name}', end=' ', flush=True)
+                extra = ['--sparse', '--hash-bits', str(bits)] + extra
+                runtime = run(args.executable, args.data, args.count, extra, scores_path)
+                print(f'({runtime} s)')
+
+                c = compare(load_scores(scores_path), reference, args.neighbors)
+                rows.append([bits, name, args.count, len(keys), collisions, runtime, c.bias, c.max_err, c.mean_err,
+                             c.rms_err, c.recall])
+
+    headers = ['Bits', 'Hash', 'Documents', 'Ngrams', 'Colliding Ngrams', 'Runtime (s)', 'Mean Error',
+               'Max Abs Error', 'Mean Abs Error', 'RMS Error', f'Top-{args.neighbors} Recall']
+    with open(args.output, 'w') as outfile:
+        writer = csv.writer(outfile)
+        writer.writerow(headers)
+        writer.writerows(rows)
+
+    print(','.join(headers))
+    for row in rows:
+        print(','.join(str(v) for v in row))
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,110 @@
+# ==============================================================================
+# Program:  join_pruning.py
+# Author:   Zachary Colbert <zcolbert@sfsu.edu>
+# Purpose:  Measure the pruning and runtime of the threshold join.
+#
+# Description:
+#   Runs the LTS executable with --join at a range of thresholds, and once
+#   with each of the full sparse and dense computations writing the pairs
+#   above the lowest threshold with --output, as baselines. Each join is
+#   checked against the sparse result: the pairs it writes must be exactly
+#   the sparse pairs at or above its threshold, except for pairs within float
+#   rounding of the threshold, as the two sum in different orders.
+#
+#   For each threshold the report gives the runtime, the share of the index
+#   left out by the prefixes, the share of all pairs which never met in the
+#   index, the share pruned by the norm bounds, the share whose dot product
+#   was completed, and the number of result pairs.
+# ==============================================================================
+
+import argparse
+import csv
+import os
+import re
+import struct
+import subprocess
+import tempfile
+
+
+TOLERANCE = 1e-5
+
+def parse_args():
+    parser = argparse.ArgumentParser()
+
+    parser.add_argument('executable', help='The LTS executable')
+    parser.add_argument('-d', '--data', default='../data/movie_reviews_combined.txt', help='The input data file')
+    parser.add_argument('-c', '--count', type=int, default=5000, help='Number of documents')
+    parser.add_argument('-t', '--thresholds', default='0.5,0.7,0.8,0.9,0.95,0.98', help='Comma-separated thresholds')
+    parser.add_argument('-o', '--output', default='join_pruning.csv', help='Output CSV file')
+
+    return parser.parse_args()
+
+
+def load_pairs(path):
+    """Load the (row, col) -> score pairs of a Pairs-format score file."""
+    with open(path, 'rb') as infile:
+        data = infile.read()
+    count = struct.unpack_from('<Q', data, 32)[0]
+    pairs = {}
+    for i in range(count):
+        row, col, score = struct.unpack_from('<IIf', data, 48 + 12 * i)
+        pairs[(row, col)] = score
+    return pairs
+
+
+def run(executable, data, count, extra):
+    """Run LTS and return its reported runtime and stderr."""
+    cmd = [executable, '--data', data, '--count', str(count)] + extra
+    p = subprocess.run(cmd, capture_output=True, text=True, check=True)
+    return float(p.stdout.split()[-1]), p.stderr
+
+
+def main():
+    args = parse_args()
+    thresholds = [float(t) for t in args.thresholds.split(',')]
+
+    rows = []
+    with tempfile.TemporaryDirectory() as tmp:
+        pairs_path = os.path.join(tmp, 'pairs.bin')
+        lowest = str(min(thresholds))
+        for name, extra in (('sparse', ['--sparse']), ('dense', ['--tf', '--mmloop', 'simd'])):
+            print(f'Running {name}', end=' ', flush=True)
+            runtime, _ = run(args.executable, args.data, args.count, extra + ['--output', pairs_path, '--threshold', lowest])
+            print(f'({runtime} s)')
+            rows.append([name, lowest, runtime, '', '', '', '', '', ''])
+            if name == 'sparse':
+                reference = load_pairs(pairs_path)
+
+        for t in thresholds:
+            print(f'Running join at {t}', end=' ', flush=True)
+            runtime, log = run(args.executable, args.data, args.count,
+                               ['--join', '--output', pairs_path, '--threshold', str(t)])
+            print(f'({runtime} s)')
+
+            stats = [int(v) for v in re.search(r'Indexed (\d+) of (\d+) non-zeros; (\d+) candidates of (\d+) pairs, '
+                                               r'(\d+) pruned by the prefix bound, (\d+) verified, (\d+)', log).groups()]
+            indexed, nonzeros, candidates, pairs, pruned, verified, results = stats
+
+            found = load_pairs(pairs_path)
+            missing = [k for k, v in reference.items() if v >= t + TOLERANCE and k not in found]
+            extra = [k for k, v in found.items() if v >= t + TOLERANCE and k not in reference]
+            if missing or extra:
+                print(f'  {len(extra)} extra and {len(missing)} missing pairs')
+
+            rows.append(['join', t, runtime, 1 - indexed / nonzeros, 1 - candidates / pairs, pruned / pairs,
+                         verified / pairs, results, not missing and not extra])
+
+    headers = ['Method', 'Threshold', 'Runtime (s)', 'Unindexed', 'Never Met', 'Bound Pruned', 'Verified',
+               'Results', 'Matches Sparse']
+    with open(args.output, 'w') as outfile:
+        writer = csv.writer(outfile)
+        writer.writerow(headers)
+        writer.writerows(rows)
+
+    print(','.join(headers))
+    for row in rows:
+        print(','.join(str(v) for v in row))
+
+
+if __name__ == '__main__':
+    main()
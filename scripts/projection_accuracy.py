@@ -0,0 +1,86 @@
+# ==============================================================================
+# Program:  projection_accuracy.py
+# Author:   Zachary Colbert <zcolbert@sfsu.edu>
+# Purpose:  Measure the speed-up and error of the random projection mode.
+#
+# Description:
+#   Runs the LTS executable with the exact term frequency vectors and with
+#   --project at a range of dimensions, writing the full similarity matrix
+#   of each run with --scores and the phase times with --profile. Each
+#   projected result is compared against the exact result.
+#
+#   For each dimension the report gives the time of the projection and of
+#   the multiply, the speed-up of the two together over the exact multiply,
+#   the mean (signed) error of the off-diagonal scores, the 50th, 90th and
+#   99th percentile and maximum absolute error, and the fraction of
+#   documents whose 10 nearest neighbours are unchanged.
+# ==============================================================================
+
+import argparse
+import csv
+import json
+import os
+import tempfile
+
+import accuracy
+
+
+def parse_args():
+    parser = argparse.ArgumentParser()
+
+    parser.add_argument('executable', help='The LTS executable')
+    parser.add_argument('-d', '--data', default='../data/movie_reviews_combined.txt', help='The input data file')
+    parser.add_argument('-c', '--count', type=int, default=1000, help='Number of documents')
+    parser.add_argument('-k', '--dims', default='64,128,256,512', help='Comma-separated projection dimensions')
+    parser.add_argument('-n', '--neighbors', type=int, default=10, help='Neighbourhood size for the recall metric')
+    parser.add_argument('-m', '--mmloop', default='simd', help='The dense multiply kernel')
+    parser.add_argument('-o', '--output', default='projection_accuracy.csv', help='Output CSV file')
+
+    return parser.parse_args()
+
+
+def run(executable, data, count, extra, scores_path, profile_path):
+    """Run LTS and return the seconds of each profiled phase."""
+    accuracy.run(executable, data, count, ['--profile=' + profile_path] + extra, scores_path)
+    with open(profile_path, 'r') as infile:
+        return {phase['name']: phase['seconds'] for phase in json.load(infile)['phases']}
+
+
+def main():
+    args = parse_args()
+
+    rows = []
+    with tempfile.TemporaryDirectory() as tmp:
+        scores_path = os.path.join(tmp, 'scores.csv')
+        profile_path = os.path.join(tmp, 'profile.json')
+        print('Running exact', end=' ', flush=True)
+        phases = run(args.executable, args.data, args.count, ['--mmloop', args.mmloop], scores_path, profile_path)
+        exact_seconds = phases['multiply']
+        print(f'({exact_seconds} s)')
+        reference = accuracy.load_scores(scores_path)
+        rows.append(['exact', args.count, 0.0, exact_seconds, 1.0, 0.0, 0.0, 0.0, 0.0, 0.0, 1.0])
+
+        for dims in (int(k) for k in args.dims.split(',')):
+            print(f'Running k={dims}', end=' ', flush=True)
+            phases = run(args.executable, args.data, args.count, ['--mmloop', args.mmloop, '--project', str(dims)],
+                         scores_path, profile_path)
+            print(f'({phases["multiply"]} s)')
+            speedup = exact_seconds / (phases['project'] + phases['multiply'])
+            c = accuracy.compare(accuracy.load_scores(scores_path), reference, args.neighbors)
+            rows.append([dims, args.count, phases['project'], phases['multiply'], speedup,
+                         c.bias, c.p50, c.p90, c.p99, c.max_err, c.recall])
+
+    headers = ['Dims', 'Documents', 'Project (s)', 'Multiply (s)', 'Speed-up', 'Mean Error',
+               'p50 Abs Error', 'p90 Abs Error', 'p99 Abs Error', 'Max Abs Error', f'Top-{args.neighbors} Recall']
+    with open(args.output, 'w') as outfile:
+        writer = csv.writer(outfile)
+        writer.writerow(headers)
+        writer.writerows(rows)
+
+    print(','.join(headers))
+    for row in rows:
+        print(','.join(str(v) for v in row))
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,85 @@
+# ==============================================================================
+# Program:  quantize_accuracy.py
+# Author:   Zachary Colbert <zcolbert@sfsu.edu>
+# Purpose:  Measure the error and speed of the quantized similarity modes.
+#
+# Description:
+#   Runs the LTS executable with the fp32 term frequency matrix and with each
+#   quantized format (--quantize int8, --quantize bf16), writing the full
+#   similarity matrix of each run with --scores. Each quantized result is
+#   compared against the fp32 result and, when supplied, against the
+#   scikit-learn reference scores produced by generate_benchmark.py.
+#
+#   For each comparison the report gives the maximum and mean absolute error,
+#   the RMS error, and the fraction of documents whose 10 nearest neighbours
+#   are unchanged.
+# ==============================================================================
+
+import argparse
+import csv
+import os
+import tempfile
+
+from accuracy import compare, load_scores, run
+
+
+def parse_args():
+    parser = argparse.ArgumentParser()
+
+    parser.add_argument('executable', help='The LTS executable')
+    parser.add_argument('-d', '--data', default='../data/movie_reviews_combined.txt', help='The input data file')
+    parser.add_argument('-c', '--count', type=int, default=1000, help='Number of documents')
+    parser.add_argument('-b', '--benchmark', help='Reference scores from generate_benchmark.py, e.g. ../data/benchmark_1000.csv')
+    parser.add_argument('-k', '--neighbors', type=int, default=10, help='Neighbourhood size for the recall metric')
+    parser.add_argument('-o', '--output', default='quantize_accuracy.csv', help='Output CSV file')
+
+    return parser.parse_args()
+
+
+def main():
+    args = parse_args()
+
+    configs = [
+        ('fp32 simd', ['--mmloop', 'simd']),
+        ('int8', ['--quantize', 'int8']),
+        ('int8 generic', ['--quantize', 'int8-generic']),
+        ('bf16', ['--quantize', 'bf16']),
+        ('bf16 generic', ['--quantize', 'bf16-generic']),
+    ]
+
+    benchmark = load_scores(args.benchmark) if args.benchmark else None
+
+    rows = []
+    with tempfile.TemporaryDirectory() as tmp:
+        reference = None
+        for name, extra in configs:
+            scores_path = os.path.join(tmp, 'scores.csv')
+            print(f'Running {name}', end=' ', flush=True)
+            runtime = run(args.executable, args.data, args.count, extra, scores_path)
+            print(f'({runtime} s)')
+
+            scores = load_scores(scores_path)
+            if reference is None:
+                reference = scores
+
+            refs = [('fp32', reference)]
+            if benchmark:
+                refs.append(('scikit-learn', benchmark))
+            for ref_name, ref in refs:
+                c = compare(scores, ref, args.neighbors)
+                rows.append([name, ref_name, args.count, runtime, c.max_err, c.mean_err, c.rms_err, c.recall])
+
+    headers = ['Mode', 'Reference', 'Documents', 'Runtime (s)', 'Max Abs Error', 'Mean Abs Error',
+               'RMS Error', f'Top-{args.neighbors} Recall']
+    with open(args.output, 'w') as outfile:
+        writer = csv.writer(outfile)
+        writer.writerow(headers)
+        writer.writerows(rows)
+
+    print(','.join(headers))
+    for row in rows:
+        print(','.join(str(v) for v in row))
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,62 @@
+# ==============================================================================
+# Program:  scaling_timer.py
+# Author:   Zachary Colbert <zcolbert@sfsu.edu>
+# Purpose:  Measure how the multiply loop permutations scale with threads.
+#
+# Description:
+#   Runs the LTS executable for each loop permutation with OMP_NUM_THREADS
+#   set to each requested thread count, and writes the runtimes together
+#   with the speedup and parallel efficiency relative to one thread.
+# ==============================================================================
+
+import argparse
+import csv
+import os
+import subprocess
+
+
+def parse_args():
+    parser = argparse.ArgumentParser()
+
+    parser.add_argument('executable', help='The executable to be run')
+    parser.add_argument('-d', '--data', default='../data/movie_reviews_combined.txt', help='The input data file')
+    parser.add_argument('-c', '--count', default='1000', help='Number of documents')
+    parser.add_argument('-l', '--loop', action='append', help='Loop permutation (repeatable)')
+    parser.add_argument('-t', '--threads', type=int, action='append', help='Thread count (repeatable)')
+    parser.add_argument('-o', '--output', default='scaling.csv', help='Output CSV file')
+
+    return parser.parse_args()
+
+
+def main():
+    args = parse_args()
+
+    loops = args.loop or ['kij', 'kji']
+    plevels = args.threads or [1, 2, 4, 8, 16, 32, 64]
+
+    rows = []
+    for loop in loops:
+        base_runtime = None
+        for plevel in plevels:
+            print(f'Running loop={loop} with nthreads={plevel}', end=' ', flush=True)
+
+            env = dict(os.environ, OMP_NUM_THREADS=str(plevel))
+            cmd = [args.executable, '--data', args.data, '--count', args.count, '--mmloop', loop]
+            p = subprocess.run(cmd, capture_output=True, env=env)
+            runtime = float(p.stdout.split()[-1])
+
+            if base_runtime is None:
+                base_runtime = runtime * plevels[0]
+            speedup = base_runtime / runtime
+            print(f'({runtime} s, speedup {speedup:.2f})')
+            rows.append([loop, plevel, runtime, f'{speedup:.3f}', f'{speedup / plevel:.3f}'])
+
+    headers = ['Loop', 'NThreads', 'Runtime (s)', 'Speedup', 'Efficiency']
+    with open(args.output, 'w') as outfile:
+        writer = csv.writer(outfile)
+        writer.writerow(headers)
+        writer.writerows(rows)
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,109 @@
+# ==============================================================================
+# Program:  serve_load.py
+# Author:   Zachary Colbert <zcolbert@sfsu.edu>
+# Purpose:  Measure the latency and throughput of the LTS query server.
+#
+# Description:
+#   Connects a number of concurrent clients to the Unix domain socket of a
+#   server started with "LTS --serve <socket>". Each client sends one query
+#   at a time and waits for its response before sending the next (a closed
+#   loop), so the offered load grows with the number of clients. Queries are
+#   lines sampled from a data file.
+#
+#   The report gives the throughput in queries per second and the p50, p90
+#   and p99 latency of the individual requests.
+# ==============================================================================
+
+import argparse
+import csv
+import os
+import random
+import socket
+import threading
+import time
+
+
+def parse_args():
+    parser = argparse.ArgumentParser()
+
+    parser.add_argument('socket', help='The socket path given to LTS --serve')
+    parser.add_argument('-d', '--data', default='../data/movie_reviews_combined.txt', help='File of query documents, one per line')
+    parser.add_argument('-c', '--clients', type=int, default=8, help='Number of concurrent clients')
+    parser.add_argument('-n', '--requests', type=int, default=2000, help='Total number of queries')
+    parser.add_argument('-w', '--warmup', type=int, default=100, help='Untimed queries sent first')
+    parser.add_argument('-o', '--output', help='Append the results to this CSV file')
+
+    return parser.parse_args()
+
+
+def load_queries(path, limit=10000):
+    with open(path, 'r', errors='replace') as infile:
+        lines = [line.rstrip('\n') for _, line in zip(range(limit), infile)]
+    return [line for line in lines if line]
+
+
+def client(path, queries, count, latencies, lock):
+    """Send count queries over one connection, recording the latency of each."""
+    sock = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+    sock.connect(path)
+    reader = sock.makefile('rb')
+    local = []
+    for _ in range(count):
+        query = random.choice(queries).encode() + b'\n'
+        start = time.perf_counter()
+        sock.sendall(query)
+        if not reader.readline():
+            break
+        local.append(time.perf_counter() - start)
+    sock.close()
+    with lock:
+        latencies.extend(local)
+
+
+def run(path, queries, clients, requests):
+    """Run the clients to completion and return the latencies and the elapsed time."""
+    latencies = []
+    lock = threading.Lock()
+    per_client = [requests // clients + (1 if i < requests % clients else 0) for i in range(clients)]
+    threads = [threading.Thread(target=client, args=(path, queries, n, latencies, lock)) for n in per_client]
+
+    start = time.perf_counter()
+    for t in threads:
+        t.start()
+    for t in threads:
+        t.join()
+    return latencies, time.perf_counter() - start
+
+
+def percentile(values, p):
+    ordered = sorted(values)
+    return ordered[min(len(ordered) - 1, int(p / 100.0 * len(ordered)))]
+
+
+def main():
+    args = parse_args()
+    random.seed(1)
+    queries = load_queries(args.data)
+
+    run(args.socket, queries, 1, args.warmup)
+    latencies, elapsed = run(args.socket, queries, args.clients, args.requests)
+
+    qps = len(latencies) / elapsed
+    p50, p90, p99 = (percentile(latencies, p) * 1000 for p in (50, 90, 99))
+    headers = ['Clients', 'Requests', 'QPS', 'p50 (ms)', 'p90 (ms)', 'p99 (ms)']
+    row = [args.clients, len(latencies), round(qps, 1), round(p50, 3), round(p90, 3), round(p99, 3)]
+
+    print(','.join(headers))
+    print(','.join(str(v) for v in row))
+
+    if args.output:
+        exists = os.path.exists(args.output)
+        with open(args.output, 'a') as outfile:
+            writer = csv.writer(outfile)
+            if not exists:
+                writer.writerow(headers)
+            writer.writerow(row)
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,146 @@
+# ==============================================================================
+# Program:  shard_check.py
+# Author:   Zachary Colbert <zcolbert@sfsu.edu>
+# Purpose:  Check the sharded computation against the sparse computation.
+#
+# Description:
+#   Runs the LTS executable once with --sparse and once with --shards P
+#   --workers W for each given (P, W), writing the full similarity matrix of
+#   each run with --scores. Each sharded matrix must be byte-for-byte equal
+#   to the sparse matrix.
+#
+#   Each (P, W) is then run again while one of its worker processes is
+#   killed with SIGKILL after --kill-after seconds, so the coordinator must
+#   re-schedule the lost worker's block on the others. The run must report
+#   the lost worker and still write the same matrix. The worker is chosen
+#   among the child processes of the coordinator, read from /proc, so the
+#   check needs Linux. Runs with a single worker are not killed, as losing
+#   every worker aborts the computation.
+#
+#   For each run the report gives the runtime, the number of workers lost
+#   and whether the matrix matches. The exit status is 1 if any run failed.
+# ==============================================================================
+
+import argparse
+import csv
+import filecmp
+import os
+import re
+import signal
+import subprocess
+import sys
+import tempfile
+import time
+
+
+def parse_args():
+    parser = argparse.ArgumentParser()
+
+    parser.add_argument('executable', help='The LTS executable')
+    parser.add_argument('-d', '--data', default='../data/movie_reviews_combined.txt', help='The input data file')
+    parser.add_argument('-c', '--count', type=int, default=2000, help='Number of documents')
+    parser.add_argument('-s', '--shards', default='1:1,2:2,4:2,4:4,8:3', help='Comma-separated shards:workers pairs')
+    parser.add_argument('-k', '--kill-after', type=float, default=0.2,
+                        help='Seconds after the workers start before one is killed')
+    parser.add_argument('-o', '--output', default='shard_check.csv', help='Output CSV file')
+
+    return parser.parse_args()
+
+
+def children(pid):
+    """The process IDs whose parent is pid."""
+    found = []
+    for entry in os.listdir('/proc'):
+        if not entry.isdigit():
+            continue
+        try:
+            with open(f'/proc/{entry}/stat') as infile:
+                stat = infile.read()
+        except OSError:
+            continue
+        # The command name may hold spaces, so the fields are counted from its closing parenthesis
+        if int(stat[stat.rindex(')') + 2:].split()[1]) == pid:
+            found.append(int(entry))
+    return found
+
+
+def run(executable, data, count, extra, scores_path, kill_after=None):
+    """Run LTS, killing one worker after kill_after seconds if given, and return its runtime and stderr."""
+    cmd = [executable, '--data', data, '--count', str(count), '--tf', '--scores', scores_path] + extra
+    p = subprocess.Popen(cmd, stdout=subprocess.PIPE, stderr=subprocess.PIPE, text=True)
+
+    killed = False
+    if kill_after is not None:
+        workers = []
+        while not workers and p.poll() is None:
+            time.sleep(0.01)
+            workers = children(p.pid)
+        time.sleep(kill_after)
+        if workers and p.poll() is None:
+            try:
+                os.kill(workers[0], signal.SIGKILL)
+                killed = True
+            except ProcessLookupError:
+                # The worker exited with the coordinator first
+                pass
+
+    stdout, stderr = p.communicate()
+    if p.returncode != 0:
+        raise RuntimeError(f'{" ".join(cmd)} exited with {p.returncode}: {stdout}{stderr}')
+    return float(stdout.split()[-1]), stderr, killed
+
+
+def main():
+    args = parse_args()
+    configs = [tuple(int(v) for v in pair.split(':')) for pair in args.shards.split(',')]
+
+    rows = []
+    failed = False
+    with tempfile.TemporaryDirectory() as tmp:
+        reference_path = os.path.join(tmp, 'sparse.csv')
+        scores_path = os.path.join(tmp, 'shards.csv')
+
+        print('Running sparse', end=' ', flush=True)
+        runtime, _, _ = run(args.executable, args.data, args.count, ['--sparse'], reference_path)
+        print(f'({runtime} s)')
+        rows.append(['sparse', '', '', False, runtime, '', ''])
+
+        for shards, workers in configs:
+            for kill in (False, True):
+                if kill and workers < 2:
+                    continue
+                print(f'Running {shards} shards on {workers} workers{" with a kill" if kill else ""}', end=' ', flush=True)
+                runtime, log, killed = run(args.executable, args.data, args.count,
+                                           ['--shards', str(shards), '--workers', str(workers)], scores_path,
+                                           args.kill_after if kill else None)
+                print(f'({runtime} s)')
+
+                lost = int(re.search(r'lost (\d+) workers', log).group(1))
+                matches = filecmp.cmp(reference_path, scores_path, shallow=False)
+                if not matches:
+                    print('  the scores differ from --sparse')
+                    failed = True
+                if kill and not killed:
+                    print('  the run finished before a worker was killed; lower --kill-after or raise --count')
+                    failed = True
+                elif lost != (1 if kill else 0):
+                    print(f'  {lost} workers were lost')
+                    failed = True
+
+                rows.append(['shards', shards, workers, kill, runtime, lost, matches])
+
+    headers = ['Method', 'Shards', 'Workers', 'Killed', 'Runtime (s)', 'Lost', 'Matches Sparse']
+    with open(args.output, 'w') as outfile:
+        writer = csv.writer(outfile)
+        writer.writerow(headers)
+        writer.writerows(rows)
+
+    print(','.join(headers))
+    for row in rows:
+        print(','.join(str(v) for v in row))
+
+    sys.exit(1 if failed else 0)
+
+
+if __name__ == '__main__':
+    main()
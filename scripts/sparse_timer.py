@@ -0,0 +1,72 @@
+# ==============================================================================
+# Program:  sparse_timer.py
+# Author:   Zachary Colbert <zcolbert@sfsu.edu>
+# Purpose:  Compare the runtime and memory use of the dense and sparse
+#           similarity paths.
+#
+# Description:
+#   Runs the LTS executable over the input data once with the dense term
+#   frequency matrix (--tf) for each loop permutation, and once with the
+#   sparse term frequency matrix (--sparse), for each document count.
+#   The multiply runtime reported by LTS and the peak resident set size of
+#   the process are written to a CSV file.
+# ==============================================================================
+
+import argparse
+import csv
+import os
+import subprocess
+
+
+def parse_args():
+    parser = argparse.ArgumentParser()
+
+    parser.add_argument('executable', help='The executable to be run')
+    parser.add_argument('-d', '--data', default='../data/movie_reviews_combined.txt', help='The input data file')
+    parser.add_argument('-c', '--count', type=int, action='append', help='Number of documents (repeatable)')
+    parser.add_argument('-l', '--loop', action='append', help='Dense loop permutation (repeatable)')
+    parser.add_argument('-o', '--output', default='sparse_runtimes.csv', help='Output CSV file')
+
+    return parser.parse_args()
+
+
+def run(cmd):
+    """Run the command and return its reported runtime and peak RSS in MB."""
+    p = subprocess.Popen(cmd, stdout=subprocess.PIPE, stderr=subprocess.DEVNULL)
+    out = p.stdout.read()
+    _, status, usage = os.wait4(p.pid, 0)
+    p.stdout.close()
+    if status != 0:
+        return None, usage.ru_maxrss / 1024
+    # The runtime is the last line written by LTS
+    return float(out.split()[-1]), usage.ru_maxrss / 1024
+
+
+def main():
+    args = parse_args()
+
+    counts = args.count or [1000, 10000, 50000]
+    loops = args.loop or ['kij']
+
+    rows = []
+    for count in counts:
+        base_args = [args.executable, '--data', args.data, '--count', str(count)]
+
+        configs = [(f'dense {loop}', ['--tf', '--mmloop', loop]) for loop in loops]
+        configs.append(('sparse', ['--sparse']))
+
+        for name, extra in configs:
+            print(f'Running {name} with count={count}', end=' ', flush=True)
+            runtime, rss = run(base_args + extra)
+            print(f'({runtime} s, {rss:.1f} MB)')
+            rows.append([count, name, runtime, f'{rss:.1f}'])
+
+    headers = ['Documents', 'Mode', 'Runtime (s)', 'Peak RSS (MB)']
+    with open(args.output, 'w') as outfile:
+        writer = csv.writer(outfile)
+        writer.writerow(headers)
+        writer.writerows(rows)
+
+
+if __name__ == '__main__':
+    main()
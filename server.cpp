@@ -0,0 +1,550 @@
+/******************************************************************************
+ * Filename: server.cpp
+ * Author: Zachary Colbert
+ * Contact: zcolbert@sfsu.edu
+ *
+ * Description: Implementation of the query server. A single thread runs a
+ *              ppoll() loop over the listening socket and every connection;
+ *              the scoring of each batch runs on the OpenMP threads.
+ *****************************************************************************/
+
+#include "server.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <csignal>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <iostream>
+#include <map>
+#include <omp.h>
+
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+
+/** Smaller batches are scored one query at a time, since they share too few postings to gain. */
+static constexpr size_t min_shared_batch = 16;
+
+/** A single query touching at least 1 / dense_query_ratio postings per document selects from every score. */
+static constexpr size_t dense_query_ratio = 4;
+
+/**
+ * For each posting (d, v), add v times the weights to row d of a row-wise matrix of width b.
+ * Compiled for AVX-512 and AVX2 as well as the baseline, and dispatched at load time.
+ */
+__attribute__((target_clones("avx512f", "avx2", "default")))
+static void addWeightedPostings(float* rows, size_t b, const float* weights,
+                                const uint32_t* docs, const uint32_t* docs_end, const float* values)
+{
+    for (const uint32_t* d = docs; d < docs_end; ++d)
+    {
+        float* out = rows + static_cast<size_t>(*d) * b;
+        const float v = values[d - docs];
+        for (size_t q = 0; q < b; ++q) {
+            out[q] += weights[q] * v;
+        }
+    }
+}
+
+/**
+ * @param postings The transpose of the row-normalized documents x vocabulary matrix.
+ *                 The arrays must outlive the engine.
+ * @param vocabulary The packed ngram of each vocabulary column.
+ * @param ngram_len The ngram length of the vocabulary.
+ */
+QueryEngine::QueryEngine(const CsrView& postings, const uint64_t* vocabulary, size_t ngram_len)
+    : postings(postings), counter(ngram_len, true)
+{
+    columns.reserve(postings.rows);
+    for (size_t c = 0; c < postings.rows; ++c) {
+        columns.emplace(vocabulary[c], static_cast<uint32_t>(c));
+    }
+}
+
+/**
+ * Find the k corpus documents most similar to each query, by cosine similarity of
+ * the ngram term frequencies. Ngrams outside the corpus vocabulary count towards
+ * the length of the query vector, but match no document.
+ *
+ * @param queries The text of each query, tokenized as tokenize() would.
+ * @param k The number of matches to return per query.
+ * @return A row-wise queries x k list of matches, each row sorted by descending score.
+ *         Rows are padded with {no_neighbor, 0} if the corpus has fewer than k documents.
+ */
+std::vector<Neighbor> QueryEngine::search(const std::vector<std::string_view>& queries, size_t k)
+{
+    // Vectorize the batch into one sparse queries x vocabulary matrix
+    CsrMatrix batch;
+    batch.rows = queries.size();
+    batch.cols = postings.rows;
+    batch.row_ptr.push_back(0);
+    for (std::string_view query: queries)
+    {
+        const size_t first = batch.values.size();
+        float sum = 0.0f;
+        counter.count(query);
+        counter.forEach([&](uint64_t key, unsigned int count) {
+            sum += static_cast<float>(count) * count;
+            auto it = columns.find(key);
+            if (it != columns.end()) {
+                batch.col_idx.push_back(it->second);
+                batch.values.push_back(static_cast<float>(count));
+            }
+        });
+        counter.clear();
+
+        if (sum > 0.0f)
+        {
+            const float mag = std::sqrt(sum);
+            for (size_t p = first; p < batch.values.size(); ++p) {
+                batch.values[p] /= mag;
+            }
+        }
+        batch.row_ptr.push_back(batch.values.size());
+    }
+
+    const size_t n = documents();
+    const size_t b = batch.rows;
+    std::vector<Neighbor> matches(b * k, Neighbor{no_neighbor, 0.0f});
+
+    if (b < min_shared_batch)
+    {
+        // Each query only visits the documents which share an ngram with it
+        for (size_t q = 0; q < b; ++q) {
+            searchPostings(batch, q, k, &matches[q * k]);
+        }
+        return matches;
+    }
+
+    scores.assign(b * n, 0.0f);
+    // Score the batch one vocabulary column at a time, so each posting list is read once per batch
+    // rather than once per query. Scores are document-major: the batch's scores of a document are
+    // adjacent. Columns shared by many queries are expanded to a dense row of b weights, which turns
+    // the update of each posting into a vectorized multiply-add over the batch.
+    const CsrMatrix by_column = transpose(batch);
+    doc_scores.assign(n * b, 0.0f);
+    std::vector<float> weights(b);
+
+    #pragma omp parallel firstprivate(weights)
+    {
+        // Each thread owns a range of documents, and so a range of every posting list
+        const size_t threads = static_cast<size_t>(omp_get_num_threads());
+        const size_t thread = static_cast<size_t>(omp_get_thread_num());
+        const uint32_t doc_first = static_cast<uint32_t>(n * thread / threads);
+        const uint32_t doc_last = static_cast<uint32_t>(n * (thread + 1) / threads);
+
+        for (size_t col = 0; col < by_column.rows; ++col)
+        {
+            const size_t q_first = by_column.row_ptr[col];
+            const size_t q_last = by_column.row_ptr[col + 1];
+            if (q_first == q_last) {
+                continue;
+            }
+            const uint32_t* docs = postings.col_idx + postings.row_ptr[col];
+            const uint32_t* docs_end = postings.col_idx + postings.row_ptr[col + 1];
+            const uint32_t* first = threads > 1 ? std::lower_bound(docs, docs_end, doc_first) : docs;
+            const uint32_t* last = threads > 1 ? std::lower_bound(first, docs_end, doc_last) : docs_end;
+            const float* values = postings.values + postings.row_ptr[col];
+
+            if ((q_last - q_first) * 4 >= b)
+            {
+                std::fill(weights.begin(), weights.end(), 0.0f);
+                for (size_t p = q_first; p < q_last; ++p) {
+                    weights[by_column.col_idx[p]] = by_column.values[p];
+                }
+                addWeightedPostings(doc_scores.data(), b, weights.data(), first, last, values + (first - docs));
+            }
+            else
+            {
+                for (const uint32_t* d = first; d < last; ++d)
+                {
+                    float* out = &doc_scores[static_cast<size_t>(*d) * b];
+                    const float v = values[d - docs];
+                    for (size_t p = q_first; p < q_last; ++p) {
+                        out[by_column.col_idx[p]] += by_column.values[p] * v;
+                    }
+                }
+            }
+        }
+    }
+
+    // Gather the scores of each query into a row
+    #pragma omp parallel for
+    for (size_t q = 0; q < b; ++q) {
+        for (size_t d = 0; d < n; ++d) {
+            scores[q * n + d] = doc_scores[d * b + q];
+        }
+    }
+
+    #pragma omp parallel for schedule(dynamic, 1)
+    for (size_t q = 0; q < b; ++q) {
+        selectTopK(&scores[q * n], n, k, n, &matches[q * k]);
+    }
+    return matches;
+}
+
+/**
+ * Find the k corpus documents most similar to one query of a batch, visiting only the
+ * postings of its ngrams. Its cost follows the number of postings touched, not the size
+ * of the corpus: the scores accumulate in an array which is zero outside the touched
+ * documents, and only those entries are reset afterwards. A query whose postings cover
+ * a good part of the corpus skips the bookkeeping and selects from the whole array.
+ *
+ * @param batch The normalized queries x vocabulary matrix of the batch.
+ * @param q The row of the query.
+ * @param k The number of matches to return.
+ * @param out The k matches, sorted by descending score. Must be padded with {no_neighbor, 0}.
+ */
+void QueryEngine::searchPostings(const CsrMatrix& batch, size_t q, size_t k, Neighbor* out)
+{
+    const size_t n = documents();
+    if (accumulator.size() != n) {
+        accumulator.assign(n, 0.0f);
+        visited.assign(n, 0);
+    }
+
+    size_t touching = 0;
+    for (size_t p = batch.row_ptr[q]; p < batch.row_ptr[q + 1]; ++p) {
+        touching += postings.row_ptr[batch.col_idx[p] + 1] - postings.row_ptr[batch.col_idx[p]];
+    }
+
+    if (touching * dense_query_ratio >= n)
+    {
+        for (size_t p = batch.row_ptr[q]; p < batch.row_ptr[q + 1]; ++p)
+        {
+            const uint32_t col = batch.col_idx[p];
+            const float v = batch.values[p];
+            for (size_t e = postings.row_ptr[col]; e < postings.row_ptr[col + 1]; ++e) {
+                accumulator[postings.col_idx[e]] += v * postings.values[e];
+            }
+        }
+        selectTopK(accumulator.data(), n, k, n, out);
+        std::fill(accumulator.begin(), accumulator.end(), 0.0f);
+        return;
+    }
+
+    for (size_t p = batch.row_ptr[q]; p < batch.row_ptr[q + 1]; ++p)
+    {
+        const uint32_t col = batch.col_idx[p];
+        const float v = batch.values[p];
+        for (size_t e = postings.row_ptr[col]; e < postings.row_ptr[col + 1]; ++e)
+        {
+            const uint32_t doc = postings.col_idx[e];
+            if (!visited[doc]) {
+                visited[doc] = 1;
+                touched.push_back(doc);
+            }
+            accumulator[doc] += v * postings.values[e];
+        }
+    }
+
+    candidates.clear();
+    for (uint32_t doc: touched)
+    {
+        candidates.push_back({doc, accumulator[doc]});
+        accumulator[doc] = 0.0f;
+    }
+    selectTopK(candidates, k, out);
+
+    // Every other document scores zero, and ties go to the lowest document ID, as in selectTopK()
+    size_t filled = std::min(k, candidates.size());
+    for (uint32_t doc = 0; filled < k && doc < n; ++doc)
+    {
+        if (!visited[doc]) {
+            out[filled++] = Neighbor{doc, 0.0f};
+        }
+    }
+    for (uint32_t doc: touched) {
+        visited[doc] = 0;
+    }
+    touched.clear();
+}
+
+
+/** Set by SIGINT and SIGTERM to stop the server. */
+static volatile std::sig_atomic_t stop_requested = 0;
+
+static void requestStop(int)
+{
+    stop_requested = 1;
+}
+
+/** A client: its descriptors and the bytes of its incomplete request. */
+struct Connection
+{
+    int in_fd;
+    int out_fd;
+    std::string buffer;
+    bool eof = false;   // The client has finished sending, but may still await responses
+};
+
+/** A complete request waiting to be scored. */
+struct PendingQuery
+{
+    int conn;           // Input descriptor of the connection
+    std::string text;
+};
+
+/**
+ * Write all bytes to a descriptor.
+ *
+ * @return False if the peer has gone away.
+ */
+static bool writeAll(int fd, const std::string& data)
+{
+    size_t done = 0;
+    while (done < data.size())
+    {
+        // send() with MSG_NOSIGNAL, so a closed socket does not raise SIGPIPE; write() for stdout
+        ssize_t n = fd == STDOUT_FILENO ? write(fd, data.data() + done, data.size() - done)
+                                        : send(fd, data.data() + done, data.size() - done, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        done += static_cast<size_t>(n);
+    }
+    return true;
+}
+
+/**
+ * Close a connection, unless it is stdin, and drop its unanswered queries.
+ * The descriptor is only released here, so it cannot be reused while queries are pending.
+ */
+static void closeConnection(std::map<int, Connection>& connections, std::vector<PendingQuery>& pending, int fd)
+{
+    if (fd != STDIN_FILENO) {
+        close(fd);
+    }
+    connections.erase(fd);
+    pending.erase(std::remove_if(pending.begin(), pending.end(), [fd](const PendingQuery& q) { return q.conn == fd; }),
+                  pending.end());
+}
+
+/**
+ * Create a listening Unix domain socket at the given path, replacing a stale socket file.
+ *
+ * @return The socket descriptor, or -1.
+ */
+static int listenUnix(const std::string& path)
+{
+    sockaddr_un addr{};
+    if (path.size() >= sizeof(addr.sun_path)) {
+        return -1;
+    }
+    addr.sun_family = AF_UNIX;
+    std::memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    unlink(path.c_str());
+    if (bind(fd, reinterpret_cast<const sockaddr*>(&addr), sizeof(addr)) != 0 || listen(fd, 128) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/**
+ * Serve queries until stdin reaches end of file, or until SIGINT or SIGTERM when
+ * listening on a socket.
+ *
+ * The first query to arrive opens a batch, which is scored when the batch window
+ * has passed or when max_batch queries are waiting, whichever comes first.
+ *
+ * @param endpoint The path of the Unix domain socket to listen on, or "-" for stdin and stdout.
+ * @param engine The engine which scores the queries.
+ * @param config The server settings.
+ * @return False if the socket could not be created.
+ */
+bool serveQueries(const std::string& endpoint, QueryEngine& engine, const ServerConfig& config)
+{
+    using clock = std::chrono::steady_clock;
+
+    const bool use_stdin = endpoint == "-";
+    int listen_fd = -1;
+    std::map<int, Connection> connections;
+
+    if (use_stdin) {
+        connections[STDIN_FILENO] = Connection{STDIN_FILENO, STDOUT_FILENO, {}};
+    } else {
+        listen_fd = listenUnix(endpoint);
+        if (listen_fd < 0) {
+            std::cerr << "Could not listen on '" << endpoint << "': " << std::strerror(errno) << std::endl;
+            return false;
+        }
+        std::signal(SIGINT, requestStop);
+        std::signal(SIGTERM, requestStop);
+    }
+    std::cerr << "Serving " << engine.documents() << " documents on " << (use_stdin ? "stdin" : endpoint)
+              << std::endl;
+
+    std::vector<PendingQuery> pending;
+    clock::time_point deadline;
+    size_t served = 0;
+    size_t batches = 0;
+    std::vector<char> chunk(1 << 16);
+    std::vector<pollfd> fds;
+
+    while (!stop_requested)
+    {
+        // Stdin mode ends once the input is exhausted and every query has been answered
+        if (use_stdin && connections.empty() && pending.empty()) {
+            break;
+        }
+
+        // Sleep until there is input, or until the open batch is due
+        timespec timeout{};
+        timespec* timeout_ptr = nullptr;
+        if (!pending.empty())
+        {
+            auto remaining = std::chrono::duration_cast<std::chrono::nanoseconds>(deadline - clock::now());
+            if (pending.size() < config.max_batch && remaining.count() > 0) {
+                timeout.tv_sec = static_cast<time_t>(remaining.count() / 1000000000);
+                timeout.tv_nsec = static_cast<long>(remaining.count() % 1000000000);
+            }
+            timeout_ptr = &timeout;
+        }
+
+        fds.clear();
+        if (listen_fd >= 0) {
+            fds.push_back({listen_fd, POLLIN, 0});
+        }
+        for (const auto& entry: connections) {
+            if (!entry.second.eof) {
+                fds.push_back({entry.first, POLLIN, 0});
+            }
+        }
+        if (ppoll(fds.data(), fds.size(), timeout_ptr, nullptr) < 0 && errno != EINTR) {
+            break;
+        }
+
+        for (const pollfd& p: fds)
+        {
+            if (p.revents == 0) {
+                continue;
+            }
+            if (p.fd == listen_fd)
+            {
+                int client = accept(listen_fd, nullptr, nullptr);
+                if (client >= 0) {
+                    connections[client] = Connection{client, client, {}};
+                }
+                continue;
+            }
+
+            ssize_t n = read(p.fd, chunk.data(), chunk.size());
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            if (n < 0) {
+                closeConnection(connections, pending, p.fd);
+                continue;
+            }
+            if (n == 0)
+            {
+                // Answer what the client has sent before closing
+                connections[p.fd].eof = true;
+                if (std::none_of(pending.begin(), pending.end(), [&p](const PendingQuery& q) { return q.conn == p.fd; })) {
+                    closeConnection(connections, pending, p.fd);
+                }
+                continue;
+            }
+
+            // Every complete line is a query
+            Connection& conn = connections[p.fd];
+            conn.buffer.append(chunk.data(), static_cast<size_t>(n));
+            size_t start = 0;
+            for (size_t end; (end = conn.buffer.find('\n', start)) != std::string::npos; start = end + 1)
+            {
+                if (pending.empty()) {
+                    deadline = clock::now() + config.batch_window;
+                }
+                size_t len = end - start;
+                if (len > 0 && conn.buffer[end - 1] == '\r') {
+                    --len;
+                }
+                pending.push_back({p.fd, conn.buffer.substr(start, len)});
+            }
+            conn.buffer.erase(0, start);
+        }
+
+        // Score the batch once it is full or its window has passed
+        if (pending.empty() || (pending.size() < config.max_batch && clock::now() < deadline)) {
+            continue;
+        }
+        const size_t count = std::min(pending.size(), config.max_batch);
+        std::vector<std::string_view> texts;
+        for (size_t q = 0; q < count; ++q) {
+            texts.emplace_back(pending[q].text);
+        }
+        std::vector<Neighbor> matches = engine.search(texts, config.k);
+        std::vector<int> failed;
+
+        // Consecutive responses to the same connection are written together
+        std::string response;
+        char field[32];
+        for (size_t q = 0; q < count; ++q)
+        {
+            for (size_t j = 0; j < config.k && matches[q * config.k + j].doc != no_neighbor; ++j)
+            {
+                const Neighbor& match = matches[q * config.k + j];
+                std::snprintf(field, sizeof(field), j == 0 ? "%u %.6f" : " %u %.6f", match.doc, match.score);
+                response += field;
+            }
+            response += '\n';
+
+            const int conn = pending[q].conn;
+            if (q + 1 == count || pending[q + 1].conn != conn)
+            {
+                auto it = connections.find(conn);
+                if (it != connections.end() && !writeAll(it->second.out_fd, response)) {
+                    failed.push_back(conn);
+                }
+                response.clear();
+            }
+        }
+
+        served += count;
+        ++batches;
+        pending.erase(pending.begin(), pending.begin() + count);
+        if (!pending.empty()) {
+            deadline = clock::now();
+        }
+
+        // Release the clients which have gone away, and those which have received every response
+        for (int fd: failed) {
+            closeConnection(connections, pending, fd);
+        }
+        for (auto it = connections.begin(); it != connections.end();)
+        {
+            const int fd = it->first;
+            ++it;
+            if (connections[fd].eof
+                && std::none_of(pending.begin(), pending.end(), [fd](const PendingQuery& q) { return q.conn == fd; })) {
+                closeConnection(connections, pending, fd);
+            }
+        }
+    }
+
+    for (const auto& entry: connections) {
+        if (entry.first != STDIN_FILENO) {
+            close(entry.first);
+        }
+    }
+    if (listen_fd >= 0) {
+        close(listen_fd);
+        unlink(endpoint.c_str());
+    }
+    std::cerr << "Served " << served << " queries in " << batches << " batches" << std::endl;
+    return true;
+}
@@ -0,0 +1,95 @@
+/******************************************************************************
+ * Filename: server.h
+ * Author: Zachary Colbert
+ * Contact: zcolbert@sfsu.edu
+ *
+ * Description: Interface of the query server, which keeps the corpus vectors
+ *              loaded and scores query documents against them. Queries are
+ *              read one per line from a Unix domain socket or stdin, and those
+ *              arriving within a short window are scored as one batch.
+ *
+ *              Protocol: each request is one line of text, the query document.
+ *              Each response is one line of "<doc> <score>" pairs separated by
+ *              spaces, best match first. Responses on a connection are written
+ *              in the order of its requests.
+ *****************************************************************************/
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "sparse.h"
+#include "tokenize.h"
+#include "topk.h"
+
+
+/**
+ * Scores batches of query documents against a corpus given as postings: for each
+ * vocabulary column, the normalized term frequency of every document containing it.
+ */
+class QueryEngine
+{
+public:
+    /**
+     * @param postings The transpose of the row-normalized documents x vocabulary matrix.
+     *                 The arrays must outlive the engine.
+     * @param vocabulary The packed ngram of each vocabulary column.
+     * @param ngram_len The ngram length of the vocabulary.
+     */
+    QueryEngine(const CsrView& postings, const uint64_t* vocabulary, size_t ngram_len);
+
+    /**
+     * Find the k corpus documents most similar to each query, by cosine similarity of
+     * the ngram term frequencies. Ngrams outside the corpus vocabulary count towards
+     * the length of the query vector, but match no document.
+     *
+     * @param queries The text of each query, tokenized as tokenize() would.
+     * @param k The number of matches to return per query.
+     * @return A row-wise queries x k list of matches, each row sorted by descending score.
+     *         Rows are padded with {no_neighbor, 0} if the corpus has fewer than k documents.
+     */
+    std::vector<Neighbor> search(const std::vector<std::string_view>& queries, size_t k);
+
+    /** @return The number of documents in the corpus. */
+    size_t documents() const { return postings.cols; }
+
+private:
+    void searchPostings(const CsrMatrix& batch, size_t q, size_t k, Neighbor* out);
+
+    CsrView postings;
+    NgramCounter counter;
+    std::unordered_map<uint64_t, uint32_t> columns;
+    std::vector<float> doc_scores;  // Document-major scores of a batch, reused across batches
+    std::vector<float> scores;      // Query-major scores of a batch, reused across batches
+    std::vector<float> accumulator; // Scores of a single query, zero except while it is scored
+    std::vector<uint8_t> visited;   // Documents which share an ngram with the single query being scored
+    std::vector<uint32_t> touched;  // The same documents, in order of first visit
+    std::vector<Neighbor> candidates;
+};
+
+/** Settings of the query server. */
+struct ServerConfig
+{
+    size_t k = 10;                                          // Matches returned per query
+    std::chrono::microseconds batch_window{1000};           // Wait after the first pending query
+    size_t max_batch = 64;                                  // Largest batch scored at once
+};
+
+/**
+ * Serve queries until stdin reaches end of file, or until SIGINT or SIGTERM when
+ * listening on a socket.
+ *
+ * The first query to arrive opens a batch, which is scored when the batch window
+ * has passed or when max_batch queries are waiting, whichever comes first.
+ *
+ * @param endpoint The path of the Unix domain socket to listen on, or "-" for stdin and stdout.
+ * @param engine The engine which scores the queries.
+ * @param config The server settings.
+ * @return False if the socket could not be created.
+ */
+bool serveQueries(const std::string& endpoint, QueryEngine& engine, const ServerConfig& config);
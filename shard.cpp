@@ -0,0 +1,386 @@
+/******************************************************************************
+ * Filename: shard.cpp
+ * Author: Zachary Colbert
+ * Contact: zcolbert@sfsu.edu
+ *
+ * Description: Implementation of the sharded similarity computation.
+ *
+ *      The coordinator starts each worker by forking and executing this
+ *      program again with --worker, passing one end of a socket pair as
+ *      worker_fd. A freshly executed worker starts its own OpenMP runtime,
+ *      which is not safe to use in a child which was only forked.
+ *****************************************************************************/
+
+#include "shard.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <fcntl.h>
+#include <poll.h>
+#include <string>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+
+// Row offsets are sent as size_t arrays and read as uint64
+static_assert(sizeof(size_t) == sizeof(uint64_t), "size_t must be 64 bits");
+
+/** The descriptor of the coordinator connection in each worker process. */
+static constexpr int worker_fd = 3;
+
+/** A block of the result, the product of a row shard and a column shard. */
+struct ShardBlock
+{
+    uint32_t i;
+    uint32_t j;
+};
+
+/** The coordinator's view of a worker process. */
+struct ShardWorker
+{
+    pid_t pid = -1;
+    int fd = -1;
+    bool busy = false;
+    ShardBlock block{0, 0};     // The block being computed while busy
+    std::vector<bool> holds;    // The shards the worker has been sent
+};
+
+/**
+ * Write a whole buffer to a socket, without raising SIGPIPE if the peer has gone.
+ *
+ * @return False if the connection failed.
+ */
+static bool writeAll(int fd, const void* data, size_t length)
+{
+    const char* p = static_cast<const char*>(data);
+    while (length > 0)
+    {
+        ssize_t n = ::send(fd, p, length, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        p += n;
+        length -= static_cast<size_t>(n);
+    }
+    return true;
+}
+
+/**
+ * Read a whole buffer from a socket.
+ *
+ * @return False if the connection failed or was closed first.
+ */
+static bool readAll(int fd, void* data, size_t length)
+{
+    char* p = static_cast<char*>(data);
+    while (length > 0)
+    {
+        ssize_t n = ::read(fd, p, length);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        p += n;
+        length -= static_cast<size_t>(n);
+    }
+    return true;
+}
+
+/**
+ * Fork and execute a worker process connected to the coordinator by a socket pair.
+ *
+ * @param worker Receives the process ID and the coordinator's end of the connection.
+ * @param threads The OpenMP threads of the worker.
+ * @return False if the process could not be started.
+ */
+static bool startWorker(ShardWorker& worker, int threads)
+{
+    int fds[2];
+    if (::socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds) != 0) {
+        return false;
+    }
+
+    // Only async-signal-safe calls are allowed between fork and exec, so the arguments are built first
+    const std::string fd_arg = std::to_string(worker_fd);
+    const std::string threads_arg = std::to_string(threads);
+
+    pid_t pid = ::fork();
+    if (pid == 0)
+    {
+        // dup2 clears close-on-exec on the copy, and fcntl when the end is already in place
+        if (fds[1] == worker_fd) {
+            ::fcntl(worker_fd, F_SETFD, 0);
+        } else if (::dup2(fds[1], worker_fd) < 0) {
+            ::_exit(127);
+        }
+        ::execl("/proc/self/exe", "LTS", "--worker", fd_arg.c_str(), "--worker-threads", threads_arg.c_str(),
+                static_cast<char*>(nullptr));
+        ::_exit(127);
+    }
+    ::close(fds[1]);
+    if (pid < 0) {
+        ::close(fds[0]);
+        return false;
+    }
+    worker.pid = pid;
+    worker.fd = fds[0];
+    return true;
+}
+
+/**
+ * Send the rows of one shard to a worker.
+ *
+ * @param fd The worker connection.
+ * @param matrix The full matrix.
+ * @param shard The shard number.
+ * @param first The first row of the shard.
+ * @param last One past the last row of the shard.
+ * @param stats Receives the bytes sent.
+ * @return False if the connection failed.
+ */
+static bool sendShard(int fd, const CsrView& matrix, uint32_t shard, size_t first, size_t last, ShardStats& stats)
+{
+    const size_t base = matrix.row_ptr[first];
+    const size_t count = matrix.row_ptr[last] - base;
+    ShardMessage msg{ShardMessageType::Shard, shard, 0, 0, last - first, matrix.cols, count};
+
+    // Row offsets are sent relative to the first row of the shard
+    std::vector<uint64_t> row_ptr(last - first + 1);
+    for (size_t r = first; r <= last; ++r) {
+        row_ptr[r - first] = matrix.row_ptr[r] - base;
+    }
+
+    stats.bytes_sent += sizeof(msg) + row_ptr.size() * sizeof(uint64_t) + count * (sizeof(uint32_t) + sizeof(float));
+    ++stats.transfers;
+    return writeAll(fd, &msg, sizeof(msg))
+        && writeAll(fd, row_ptr.data(), row_ptr.size() * sizeof(uint64_t))
+        && writeAll(fd, matrix.col_idx + base, count * sizeof(uint32_t))
+        && writeAll(fd, matrix.values + base, count * sizeof(float));
+}
+
+/**
+ * Compute matrix x transpose(matrix) with worker processes, one shard-pair block at a time.
+ *
+ * @param matrix The N x M sparse matrix of normalized document vectors.
+ * @param config The number of shards and workers.
+ * @param result A row-wise N x N matrix which receives the scores.
+ * @param stats Receives the amount of work and traffic.
+ * @return False if the workers could not be started or all of them were lost.
+ */
+bool shardedSimilarity(const CsrView& matrix, const ShardConfig& config, std::vector<float>& result,
+                       ShardStats& stats)
+{
+    stats = ShardStats{};
+    const size_t n = matrix.rows;
+    const size_t shards = std::max<size_t>(1, std::min(config.shards, std::max<size_t>(1, n)));
+    std::vector<size_t> bounds(shards + 1);
+    for (size_t s = 0; s <= shards; ++s) {
+        bounds[s] = n * s / shards;
+    }
+
+    std::vector<ShardBlock> pending;
+    for (uint32_t i = 0; i < shards; ++i) {
+        for (uint32_t j = i; j < shards; ++j) {
+            pending.push_back({i, j});
+        }
+    }
+    const size_t total = pending.size();
+
+    std::vector<ShardWorker> workers(config.workers > 0 ? config.workers : shards);
+    for (ShardWorker& worker: workers)
+    {
+        if (!startWorker(worker, config.worker_threads)) {
+            break;
+        }
+        worker.holds.assign(shards, false);
+    }
+
+    auto lose = [&](ShardWorker& worker) {
+        if (worker.busy) {
+            pending.push_back(worker.block);
+        }
+        ::close(worker.fd);
+        ::kill(worker.pid, SIGKILL);
+        worker.fd = -1;
+        worker.busy = false;
+        ++stats.failed_workers;
+    };
+
+    std::vector<float> block;
+    std::vector<pollfd> fds;
+    std::vector<ShardWorker*> polled;
+    bool failed = false;
+    while (stats.blocks < total)
+    {
+        // Give each idle worker the pending block needing the fewest shards it does not hold
+        for (ShardWorker& worker: workers)
+        {
+            if (worker.fd < 0 || worker.busy || pending.empty()) {
+                continue;
+            }
+            auto missing = [&](const ShardBlock& b) {
+                return (worker.holds[b.i] ? 0 : 1) + (b.j != b.i && !worker.holds[b.j] ? 1 : 0);
+            };
+            auto best = std::min_element(pending.begin(), pending.end(), [&](const ShardBlock& x, const ShardBlock& y) {
+                return missing(x) < missing(y);
+            });
+            const ShardBlock next = *best;
+            pending.erase(best);
+            worker.busy = true;
+            worker.block = next;
+
+            bool sent = true;
+            for (uint32_t s: {next.i, next.j})
+            {
+                if (sent && !worker.holds[s]) {
+                    sent = sendShard(worker.fd, matrix, s, bounds[s], bounds[s + 1], stats);
+                    worker.holds[s] = sent;
+                }
+            }
+            ShardMessage msg{ShardMessageType::Block, next.i, next.j, 0, 0, 0, 0};
+            stats.bytes_sent += sizeof(msg);
+            if (!sent || !writeAll(worker.fd, &msg, sizeof(msg))) {
+                lose(worker);
+            }
+        }
+
+        // Wait for any busy worker to answer
+        fds.clear();
+        polled.clear();
+        for (ShardWorker& worker: workers)
+        {
+            if (worker.fd >= 0 && worker.busy) {
+                fds.push_back({worker.fd, POLLIN, 0});
+                polled.push_back(&worker);
+            }
+        }
+        if (fds.empty())
+        {
+            // Every worker has been lost
+            failed = true;
+            break;
+        }
+        if (::poll(fds.data(), fds.size(), -1) < 0)
+        {
+            if (errno == EINTR) {
+                continue;
+            }
+            failed = true;
+            break;
+        }
+
+        for (size_t w = 0; w < fds.size(); ++w)
+        {
+            if (fds[w].revents == 0) {
+                continue;
+            }
+            ShardWorker& worker = *polled[w];
+            const ShardBlock b = worker.block;
+            const size_t rows = bounds[b.i + 1] - bounds[b.i];
+            const size_t cols = bounds[b.j + 1] - bounds[b.j];
+
+            ShardMessage msg;
+            block.resize(rows * cols);
+            if (!readAll(worker.fd, &msg, sizeof(msg)) || msg.type != ShardMessageType::Result
+                || msg.a != b.i || msg.b != b.j || msg.rows != rows || msg.cols != cols
+                || !readAll(worker.fd, block.data(), block.size() * sizeof(float)))
+            {
+                lose(worker);
+                continue;
+            }
+            stats.bytes_received += sizeof(msg) + block.size() * sizeof(float);
+            worker.busy = false;
+            ++stats.blocks;
+
+            // The result is symmetric, so block (j, i) is the transpose of block (i, j)
+            for (size_t r = 0; r < rows; ++r)
+            {
+                std::copy(&block[r * cols], &block[r * cols] + cols, &result[(bounds[b.i] + r) * n + bounds[b.j]]);
+                if (b.i != b.j) {
+                    for (size_t c = 0; c < cols; ++c) {
+                        result[(bounds[b.j] + c) * n + bounds[b.i] + r] = block[r * cols + c];
+                    }
+                }
+            }
+        }
+    }
+
+    // Closing the connections tells the workers to exit
+    for (ShardWorker& worker: workers)
+    {
+        if (worker.fd >= 0) {
+            ::close(worker.fd);
+        }
+        if (worker.pid > 0) {
+            ::waitpid(worker.pid, nullptr, 0);
+        }
+    }
+    return !failed;
+}
+
+/**
+ * Serve block requests from a coordinator until it closes the connection.
+ *
+ * @param fd The connected stream socket.
+ * @return The process exit status: zero when the coordinator closed the connection.
+ */
+int runShardWorker(int fd)
+{
+    std::vector<CsrMatrix> shards;
+    CsrMatrix postings;
+    uint32_t postings_shard = UINT32_MAX;   // The shard whose transpose is held in postings
+    std::vector<float> block;
+
+    ShardMessage msg;
+    while (readAll(fd, &msg, sizeof(msg)))
+    {
+        if (msg.type == ShardMessageType::Shard)
+        {
+            if (msg.a >= shards.size()) {
+                shards.resize(msg.a + 1);
+            }
+            CsrMatrix& shard = shards[msg.a];
+            shard.rows = msg.rows;
+            shard.cols = msg.cols;
+            shard.row_ptr.resize(msg.rows + 1);
+            shard.col_idx.resize(msg.count);
+            shard.values.resize(msg.count);
+            if (!readAll(fd, shard.row_ptr.data(), shard.row_ptr.size() * sizeof(uint64_t))
+                || !readAll(fd, shard.col_idx.data(), msg.count * sizeof(uint32_t))
+                || !readAll(fd, shard.values.data(), msg.count * sizeof(float))) {
+                return 1;
+            }
+            if (postings_shard == msg.a) {
+                postings_shard = UINT32_MAX;
+            }
+        }
+        else if (msg.type == ShardMessageType::Block && msg.a < shards.size() && msg.b < shards.size())
+        {
+            // Consecutive blocks often share their column shard, so its transpose is kept
+            if (postings_shard != msg.b) {
+                postings = transpose(shards[msg.b]);
+                postings_shard = msg.b;
+            }
+            const CsrMatrix& rows = shards[msg.a];
+            const CsrMatrix& cols = shards[msg.b];
+            block.assign(rows.rows * cols.rows, 0.0f);
+            sparseMultiplyPostings(view(rows), view(postings), block);
+
+            ShardMessage reply{ShardMessageType::Result, msg.a, msg.b, 0, rows.rows, cols.rows, block.size()};
+            if (!writeAll(fd, &reply, sizeof(reply)) || !writeAll(fd, block.data(), block.size() * sizeof(float))) {
+                return 1;
+            }
+        }
+        else {
+            return 1;
+        }
+    }
+    return 0;
+}
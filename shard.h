@@ -0,0 +1,87 @@
+/******************************************************************************
+ * Filename: shard.h
+ * Author: Zachary Colbert
+ * Contact: zcolbert@sfsu.edu
+ *
+ * Description: Interface of the sharded similarity computation. The documents
+ *              are split into P shards of consecutive rows, and worker
+ *              processes compute the (i, j) shard-pair blocks of the result.
+ *              A coordinator schedules the blocks, sends each worker the
+ *              shards it needs and merges the returned blocks.
+ *
+ *              Workers hold no state but the shards they were sent, and all
+ *              traffic is framed messages over a stream socket, so the same
+ *              protocol works over TCP between hosts.
+ *
+ *              Protocol: each message is a ShardMessage header, followed by
+ *                  Shard:  uint64 row_ptr[rows + 1] (starting at zero),
+ *                          uint32 col_idx[count], float values[count]
+ *                  Block:  nothing. Asks for shard a x transpose(shard b).
+ *                  Result: float scores[rows * cols], the row-wise block a x b.
+ *****************************************************************************/
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "sparse.h"
+
+
+/** Types of the messages between the coordinator and the workers. */
+enum class ShardMessageType : uint32_t { Shard = 1, Block = 2, Result = 3 };
+
+/** The fixed-size header of every message. */
+struct ShardMessage
+{
+    ShardMessageType type;
+    uint32_t a;             // The shard sent, or the row shard of a block
+    uint32_t b;             // The column shard of a block
+    uint32_t reserved;
+    uint64_t rows;
+    uint64_t cols;
+    uint64_t count;         // Non-zero elements of a shard, or scores of a result
+};
+
+/** Settings of a sharded computation. */
+struct ShardConfig
+{
+    size_t shards = 4;          // Partitions of the documents
+    size_t workers = 0;         // Worker processes. Zero starts one per shard.
+    int worker_threads = 1;     // OpenMP threads of each worker
+};
+
+/** What a sharded computation did. */
+struct ShardStats
+{
+    size_t blocks = 0;              // Blocks computed, i <= j
+    size_t transfers = 0;           // Shards sent to workers
+    uint64_t bytes_sent = 0;
+    uint64_t bytes_received = 0;
+    size_t failed_workers = 0;      // Workers lost, whose blocks were given to others
+};
+
+/**
+ * Compute matrix x transpose(matrix) with worker processes, one shard-pair block at a time.
+ * Only the blocks i <= j are computed, and each is mirrored into block (j, i).
+ *
+ * The workers run this executable with --worker. Each idle worker is given the pending
+ * block needing the fewest shards it does not already hold. If a worker exits, its
+ * block is given to another.
+ *
+ * @param matrix The N x M sparse matrix of normalized document vectors.
+ * @param config The number of shards and workers.
+ * @param result A row-wise N x N matrix which receives the scores.
+ * @param stats Receives the amount of work and traffic.
+ * @return False if the workers could not be started or all of them were lost.
+ */
+bool shardedSimilarity(const CsrView& matrix, const ShardConfig& config, std::vector<float>& result,
+                       ShardStats& stats);
+
+/**
+ * Serve block requests from a coordinator until it closes the connection.
+ *
+ * @param fd The connected stream socket.
+ * @return The process exit status: zero when the coordinator closed the connection.
+ */
+int runShardWorker(int fd);
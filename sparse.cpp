@@ -0,0 +1,284 @@
+/******************************************************************************
+ * Filename: sparse.cpp
+ * Author: Zachary Colbert
+ * Contact: zcolbert@sfsu.edu
+ *
+ * Description: Implementation of compressed sparse row (CSR) matrix
+ *              operations.
+ *****************************************************************************/
+
+#include "sparse.h"
+
+#include <algorithm>
+#include <cmath>    // sqrt
+
+
+/**
+ * Construct a sparse term frequency matrix with one row per document.
+ *
+ * Columns follow the iteration order of the vocabulary, so the result holds
+ * exactly the non-zero elements of getTermFrequencyMatrix().
+ *
+ * @param doc_freq_maps The token counts of each document.
+ * @param vocabulary The set of unique tokens defining the column space.
+ * @return A (documents x vocabulary) sparse matrix of term frequencies.
+ */
+CsrMatrix getSparseTermFrequencyMatrix(
+        const std::vector<std::unordered_map<std::string, unsigned int>>& doc_freq_maps,
+        const std::set<std::string>& vocabulary)
+{
+    // Assign each token the column it would occupy in the dense matrix
+    std::unordered_map<std::string, uint32_t> columns;
+    columns.reserve(vocabulary.size());
+    uint32_t col = 0;
+    for (const auto& tkn: vocabulary) {
+        columns.emplace(tkn, col++);
+    }
+
+    CsrMatrix matrix;
+    matrix.rows = doc_freq_maps.size();
+    matrix.cols = vocabulary.size();
+    matrix.row_ptr.reserve(matrix.rows + 1);
+    matrix.row_ptr.push_back(0);
+
+    size_t nnz = 0;
+    for (const auto& doc: doc_freq_maps) {
+        nnz += doc.size();
+    }
+    matrix.col_idx.reserve(nnz);
+    matrix.values.reserve(nnz);
+
+    std::vector<std::pair<uint32_t, float>> row;
+    for (const auto& doc: doc_freq_maps)
+    {
+        row.clear();
+        for (const auto& kv: doc)
+        {
+            auto it = columns.find(kv.first);
+            if (it != columns.end()) {
+                row.emplace_back(it->second, static_cast<float>(kv.second));
+            }
+        }
+        // Keep the column indices of each row in ascending order
+        std::sort(row.begin(), row.end());
+        for (const auto& elem: row) {
+            matrix.col_idx.push_back(elem.first);
+            matrix.values.push_back(elem.second);
+        }
+        matrix.row_ptr.push_back(matrix.values.size());
+    }
+    return matrix;
+}
+
+/**
+ * Construct a sparse term frequency matrix from token counts indexed by token ID.
+ *
+ * @param docs The token counts of each document.
+ * @param vocabulary The token IDs defining the column space, in column order.
+ * @return A (documents x vocabulary) sparse matrix of term frequencies.
+ */
+CsrMatrix getSparseTermFrequencyMatrix(
+        const DocumentTokenCounts& docs,
+        const std::vector<uint32_t>& vocabulary)
+{
+    const std::vector<uint32_t> columns = getColumnMap(vocabulary);
+
+    CsrMatrix matrix;
+    matrix.rows = docs.size();
+    matrix.cols = vocabulary.size();
+    matrix.row_ptr.reserve(matrix.rows + 1);
+    matrix.row_ptr.push_back(0);
+
+    size_t nnz = 0;
+    for (const auto& doc: docs) {
+        nnz += doc.size();
+    }
+    matrix.col_idx.reserve(nnz);
+    matrix.values.reserve(nnz);
+
+    std::vector<std::pair<uint32_t, float>> row;
+    for (const auto& doc: docs)
+    {
+        row.clear();
+        for (const auto& tc: doc)
+        {
+            if (tc.first < columns.size() && columns[tc.first] != no_column) {
+                row.emplace_back(columns[tc.first], static_cast<float>(tc.second));
+            }
+        }
+        // Columns are only in ID order when the vocabulary is sorted
+        std::sort(row.begin(), row.end());
+        for (const auto& elem: row) {
+            matrix.col_idx.push_back(elem.first);
+            matrix.values.push_back(elem.second);
+        }
+        matrix.row_ptr.push_back(matrix.values.size());
+    }
+    return matrix;
+}
+
+/**
+ * @param matrix The matrix to view. It must outlive the view.
+ * @return A view of the arrays of the matrix.
+ */
+CsrView view(const CsrMatrix& matrix)
+{
+    CsrView v;
+    v.rows = matrix.rows;
+    v.cols = matrix.cols;
+    v.row_ptr = matrix.row_ptr.data();
+    v.col_idx = matrix.col_idx.data();
+    v.values = matrix.values.data();
+    return v;
+}
+
+/**
+ * Normalize each row vector in the given sparse matrix to unit length.
+ * Rows without any non-zero elements are left empty.
+ *
+ * @param matrix The sparse matrix to modify.
+ */
+void normalizeSparseMatrix(CsrMatrix& matrix)
+{
+    #pragma omp parallel for
+    for (size_t i = 0; i < matrix.rows; ++i)
+    {
+        float sum = 0.0f;
+        for (size_t p = matrix.row_ptr[i]; p < matrix.row_ptr[i + 1]; ++p) {
+            sum += matrix.values[p] * matrix.values[p];
+        }
+        if (sum > 0.0f)
+        {
+            float mag = std::sqrt(sum);
+            for (size_t p = matrix.row_ptr[i]; p < matrix.row_ptr[i + 1]; ++p) {
+                matrix.values[p] = matrix.values[p] / mag;
+            }
+        }
+    }
+}
+
+/**
+ * Expand a sparse matrix to a dense row-wise matrix.
+ *
+ * @param matrix The N x M sparse matrix.
+ * @return The row-wise N x M dense matrix.
+ */
+std::vector<float> toDense(const CsrView& matrix)
+{
+    std::vector<float> dense(matrix.rows * matrix.cols, 0.0f);
+
+    #pragma omp parallel for
+    for (size_t i = 0; i < matrix.rows; ++i) {
+        for (size_t p = matrix.row_ptr[i]; p < matrix.row_ptr[i + 1]; ++p) {
+            dense[i * matrix.cols + matrix.col_idx[p]] = matrix.values[p];
+        }
+    }
+    return dense;
+}
+
+/**
+ * Compute the Euclidean length of each row vector in the given sparse matrix.
+ *
+ * @param matrix The sparse matrix.
+ * @return The length of each row.
+ */
+std::vector<float> sparseRowNorms(const CsrMatrix& matrix)
+{
+    std::vector<float> norms(matrix.rows);
+
+    #pragma omp parallel for
+    for (size_t i = 0; i < matrix.rows; ++i)
+    {
+        float sum = 0.0f;
+        for (size_t p = matrix.row_ptr[i]; p < matrix.row_ptr[i + 1]; ++p) {
+            sum += matrix.values[p] * matrix.values[p];
+        }
+        norms[i] = std::sqrt(sum);
+    }
+    return norms;
+}
+
+/**
+ * Produce the transpose of the given sparse matrix.
+ *
+ * @param matrix The original N x M sparse matrix.
+ * @return The M x N transpose, with sorted column indices in each row.
+ */
+CsrMatrix transpose(const CsrMatrix& matrix)
+{
+    CsrMatrix m_T;
+    m_T.rows = matrix.cols;
+    m_T.cols = matrix.rows;
+    m_T.row_ptr.assign(m_T.rows + 1, 0);
+    m_T.col_idx.resize(matrix.nonZeros());
+    m_T.values.resize(matrix.nonZeros());
+
+    // Count the elements in each column, then convert the counts to offsets
+    for (uint32_t c: matrix.col_idx) {
+        ++m_T.row_ptr[c + 1];
+    }
+    for (size_t c = 0; c < m_T.rows; ++c) {
+        m_T.row_ptr[c + 1] += m_T.row_ptr[c];
+    }
+
+    // Scatter the elements in row order, which keeps each output row sorted
+    std::vector<size_t> next(m_T.row_ptr.begin(), m_T.row_ptr.end() - 1);
+    for (size_t r = 0; r < matrix.rows; ++r)
+    {
+        for (size_t p = matrix.row_ptr[r]; p < matrix.row_ptr[r + 1]; ++p)
+        {
+            size_t dest = next[matrix.col_idx[p]]++;
+            m_T.col_idx[dest] = static_cast<uint32_t>(r);
+            m_T.values[dest] = matrix.values[p];
+        }
+    }
+    return m_T;
+}
+
+/**
+ * Perform the multiplication lhs x transpose(rhs), accumulating into a dense result.
+ *
+ * Each row of the result only visits the columns shared between its lhs row and
+ * the rows of rhs, so the work is proportional to the number of matching
+ * non-zero pairs rather than to the size of the vocabulary.
+ *
+ * @param lhs The left-hand operand, with dimensions N x M.
+ * @param rhs The right-hand operand before transposition, with dimensions P x M.
+ * @param result A row-wise N x P matrix which receives the sum of the products.
+ */
+void sparseMultiplyTranspose(const CsrMatrix& lhs, const CsrMatrix& rhs, std::vector<float>& result)
+{
+    // The columns of rhs become rows: for every token, the documents containing it
+    const CsrMatrix postings = transpose(rhs);
+    sparseMultiplyPostings(view(lhs), view(postings), result);
+}
+
+/**
+ * Perform the multiplication lhs x transpose(rhs), given transpose(rhs) as postings:
+ * row k of the postings lists the rows of rhs which contain column k.
+ *
+ * @param lhs The left-hand operand, with dimensions N x M.
+ * @param postings The transpose of the right-hand operand, with dimensions M x P.
+ * @param result A row-wise N x P matrix which receives the sum of the products.
+ */
+void sparseMultiplyPostings(const CsrView& lhs, const CsrView& postings, std::vector<float>& result)
+{
+    const size_t n = postings.cols;
+
+    #pragma omp parallel for schedule(dynamic, 16)
+    for (size_t i = 0; i < lhs.rows; ++i)
+    {
+        float* out = &result[i * n];
+        for (size_t p = lhs.row_ptr[i]; p < lhs.row_ptr[i + 1]; ++p)
+        {
+            const uint32_t k = lhs.col_idx[p];
+            if (k >= postings.rows) {
+                continue;
+            }
+            const float a = lhs.values[p];
+            for (size_t q = postings.row_ptr[k]; q < postings.row_ptr[k + 1]; ++q) {
+                out[postings.col_idx[q]] += a * postings.values[q];
+            }
+        }
+    }
+}
@@ -0,0 +1,137 @@
+/******************************************************************************
+ * Filename: sparse.h
+ * Author: Zachary Colbert
+ * Contact: zcolbert@sfsu.edu
+ *
+ * Description: Interface of compressed sparse row (CSR) matrix operations
+ *              used to compute document similarity without materializing
+ *              the dense term frequency matrix.
+ *****************************************************************************/
+#pragma once
+
+#include <cstdint>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "dictionary.h"
+
+
+/**
+ * A row-wise sparse matrix in compressed sparse row (CSR) format.
+ *
+ * The non-zero elements of row i are stored at [row_ptr[i], row_ptr[i + 1])
+ * of col_idx and values. Column indices within a row are sorted ascending.
+ */
+struct CsrMatrix
+{
+    size_t rows = 0;
+    size_t cols = 0;
+    std::vector<size_t> row_ptr;
+    std::vector<uint32_t> col_idx;
+    std::vector<float> values;
+
+    size_t nonZeros() const { return values.size(); }
+};
+
+/**
+ * A read-only view of CSR arrays owned elsewhere, such as a CsrMatrix or a
+ * memory-mapped index file. The layout is the same as CsrMatrix.
+ */
+struct CsrView
+{
+    size_t rows = 0;
+    size_t cols = 0;
+    const size_t* row_ptr = nullptr;
+    const uint32_t* col_idx = nullptr;
+    const float* values = nullptr;
+
+    size_t nonZeros() const { return row_ptr != nullptr ? row_ptr[rows] : 0; }
+};
+
+/**
+ * @param matrix The matrix to view. It must outlive the view.
+ * @return A view of the arrays of the matrix.
+ */
+CsrView view(const CsrMatrix& matrix);
+
+/**
+ * Expand a sparse matrix to a dense row-wise matrix.
+ *
+ * @param matrix The N x M sparse matrix.
+ * @return The row-wise N x M dense matrix.
+ */
+std::vector<float> toDense(const CsrView& matrix);
+
+/**
+ * Construct a sparse term frequency matrix with one row per document.
+ *
+ * Columns follow the iteration order of the vocabulary, so the result holds
+ * exactly the non-zero elements of getTermFrequencyMatrix().
+ *
+ * @param doc_freq_maps The token counts of each document.
+ * @param vocabulary The set of unique tokens defining the column space.
+ * @return A (documents x vocabulary) sparse matrix of term frequencies.
+ */
+CsrMatrix getSparseTermFrequencyMatrix(
+        const std::vector<std::unordered_map<std::string, unsigned int>>& doc_freq_maps,
+        const std::set<std::string>& vocabulary);
+
+/**
+ * Construct a sparse term frequency matrix from token counts indexed by token ID.
+ *
+ * @param docs The token counts of each document.
+ * @param vocabulary The token IDs defining the column space, in column order.
+ * @return A (documents x vocabulary) sparse matrix of term frequencies.
+ */
+CsrMatrix getSparseTermFrequencyMatrix(
+        const DocumentTokenCounts& docs,
+        const std::vector<uint32_t>& vocabulary);
+
+/**
+ * Normalize each row vector in the given sparse matrix to unit length.
+ * Rows without any non-zero elements are left empty.
+ *
+ * @param matrix The sparse matrix to modify.
+ */
+void normalizeSparseMatrix(CsrMatrix& matrix);
+
+/**
+ * Compute the Euclidean length of each row vector in the given sparse matrix.
+ *
+ * @param matrix The sparse matrix.
+ * @return The length of each row.
+ */
+std::vector<float> sparseRowNorms(const CsrMatrix& matrix);
+
+/**
+ * Produce the transpose of the given sparse matrix.
+ *
+ * @param matrix The original N x M sparse matrix.
+ * @return The M x N transpose, with sorted column indices in each row.
+ */
+CsrMatrix transpose(const CsrMatrix& matrix);
+
+/**
+ * Perform the multiplication lhs x transpose(rhs), accumulating into a dense result.
+ *
+ * Each row of the result only visits the columns shared between its lhs row and
+ * the rows of rhs, so the work is proportional to the number of matching
+ * non-zero pairs rather than to the size of the vocabulary.
+ *
+ * @param lhs The left-hand operand, with dimensions N x M.
+ * @param rhs The right-hand operand before transposition, with dimensions P x M.
+ * @param result A row-wise N x P matrix which receives the sum of the products.
+ */
+void sparseMultiplyTranspose(const CsrMatrix& lhs, const CsrMatrix& rhs, std::vector<float>& result);
+
+/**
+ * Perform the multiplication lhs x transpose(rhs), given transpose(rhs) as postings:
+ * row k of the postings lists the rows of rhs which contain column k.
+ *
+ * @param lhs The left-hand operand, with dimensions N x M.
+ * @param postings The transpose of the right-hand operand, with dimensions M x P.
+ * @param result A row-wise N x P matrix which receives the sum of the products.
+ */
+void sparseMultiplyPostings(const CsrView& lhs, const CsrView& postings, std::vector<float>& result);
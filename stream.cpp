@@ -0,0 +1,275 @@
+/******************************************************************************
+ * Filename: stream.cpp
+ * Author: Zachary Colbert
+ * Contact: zcolbert@sfsu.edu
+ *
+ * Description: Implementation of the out-of-core similarity computation.
+ *
+ *      Two stripe buffers are used in turn. While the OpenMP threads compute
+ *      a stripe into one buffer, a writer thread filters and writes the
+ *      previous stripe from the other, so the disk and the computation
+ *      overlap and peak memory is two stripes regardless of N.
+ *****************************************************************************/
+
+#include "stream.h"
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <fstream>
+#include <mutex>
+#include <thread>
+
+#include "gemm.h"
+#include "linear.h"
+
+
+/** Pairs collected before each write of the Pairs format. */
+static constexpr size_t pair_chunk = 65536;
+
+/**
+ * Write the rows of one stripe in the configured format.
+ *
+ * @param outfile The score file.
+ * @param stripe The row-wise count x n stripe.
+ * @param first The first row of the stripe.
+ * @param count The number of rows in the stripe.
+ * @param n The number of columns.
+ * @param config The output format.
+ * @param pairs A buffer for the Pairs format.
+ * @return The number of scores or pairs written.
+ */
+static uint64_t writeStripe(std::ofstream& outfile, const std::vector<float>& stripe, size_t first, size_t count,
+                            size_t n, const StreamConfig& config, std::vector<ScorePair>& pairs)
+{
+    if (!config.use_threshold) {
+        outfile.write(reinterpret_cast<const char*>(stripe.data()), static_cast<std::streamsize>(count * n * sizeof(float)));
+        return count * n;
+    }
+
+    // Only the upper triangle: the matrix is symmetric and the diagonal holds each document with itself
+    uint64_t written = 0;
+    for (size_t r = 0; r < count; ++r)
+    {
+        const size_t i = first + r;
+        const float* row = &stripe[r * n];
+        for (size_t j = i + 1; j < n; ++j)
+        {
+            if (row[j] >= config.threshold) {
+                pairs.push_back({static_cast<uint32_t>(i), static_cast<uint32_t>(j), row[j]});
+            }
+            if (pairs.size() == pair_chunk)
+            {
+                outfile.write(reinterpret_cast<const char*>(pairs.data()), static_cast<std::streamsize>(pairs.size() * sizeof(ScorePair)));
+                written += pairs.size();
+                pairs.clear();
+            }
+        }
+    }
+    outfile.write(reinterpret_cast<const char*>(pairs.data()), static_cast<std::streamsize>(pairs.size() * sizeof(ScorePair)));
+    written += pairs.size();
+    pairs.clear();
+    return written;
+}
+
+/**
+ * Compute an n x n result one stripe at a time and stream it to a score file.
+ *
+ * @param n The number of rows and columns of the result.
+ * @param path The path of the score file.
+ * @param config The memory budget and output format.
+ * @param stats Receives the stripe size and the amount written.
+ * @param compute A callable taking (first, count, stripe) which adds rows [first, first + count)
+ *                of the result to the zeroed count x n stripe.
+ * @return False if the file could not be written.
+ */
+template <typename Compute>
+static bool streamStripes(size_t n, const std::string& path, const StreamConfig& config, StreamStats& stats,
+                          Compute compute)
+{
+    std::ofstream outfile(path, std::ios::binary | std::ios::trunc);
+    if (!outfile) {
+        return false;
+    }
+
+    ScoreFileHeader header{};
+    std::memcpy(header.magic, score_magic, sizeof(score_magic));
+    header.version = score_version;
+    header.format = config.use_threshold ? ScoreFormat::Pairs : ScoreFormat::Dense;
+    header.rows = n;
+    header.cols = n;
+    header.threshold = config.threshold;
+    outfile.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+    // Two stripes fit in the budget
+    stats = StreamStats{};
+    stats.stripe_rows = std::max<size_t>(1, std::min(n, config.memory_budget / (2 * std::max<size_t>(1, n) * sizeof(float))));
+    stats.stripes = (n + stats.stripe_rows - 1) / stats.stripe_rows;
+
+    std::vector<float> buffers[2];
+    bool full[2] = {false, false};
+    std::mutex mutex;
+    std::condition_variable changed;
+    bool failed = false;
+
+    // The writer takes the stripes in order, alternating between the buffers
+    std::thread writer([&]() {
+        std::vector<ScorePair> pairs;
+        pairs.reserve(config.use_threshold ? pair_chunk : 0);
+        for (size_t s = 0; s < stats.stripes; ++s)
+        {
+            const size_t b = s % 2;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                changed.wait(lock, [&]() { return full[b]; });
+            }
+            const size_t first = s * stats.stripe_rows;
+            const size_t count = std::min(stats.stripe_rows, n - first);
+            if (!failed)
+            {
+                stats.written += writeStripe(outfile, buffers[b], first, count, n, config, pairs);
+                failed = !outfile;
+            }
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                full[b] = false;
+            }
+            changed.notify_all();
+        }
+    });
+
+    for (size_t s = 0; s < stats.stripes; ++s)
+    {
+        const size_t b = s % 2;
+        auto wait_start = std::chrono::steady_clock::now();
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            changed.wait(lock, [&]() { return !full[b]; });
+        }
+        std::chrono::duration<double> waited = std::chrono::steady_clock::now() - wait_start;
+        stats.write_wait += waited.count();
+
+        const size_t first = s * stats.stripe_rows;
+        const size_t count = std::min(stats.stripe_rows, n - first);
+        buffers[b].assign(count * n, 0.0f);
+        compute(first, count, buffers[b]);
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            full[b] = true;
+        }
+        changed.notify_all();
+    }
+    writer.join();
+
+    // The number of pairs is only known at the end
+    header.count = stats.written;
+    outfile.seekp(0);
+    outfile.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    outfile.close();
+    return !failed && static_cast<bool>(outfile);
+}
+
+/**
+ * Compute matrix x transpose(matrix) for a dense row-wise matrix, one stripe at a time,
+ * and stream the result to a score file.
+ *
+ * @param matrix The row-wise N x M matrix of normalized document vectors.
+ * @param rows The number of rows in the matrix.
+ * @param cols The number of columns in the matrix.
+ * @param path The path of the score file.
+ * @param config The memory budget and output format.
+ * @param stats Receives the stripe size and the amount written.
+ * @return False if the file could not be written.
+ */
+bool streamDenseSimilarity(const std::vector<float>& matrix, size_t rows, size_t cols,
+                           const std::string& path, const StreamConfig& config, StreamStats& stats)
+{
+    // Each stripe is a panel of the packed GEMM, against the transpose
+    const std::vector<float> m_T = transpose(matrix, rows, cols);
+    return streamStripes(rows, path, config, stats, [&](size_t first, size_t count, std::vector<float>& stripe) {
+        gemm(count, rows, cols, &matrix[first * cols], cols, m_T.data(), rows, stripe.data(), rows);
+    });
+}
+
+/**
+ * Compute matrix x transpose(matrix) for a sparse matrix, one stripe at a time,
+ * and stream the result to a score file.
+ *
+ * @param matrix The N x M sparse matrix of normalized document vectors.
+ * @param postings The transpose of the matrix.
+ * @param path The path of the score file.
+ * @param config The memory budget and output format.
+ * @param stats Receives the stripe size and the amount written.
+ * @return False if the file could not be written.
+ */
+bool streamSparseSimilarity(const CsrView& matrix, const CsrView& postings,
+                            const std::string& path, const StreamConfig& config, StreamStats& stats)
+{
+    return streamStripes(matrix.rows, path, config, stats, [&](size_t first, size_t count, std::vector<float>& stripe) {
+        // Row offsets are absolute, so a stripe is a view starting at its first row
+        CsrView rows = matrix;
+        rows.row_ptr = matrix.row_ptr + first;
+        rows.rows = count;
+        sparseMultiplyPostings(rows, postings, stripe);
+    });
+}
+
+/**
+ * Write the top-k lists of every document to a score file in the Neighbors format.
+ *
+ * @param neighbors The row-wise rows x k list of neighbours, as returned by topKSimilar().
+ * @param rows The number of documents.
+ * @param k The number of neighbours per document.
+ * @param path The path of the score file.
+ * @return False if the file could not be written.
+ */
+bool writeNeighborFile(const std::vector<Neighbor>& neighbors, size_t rows, size_t k, const std::string& path)
+{
+    std::ofstream outfile(path, std::ios::binary | std::ios::trunc);
+    if (!outfile) {
+        return false;
+    }
+
+    ScoreFileHeader header{};
+    std::memcpy(header.magic, score_magic, sizeof(score_magic));
+    header.version = score_version;
+    header.format = ScoreFormat::Neighbors;
+    header.rows = rows;
+    header.cols = k;
+    header.count = rows * k;
+    outfile.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    outfile.write(reinterpret_cast<const char*>(neighbors.data()), static_cast<std::streamsize>(rows * k * sizeof(Neighbor)));
+    outfile.close();
+    return static_cast<bool>(outfile);
+}
+
+/**
+ * Write a list of pairs to a score file in the Pairs format.
+ *
+ * @param pairs The pairs i < j, in row order.
+ * @param rows The number of documents.
+ * @param threshold The smallest score the pairs were selected by.
+ * @param path The path of the score file.
+ * @return False if the file could not be written.
+ */
+bool writePairFile(const std::vector<ScorePair>& pairs, size_t rows, float threshold, const std::string& path)
+{
+    std::ofstream outfile(path, std::ios::binary | std::ios::trunc);
+    if (!outfile) {
+        return false;
+    }
+
+    ScoreFileHeader header{};
+    std::memcpy(header.magic, score_magic, sizeof(score_magic));
+    header.version = score_version;
+    header.format = ScoreFormat::Pairs;
+    header.rows = rows;
+    header.cols = rows;
+    header.count = pairs.size();
+    header.threshold = threshold;
+    outfile.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    outfile.write(reinterpret_cast<const char*>(pairs.data()), static_cast<std::streamsize>(pairs.size() * sizeof(ScorePair)));
+    outfile.close();
+    return static_cast<bool>(outfile);
+}
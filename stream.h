@@ -0,0 +1,128 @@
+/******************************************************************************
+ * Filename: stream.h
+ * Author: Zachary Colbert
+ * Contact: zcolbert@sfsu.edu
+ *
+ * Description: Interface of the out-of-core similarity computation, which
+ *              computes the N x N similarity matrix in row stripes sized to
+ *              a memory budget and streams each finished stripe to a binary
+ *              file while the next stripe is computed.
+ *
+ *              File layout, all integers little-endian:
+ *                  ScoreFileHeader
+ *                  Dense format: float[rows * cols], the full row-wise matrix
+ *                  Pairs format: ScorePair[count], the pairs i < j whose score
+ *                                is at least the threshold, in row order
+ *                                (in column order when written by the pipeline)
+ *                  Neighbors format: Neighbor[rows * cols], the cols best matches
+ *                                of each row, best first (see topk.h)
+ *****************************************************************************/
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "sparse.h"
+#include "topk.h"
+
+
+/** The first 8 bytes of a score file. */
+constexpr char score_magic[8] = {'L', 'T', 'S', 'S', 'C', 'O', 'R', 'E'};
+
+/** Incremented whenever the file layout changes. */
+constexpr uint32_t score_version = 1;
+
+/** Layouts of the scores following the header. */
+enum class ScoreFormat : uint32_t { Dense = 0, Pairs = 1, Neighbors = 2 };
+
+/** The fixed-size header at the start of a score file. */
+struct ScoreFileHeader
+{
+    char magic[8];
+    uint32_t version;
+    ScoreFormat format;
+    uint64_t rows;
+    uint64_t cols;
+    uint64_t count;         // Scores (Dense), pairs (Pairs) or neighbours (Neighbors) following the header
+    float threshold;        // Smallest score kept by the Pairs format
+    uint32_t reserved;
+};
+
+/** A pair of documents and their score, as stored by the Pairs format. */
+struct ScorePair
+{
+    uint32_t row;
+    uint32_t col;
+    float score;
+};
+
+/** Settings of a streamed computation. */
+struct StreamConfig
+{
+    size_t memory_budget = size_t(256) << 20;   // Bytes for the stripe buffers
+    bool use_threshold = false;                 // Write the Pairs format instead of the Dense format
+    float threshold = 0.0f;
+};
+
+/** What a streamed computation did. */
+struct StreamStats
+{
+    size_t stripe_rows = 0;     // Rows per stripe
+    size_t stripes = 0;
+    uint64_t written = 0;       // Scores or pairs written
+    double write_wait = 0.0;    // Seconds the computation waited for the writer
+};
+
+/**
+ * Compute matrix x transpose(matrix) for a dense row-wise matrix, one stripe at a time,
+ * and stream the result to a score file. Each stripe is computed by the packed GEMM
+ * against a transposed copy of the matrix.
+ *
+ * @param matrix The row-wise N x M matrix of normalized document vectors.
+ * @param rows The number of rows in the matrix.
+ * @param cols The number of columns in the matrix.
+ * @param path The path of the score file.
+ * @param config The memory budget and output format.
+ * @param stats Receives the stripe size and the amount written.
+ * @return False if the file could not be written.
+ */
+bool streamDenseSimilarity(const std::vector<float>& matrix, size_t rows, size_t cols,
+                           const std::string& path, const StreamConfig& config, StreamStats& stats);
+
+/**
+ * Compute matrix x transpose(matrix) for a sparse matrix, one stripe at a time,
+ * and stream the result to a score file.
+ *
+ * @param matrix The N x M sparse matrix of normalized document vectors.
+ * @param postings The transpose of the matrix.
+ * @param path The path of the score file.
+ * @param config The memory budget and output format.
+ * @param stats Receives the stripe size and the amount written.
+ * @return False if the file could not be written.
+ */
+bool streamSparseSimilarity(const CsrView& matrix, const CsrView& postings,
+                            const std::string& path, const StreamConfig& config, StreamStats& stats);
+
+/**
+ * Write the top-k lists of every document to a score file in the Neighbors format.
+ *
+ * @param neighbors The row-wise rows x k list of neighbours, as returned by topKSimilar().
+ * @param rows The number of documents.
+ * @param k The number of neighbours per document.
+ * @param path The path of the score file.
+ * @return False if the file could not be written.
+ */
+bool writeNeighborFile(const std::vector<Neighbor>& neighbors, size_t rows, size_t k, const std::string& path);
+
+/**
+ * Write a list of pairs to a score file in the Pairs format.
+ *
+ * @param pairs The pairs i < j, in row order.
+ * @param rows The number of documents.
+ * @param threshold The smallest score the pairs were selected by.
+ * @param path The path of the score file.
+ * @return False if the file could not be written.
+ */
+bool writePairFile(const std::vector<ScorePair>& pairs, size_t rows, float threshold, const std::string& path);
@@ -7,8 +7,12 @@
  *      Implementation of string tokenization functions.
  *****************************************************************************/
 
-#include <fstream>
+#include <algorithm>
+#include <cstring>  // memchr
+#include <memory>
+#include <omp.h>
 
+#include "mapped_file.h"
 #include "tokenize.h"
 
 
@@ -24,6 +28,27 @@ static void lowercase(std::string& orig)
     }
 }
 
+/**
+ * Split text into lines without copying, as repeated calls to std::getline would.
+ *
+ * @param text The text to split.
+ * @param max_count The maximum number of lines to return. Zero returns all lines.
+ * @return Views of each line, excluding the newline characters.
+ */
+std::vector<std::string_view> splitLines(std::string_view text, size_t max_count)
+{
+    std::vector<std::string_view> lines;
+    size_t pos = 0;
+    while (pos < text.length() && (max_count == 0 || lines.size() < max_count))
+    {
+        const void* nl = std::memchr(text.data() + pos, '\n', text.length() - pos);
+        size_t end = nl ? static_cast<const char*>(nl) - text.data() : text.length();
+        lines.push_back(text.substr(pos, end - pos));
+        pos = end + 1;
+    }
+    return lines;
+}
+
 /**
  * Parse the string into individual tokens and keep count of the number
  * of times each token occurs.
@@ -71,19 +96,22 @@ std::unordered_map<std::string, unsigned int>
  *
  * @param path The path of the file to read.
  * @param ngram_len The length of ngram tokens that will be produced.
- * @param max_count The maximum number of records to process.
+ * @param max_count The maximum number of records to process. Zero processes all records.
  * @param ignorecase If true, ignore case sensitivity.
  * @return A vector with a map of tokens and their counts for each document.
  */
 std::vector<std::unordered_map<std::string, unsigned int>>
         tokenizeFile(const std::string& path, unsigned short ngram_len, unsigned int max_count, bool ignorecase)
 {
-    std::vector<std::unordered_map<std::string, unsigned int>> doc_freq_maps;
-    std::ifstream fs(path);
-    std::string line;
-    int i = 0;
-    while (std::getline(fs, line) && i++ < max_count) {
-        doc_freq_maps.push_back(tokenize(line, ngram_len, ignorecase));
+    MappedFile file(path);
+    const std::vector<std::string_view> lines = splitLines(file.view(), max_count);
+
+    // Each document is independent, so the output can be filled in place by any thread
+    std::vector<std::unordered_map<std::string, unsigned int>> doc_freq_maps(lines.size());
+
+    #pragma omp parallel for schedule(dynamic, 64)
+    for (size_t i = 0; i < lines.size(); ++i) {
+        doc_freq_maps[i] = tokenize(std::string(lines[i]), ngram_len, ignorecase);
     }
     return doc_freq_maps;
 }
@@ -103,3 +131,401 @@ std::set<std::string> extractUniqueKeys(const std::vector<std::unordered_map<std
     }
     return unique;
 }
+
+/**
+ * Convert a list of token IDs into a sorted list of distinct IDs and their counts.
+ *
+ * @param ids The token IDs in order of appearance. Sorted in-place.
+ * @return The distinct token IDs and the number of times each appears.
+ */
+static TokenCounts countTokenIds(std::vector<uint32_t>& ids)
+{
+    std::sort(ids.begin(), ids.end());
+
+    TokenCounts counts;
+    for (size_t i = 0; i < ids.size(); ++i)
+    {
+        if (counts.empty() || counts.back().first != ids[i]) {
+            counts.emplace_back(ids[i], 1);
+        } else {
+            counts.back().second += 1;
+        }
+    }
+    return counts;
+}
+
+/**
+ * Build a table mapping each byte value to itself, or to its lowercase form.
+ *
+ * @param ignorecase If true, map uppercase characters to lowercase.
+ * @return The 256-entry table.
+ */
+static std::vector<unsigned char> makeFoldTable(bool ignorecase)
+{
+    std::vector<unsigned char> fold(256);
+    for (int c = 0; c < 256; ++c) {
+        fold[c] = static_cast<unsigned char>(ignorecase ? std::tolower(c) : c);
+    }
+    return fold;
+}
+
+/**
+ * @param ngram_len The length of each ngram, from 1 to TokenDictionary::max_packed_len.
+ * @param ignorecase If true, ignore case sensitivity.
+ * @param trailing How to handle the truncated ngrams at the end of each text.
+ */
+NgramCounter::NgramCounter(size_t ngram_len, bool ignorecase, TrailingNgrams trailing)
+    : ngram_len(ngram_len),
+      mask(ngram_len >= 8 ? ~0ULL : (1ULL << (8 * ngram_len)) - 1),
+      use_histogram(ngram_len <= 2),
+      ignorecase(ignorecase),
+      trailing(trailing)
+{
+    static const std::vector<unsigned char> fold_identity = makeFoldTable(false);
+    static const std::vector<unsigned char> fold_lower = makeFoldTable(true);
+    fold = ignorecase ? fold_lower.data() : fold_identity.data();
+
+    if (use_histogram) {
+        histogram.assign(1 << 16, 0);
+    } else {
+        table.assign(1024, Slot{0, 0});
+    }
+}
+
+/**
+ * Add the ngrams of the text to the counts.
+ * @param text The text to be parsed.
+ */
+void NgramCounter::count(std::string_view text)
+{
+    const size_t len = text.length();
+    const size_t warmup = std::min(len, ngram_len - 1);
+
+    // Fill the window with the characters of the first ngram
+    uint64_t key = 0;
+    size_t i = 0;
+    for (; i < warmup; ++i) {
+        key = (key << 8) | fold[static_cast<unsigned char>(text[i])];
+    }
+
+    // Each further character completes the ngram starting (ngram_len - 1) characters earlier
+    if (use_histogram)
+    {
+        for (; i < len; ++i)
+        {
+            key = ((key << 8) | fold[static_cast<unsigned char>(text[i])]) & mask;
+            if (histogram[key]++ == 0) {
+                touched.push_back(static_cast<uint32_t>(key));
+            }
+        }
+    }
+    else
+    {
+        for (; i < len; ++i)
+        {
+            key = ((key << 8) | fold[static_cast<unsigned char>(text[i])]) & mask;
+            addToTable(key);
+        }
+    }
+
+    // The ngrams starting in the last (ngram_len - 1) characters are the suffixes of the final window
+    if (trailing == TrailingNgrams::Keep)
+    {
+        for (size_t t = warmup; t > 0; --t) {
+            add(key & ((1ULL << (8 * t)) - 1));
+        }
+    }
+}
+
+/** Reset all counts to zero. */
+void NgramCounter::clear()
+{
+    if (use_histogram) {
+        for (uint32_t slot: touched) {
+            histogram[slot] = 0;
+        }
+    } else {
+        for (uint32_t slot: touched) {
+            table[slot] = Slot{0, 0};
+        }
+    }
+    touched.clear();
+}
+
+void NgramCounter::add(uint64_t key)
+{
+    if (use_histogram) {
+        if (histogram[key]++ == 0) {
+            touched.push_back(static_cast<uint32_t>(key));
+        }
+    } else {
+        addToTable(key);
+    }
+}
+
+void NgramCounter::addToTable(uint64_t key)
+{
+    // Linear probing from a multiplicative hash of the key
+    const size_t slot_mask = table.size() - 1;
+    size_t slot = (key * 0x9E3779B97F4A7C15ULL) >> 32 & slot_mask;
+    while (table[slot].count != 0 && table[slot].key != key) {
+        slot = (slot + 1) & slot_mask;
+    }
+
+    if (table[slot].count++ == 0)
+    {
+        table[slot].key = key;
+        touched.push_back(static_cast<uint32_t>(slot));
+
+        // Keep the load factor at or below one half
+        if (touched.size() * 2 > table.size()) {
+            growTable();
+        }
+    }
+}
+
+void NgramCounter::growTable()
+{
+    std::vector<Slot> old_table(table.size() * 2, Slot{0, 0});
+    old_table.swap(table);
+    std::vector<uint32_t> old_touched;
+    old_touched.swap(touched);
+    touched.reserve(old_touched.size());
+
+    // Reinsert in order of first appearance so the visiting order is preserved
+    const size_t slot_mask = table.size() - 1;
+    for (uint32_t old_slot: old_touched)
+    {
+        const Slot& entry = old_table[old_slot];
+        size_t slot = (entry.key * 0x9E3779B97F4A7C15ULL) >> 32 & slot_mask;
+        while (table[slot].count != 0) {
+            slot = (slot + 1) & slot_mask;
+        }
+        table[slot] = entry;
+        touched.push_back(static_cast<uint32_t>(slot));
+    }
+}
+
+/**
+ * Get a counter owned by the calling thread, so its tables are allocated once per thread.
+ *
+ * @param ngram_len The length of each ngram.
+ * @param ignorecase If true, ignore case sensitivity.
+ * @param trailing How to handle the truncated ngrams at the end of each text.
+ * @return An empty counter with the given configuration.
+ */
+static NgramCounter& threadCounter(size_t ngram_len, bool ignorecase, TrailingNgrams trailing)
+{
+    thread_local std::unique_ptr<NgramCounter> counter;
+    if (!counter || !counter->configuredAs(ngram_len, ignorecase, trailing)) {
+        counter = std::make_unique<NgramCounter>(ngram_len, ignorecase, trailing);
+    }
+    return *counter;
+}
+
+/**
+ * Parse the string into overlapping ngram tokens, as tokenize() does, and count
+ * each token by the ID assigned to it in the dictionary.
+ *
+ * @param line The string to be parsed.
+ * @param ngram_len The length of each token.
+ * @param ignorecase If true, ignore case sensitivity.
+ * @param dictionary The dictionary which assigns token IDs. New tokens are added to it.
+ * @param trailing How to handle the truncated ngrams at the end of the line.
+ * @return The token IDs and their counts for this document, sorted by ID.
+ */
+TokenCounts tokenize(std::string_view line, size_t ngram_len, bool ignorecase, TokenDictionary& dictionary,
+                     TrailingNgrams trailing)
+{
+    TokenCounts counts;
+
+    if (dictionary.packed())
+    {
+        // Count the packed ngrams first, so the dictionary is consulted once per distinct ngram
+        NgramCounter& counter = threadCounter(ngram_len, ignorecase, trailing);
+        counter.count(line);
+        counts.reserve(counter.size());
+        counter.forEach([&](uint64_t key, unsigned int count) {
+            counts.emplace_back(dictionary.internPacked(key), count);
+        });
+        counter.clear();
+        std::sort(counts.begin(), counts.end());
+        return counts;
+    }
+
+    // Tokens are too long to pack. Reuse a single buffer for each token.
+    std::vector<uint32_t> ids;
+    ids.reserve(line.length());
+    std::string token;
+    size_t last = line.length();
+    if (trailing == TrailingNgrams::Drop) {
+        last = line.length() >= ngram_len ? line.length() - ngram_len + 1 : 0;
+    }
+    for (size_t pos = 0; pos < last; ++pos)
+    {
+        token.assign(line.substr(pos, ngram_len));
+        if (ignorecase) {
+            lowercase(token);
+        }
+        ids.push_back(dictionary.intern(token));
+    }
+    return countTokenIds(ids);
+}
+
+/**
+ * Tokenize one document by token ID, as tokenize() does, writing its counts to the
+ * arena of a document set rather than to a vector of its own.
+ *
+ * @param docs The document set receiving the counts.
+ * @param doc The index of the document.
+ * @param arena The arena of the document set to allocate from.
+ * @param line The string to be parsed.
+ * @param ngram_len The length of each token.
+ * @param ignorecase If true, ignore case sensitivity.
+ * @param dictionary The dictionary which assigns token IDs. New tokens are added to it.
+ * @param trailing How to handle the truncated ngrams at the end of the line.
+ */
+static void tokenizeInto(DocumentTokenCounts& docs, size_t doc, size_t arena, std::string_view line,
+                         size_t ngram_len, bool ignorecase, TokenDictionary& dictionary, TrailingNgrams trailing)
+{
+    if (!dictionary.packed())
+    {
+        const TokenCounts counts = tokenize(line, ngram_len, ignorecase, dictionary, trailing);
+        std::copy(counts.begin(), counts.end(), docs.allocate(doc, arena, counts.size()).begin());
+        return;
+    }
+
+    // The number of distinct ngrams is known once counted, so the allocation is exact
+    NgramCounter& counter = threadCounter(ngram_len, ignorecase, trailing);
+    counter.count(line);
+    TokenCountSpan& counts = docs.allocate(doc, arena, counter.size());
+    TokenCount* out = counts.begin();
+    counter.forEach([&](uint64_t key, unsigned int count) {
+        *out++ = TokenCount(dictionary.internPacked(key), count);
+    });
+    counter.clear();
+    std::sort(counts.begin(), counts.end());
+}
+
+/**
+ * Perform tokenization by token ID on a set of lines, one document per line.
+ *
+ * @param lines The text of each document. The views must point into one contiguous buffer, in order.
+ * @param ngram_len The length of ngram tokens that will be produced.
+ * @param ignorecase If true, ignore case sensitivity.
+ * @param dictionary The dictionary which assigns token IDs. New tokens are added to it.
+ * @param trailing How to handle the truncated ngrams at the end of each line.
+ * @return The token IDs and their counts for each document.
+ */
+DocumentTokenCounts tokenizeLines(const std::vector<std::string_view>& lines, unsigned short ngram_len,
+                                  bool ignorecase, TokenDictionary& dictionary, TrailingNgrams trailing)
+{
+    if (lines.empty()) {
+        return DocumentTokenCounts();
+    }
+
+    // Split the lines into contiguous chunks of roughly equal byte size.
+    // Several chunks per thread let the dynamic schedule absorb uneven lines.
+    const char* base = lines.front().data();
+    const size_t chunk_count = std::min(lines.size(), static_cast<size_t>(omp_get_max_threads()) * 4);
+    const size_t total_bytes = static_cast<size_t>(lines.back().data() + lines.back().size() - base);
+    std::vector<size_t> chunk_start(chunk_count + 1, lines.size());
+    chunk_start[0] = 0;
+    size_t line = 0;
+    for (size_t c = 1; c < chunk_count; ++c)
+    {
+        const size_t target = total_bytes / chunk_count * c;
+        while (line < lines.size() && static_cast<size_t>(lines[line].data() - base) < target) {
+            ++line;
+        }
+        chunk_start[c] = line;
+    }
+
+    // One arena per chunk, so each thread allocates without contention
+    DocumentTokenCounts docs(lines.size(), chunk_count);
+
+    // Tokenize each chunk against its own dictionary, so no thread shares mutable state
+    std::vector<TokenDictionary> local_dicts(chunk_count, TokenDictionary(ngram_len));
+
+    #pragma omp parallel for schedule(dynamic, 1)
+    for (size_t c = 0; c < chunk_count; ++c)
+    {
+        for (size_t i = chunk_start[c]; i < chunk_start[c + 1]; ++i) {
+            tokenizeInto(docs, i, c, lines[i], ngram_len, ignorecase, local_dicts[c], trailing);
+        }
+    }
+
+    // Merge the chunk dictionaries in document order. Each chunk assigns IDs by first
+    // appearance, so the global IDs are the same as those of a sequential pass.
+    std::vector<std::vector<uint32_t>> global_ids(chunk_count);
+    for (size_t c = 0; c < chunk_count; ++c)
+    {
+        const TokenDictionary& local = local_dicts[c];
+        global_ids[c].resize(local.size());
+        for (uint32_t id = 0; id < local.size(); ++id) {
+            global_ids[c][id] = local.packed() ? dictionary.internPacked(local.packedKey(id))
+                                               : dictionary.intern(local.token(id));
+        }
+    }
+
+    // Translate the chunk-local IDs of every document to the global IDs
+    #pragma omp parallel for schedule(dynamic, 1)
+    for (size_t c = 0; c < chunk_count; ++c)
+    {
+        for (size_t i = chunk_start[c]; i < chunk_start[c + 1]; ++i)
+        {
+            for (auto& tc: docs[i]) {
+                tc.first = global_ids[c][tc.first];
+            }
+            std::sort(docs[i].begin(), docs[i].end());
+        }
+    }
+    return docs;
+}
+
+/**
+ * Perform tokenization by token ID on all text records in the given file.
+ *
+ * @param path The path of the file to read.
+ * @param ngram_len The length of ngram tokens that will be produced.
+ * @param max_count The maximum number of records to process. Zero processes all records.
+ * @param ignorecase If true, ignore case sensitivity.
+ * @param dictionary The dictionary which assigns token IDs. New tokens are added to it.
+ * @param trailing How to handle the truncated ngrams at the end of each line.
+ * @return The token IDs and their counts for each document.
+ */
+DocumentTokenCounts tokenizeFile(const std::string& path, unsigned short ngram_len, unsigned int max_count,
+                                 bool ignorecase, TokenDictionary& dictionary, TrailingNgrams trailing)
+{
+    MappedFile file(path);
+    return tokenizeLines(splitLines(file.view(), max_count), ngram_len, ignorecase, dictionary, trailing);
+}
+
+/**
+ * Get the unique token IDs from the token counts of a set of documents.
+ * @param docs The token counts of each document.
+ * @return A sorted vector of all unique token IDs across the documents.
+ */
+std::vector<uint32_t> extractUniqueKeys(const DocumentTokenCounts& docs)
+{
+    // IDs are dense, so a flag per ID replaces the ordered set
+    std::vector<bool> seen;
+    for (const auto& doc: docs)
+    {
+        for (const auto& tc: doc)
+        {
+            if (tc.first >= seen.size()) {
+                seen.resize(tc.first + 1, false);
+            }
+            seen[tc.first] = true;
+        }
+    }
+
+    std::vector<uint32_t> unique;
+    for (size_t id = 0; id < seen.size(); ++id) {
+        if (seen[id]) {
+            unique.push_back(static_cast<uint32_t>(id));
+        }
+    }
+    return unique;
+}
@@ -9,11 +9,118 @@
 
 #pragma once
 
+#include <cstdint>
 #include <set>
 #include <string>
+#include <string_view>
 #include <unordered_map>
 #include <vector>
 
+#include "dictionary.h"
+
+
+/**
+ * Policy for the ngrams which start within (ngram_len - 1) characters of the end of a line.
+ */
+enum class TrailingNgrams
+{
+    Keep,   // Emit the truncated ngrams, e.g. "d" at the end of "world" (the behaviour of tokenize())
+    Drop    // Emit only full-length ngrams, matching the scikit-learn char analyzer
+};
+
+
+/**
+ * Counts the packed ngrams of a text without allocating per character.
+ *
+ * A rolling 64-bit window holds the last ngram_len characters, so each character
+ * is read once. Ngrams of up to 2 characters are counted in a flat 65,536-entry
+ * histogram indexed by the packed key. Longer ngrams (up to 8 characters) are
+ * counted in an open-addressing hash table. Keys are packed as by
+ * TokenDictionary::pack(), and truncated trailing ngrams pack to the key of their
+ * shorter text.
+ *
+ * The counter is reusable: clear() resets it in time proportional to the number
+ * of distinct ngrams counted.
+ */
+class NgramCounter
+{
+public:
+    /**
+     * @param ngram_len The length of each ngram, from 1 to TokenDictionary::max_packed_len.
+     * @param ignorecase If true, ignore case sensitivity.
+     * @param trailing How to handle the truncated ngrams at the end of each text.
+     */
+    NgramCounter(size_t ngram_len, bool ignorecase, TrailingNgrams trailing = TrailingNgrams::Keep);
+
+    /**
+     * Add the ngrams of the text to the counts.
+     * @param text The text to be parsed.
+     */
+    void count(std::string_view text);
+
+    /** Reset all counts to zero. */
+    void clear();
+
+    /** @return True if the counter was constructed with the given parameters. */
+    bool configuredAs(size_t ngram_len, bool ignorecase, TrailingNgrams trailing) const
+    {
+        return this->ngram_len == ngram_len && this->ignorecase == ignorecase && this->trailing == trailing;
+    }
+
+    /** @return The number of distinct ngrams counted. */
+    size_t size() const { return touched.size(); }
+
+    /**
+     * Visit each distinct ngram in order of first appearance.
+     * @param visit A callable taking (uint64_t key, unsigned int count).
+     */
+    template <typename Visitor>
+    void forEach(Visitor visit) const
+    {
+        if (use_histogram) {
+            for (uint32_t slot: touched) {
+                visit(static_cast<uint64_t>(slot), histogram[slot]);
+            }
+        } else {
+            for (uint32_t slot: touched) {
+                visit(table[slot].key, table[slot].count);
+            }
+        }
+    }
+
+private:
+    struct Slot
+    {
+        uint64_t key;
+        unsigned int count;   // zero marks an empty slot
+    };
+
+    void add(uint64_t key);
+    void addToTable(uint64_t key);
+    void growTable();
+
+    size_t ngram_len;
+    uint64_t mask;
+    bool use_histogram;
+    bool ignorecase;
+    TrailingNgrams trailing;
+    const unsigned char* fold;   // maps each byte to itself or its lowercase form
+
+    std::vector<unsigned int> histogram;
+    std::vector<Slot> table;
+    std::vector<uint32_t> touched;   // histogram or table slots in order of first appearance
+};
+
+
+/**
+ * Split text into lines without copying, as repeated calls to std::getline would.
+ *
+ * @param text The text to split.
+ * @param max_count The maximum number of lines to return. Zero returns all lines.
+ * @return Views of each line, excluding the newline characters.
+ */
+std::vector<std::string_view> splitLines(std::string_view text, size_t max_count);
+
 
 /**
  * Parse the string into individual tokens and keep count of the number
@@ -35,9 +142,11 @@ std::unordered_map<std::string, unsigned int>
 /**
  * Perform tokenization on all text records in the given file.
  *
+ * The file is memory mapped and its lines are tokenized in parallel.
+ *
  * @param path The path of the file to read.
  * @param ngram_len The length of ngram tokens that will be produced.
- * @param max_count The maximum number of records to process.
+ * @param max_count The maximum number of records to process. Zero processes all records.
  * @param ignorecase If true, ignore case sensitivity.
  * @return A vector with a map of tokens and their counts for each document.
  */
@@ -51,3 +160,63 @@ std::vector<std::unordered_map<std::string, unsigned int>>
  * @return A set of all unique keys across the maps.
  */
 std::set<std::string> extractUniqueKeys(const std::vector<std::unordered_map<std::string, unsigned int>>& maps);
+
+
+/**
+ * Parse the string into overlapping ngram tokens, as tokenize() does, and count
+ * each token by the ID assigned to it in the dictionary.
+ *
+ * @param line The string to be parsed.
+ * @param ngram_len The length of each token.
+ * @param ignorecase If true, ignore case sensitivity.
+ * @param dictionary The dictionary which assigns token IDs. New tokens are added to it.
+ * @param trailing How to handle the truncated ngrams at the end of the line.
+ * @return The token IDs and their counts for this document, sorted by ID.
+ */
+TokenCounts tokenize(std::string_view line, size_t ngram_len, bool ignorecase, TokenDictionary& dictionary,
+                     TrailingNgrams trailing = TrailingNgrams::Keep);
+
+
+/**
+ * Perform tokenization by token ID on a set of lines, one document per line.
+ *
+ * The lines are split into chunks which are tokenized in parallel. Documents are
+ * returned in line order, and token IDs are assigned exactly as a sequential pass
+ * would assign them. The counts of each chunk are allocated from an arena of its own.
+ *
+ * @param lines The text of each document. The views must point into one contiguous buffer, in order.
+ * @param ngram_len The length of ngram tokens that will be produced.
+ * @param ignorecase If true, ignore case sensitivity.
+ * @param dictionary The dictionary which assigns token IDs. New tokens are added to it.
+ * @param trailing How to handle the truncated ngrams at the end of each line.
+ * @return The token IDs and their counts for each document.
+ */
+DocumentTokenCounts tokenizeLines(const std::vector<std::string_view>& lines, unsigned short ngram_len,
+                                  bool ignorecase, TokenDictionary& dictionary,
+                                  TrailingNgrams trailing = TrailingNgrams::Keep);
+
+
+/**
+ * Perform tokenization by token ID on all text records in the given file.
+ *
+ * The file is memory mapped and its lines are tokenized with tokenizeLines().
+ *
+ * @param path The path of the file to read.
+ * @param ngram_len The length of ngram tokens that will be produced.
+ * @param max_count The maximum number of records to process. Zero processes all records.
+ * @param ignorecase If true, ignore case sensitivity.
+ * @param dictionary The dictionary which assigns token IDs. New tokens are added to it.
+ * @param trailing How to handle the truncated ngrams at the end of each line.
+ * @return The token IDs and their counts for each document.
+ */
+DocumentTokenCounts tokenizeFile(const std::string& path, unsigned short ngram_len, unsigned int max_count,
+                                 bool ignorecase, TokenDictionary& dictionary,
+                                 TrailingNgrams trailing = TrailingNgrams::Keep);
+
+
+/**
+ * Get the unique token IDs from the token counts of a set of documents.
+ * @param docs The token counts of each document.
+ * @return A sorted vector of all unique token IDs across the documents.
+ */
+std::vector<uint32_t> extractUniqueKeys(const DocumentTokenCounts& docs);
@@ -0,0 +1,177 @@
+/******************************************************************************
+ * Filename: topk.cpp
+ * Author: Zachary Colbert
+ * Contact: zcolbert@sfsu.edu
+ *
+ * Description: Implementation of the top-k nearest neighbour search.
+ *****************************************************************************/
+
+#include "topk.h"
+
+#include <algorithm>
+#include <iomanip>
+#include <iostream>
+
+#include "linear.h"
+
+
+/**
+ * Order neighbours so the best candidate compares least, which keeps the
+ * worst retained candidate at the front of a std heap.
+ */
+static bool betterNeighbor(const Neighbor& lhs, const Neighbor& rhs)
+{
+    return lhs.score > rhs.score || (lhs.score == rhs.score && lhs.doc < rhs.doc);
+}
+
+/**
+ * Select the k highest scores of a row.
+ *
+ * @param scores The scores of the row.
+ * @param n The number of scores.
+ * @param k The number of neighbours to keep.
+ * @param exclude An index never reported, or n to keep every index.
+ * @param out The k neighbours, sorted by descending score. Entries beyond the
+ *            number of candidates are left unchanged.
+ */
+void selectTopK(const float* scores, size_t n, size_t k, size_t exclude, Neighbor* out)
+{
+    // Min-heap of the best k candidates seen so far, worst at the front
+    std::vector<Neighbor> heap;
+    heap.reserve(k);
+    for (size_t j = 0; j < n; ++j)
+    {
+        if (j == exclude) {
+            continue;
+        }
+        Neighbor candidate{static_cast<uint32_t>(j), scores[j]};
+        if (heap.size() < k) {
+            heap.push_back(candidate);
+            std::push_heap(heap.begin(), heap.end(), betterNeighbor);
+        }
+        else if (betterNeighbor(candidate, heap.front())) {
+            std::pop_heap(heap.begin(), heap.end(), betterNeighbor);
+            heap.back() = candidate;
+            std::push_heap(heap.begin(), heap.end(), betterNeighbor);
+        }
+    }
+
+    std::sort_heap(heap.begin(), heap.end(), betterNeighbor);
+    std::copy(heap.begin(), heap.end(), out);
+}
+
+/**
+ * Select the k best of a list of candidates.
+ *
+ * @param candidates The candidates, in any order. Reordered by the selection.
+ * @param k The number of neighbours to keep.
+ * @param out The k neighbours, sorted by descending score. Entries beyond the
+ *            number of candidates are left unchanged.
+ */
+void selectTopK(std::vector<Neighbor>& candidates, size_t k, Neighbor* out)
+{
+    const auto kth = candidates.begin() + static_cast<std::ptrdiff_t>(std::min(k, candidates.size()));
+    std::nth_element(candidates.begin(), kth, candidates.end(), betterNeighbor);
+    std::sort(candidates.begin(), kth, betterNeighbor);
+    std::copy(candidates.begin(), kth, out);
+}
+
+/**
+ * Merge candidates into a row of k neighbours, keeping the k best.
+ *
+ * @param row The k neighbours of the row, sorted by descending score and padded with
+ *            {no_neighbor, 0}. Receives the merged list, in the same form.
+ * @param k The number of neighbours per row.
+ * @param candidates The new candidates, in any order. Reordered by the merge.
+ */
+void mergeNeighbors(Neighbor* row, size_t k, std::vector<Neighbor>& candidates)
+{
+    std::sort(candidates.begin(), candidates.end(), betterNeighbor);
+
+    // Both lists are sorted, so the k best are found by one merge. Padding ranks below every candidate.
+    const size_t filled = static_cast<size_t>(std::find_if(row, row + k, [](const Neighbor& nb) {
+        return nb.doc == no_neighbor;
+    }) - row);
+    std::vector<Neighbor> merged(k, Neighbor{no_neighbor, 0.0f});
+    size_t a = 0;
+    size_t b = 0;
+    for (size_t j = 0; j < k && (a < filled || b < candidates.size()); ++j)
+    {
+        if (b == candidates.size() || (a < filled && betterNeighbor(row[a], candidates[b]))) {
+            merged[j] = row[a++];
+        } else {
+            merged[j] = candidates[b++];
+        }
+    }
+    std::copy(merged.begin(), merged.end(), row);
+}
+
+/**
+ * Find the k rows most similar to each row of a row-wise matrix, by dot product.
+ *
+ * The similarity is computed one stripe of tile_rows rows at a time with the tiled
+ * multiply kernel, and a bounded heap per row keeps the best candidates. Peak memory
+ * is O(N * k + tile_rows * N) rather than O(N^2).
+ *
+ * @param matrix The row-wise N x M matrix of (normalized) document vectors.
+ * @param n The number of rows in the matrix.
+ * @param m The number of columns in the matrix.
+ * @param k The number of neighbours to keep for each row.
+ * @param tile_rows The number of rows whose similarities are computed at once.
+ * @param exclude_self If true, a row is never reported as its own neighbour.
+ * @return A row-wise N x k list of neighbours, each row sorted by descending score.
+ *         Rows with fewer than k candidates are padded with {no_neighbor, 0}.
+ */
+std::vector<Neighbor> topKSimilar(const std::vector<float>& matrix, size_t n, size_t m, size_t k,
+                                  size_t tile_rows, bool exclude_self)
+{
+    std::vector<Neighbor> neighbors(n * k, Neighbor{no_neighbor, 0.0f});
+    if (k == 0 || n == 0) {
+        return neighbors;
+    }
+    tile_rows = std::max<size_t>(1, std::min(tile_rows, n));
+
+    // The only N-wide buffer: the similarities of one stripe of rows
+    std::vector<float> stripe(tile_rows * n);
+
+    for (size_t first = 0; first < n; first += tile_rows)
+    {
+        const size_t count = std::min(tile_rows, n - first);
+        std::fill(stripe.begin(), stripe.begin() + count * n, 0.0f);
+        matrixMultiplyTransposed(matrix, first, count, matrix, n, m, stripe);
+
+        #pragma omp parallel for schedule(dynamic, 4)
+        for (size_t r = 0; r < count; ++r)
+        {
+            const size_t row = first + r;
+            const float* scores = &stripe[r * n];
+
+            selectTopK(scores, n, k, exclude_self ? row : n, &neighbors[row * k]);
+        }
+    }
+    return neighbors;
+}
+
+/**
+ * Print the neighbours of each row as (doc, score) pairs.
+ *
+ * @param neighbors The row-wise N x k list of neighbours.
+ * @param n The number of rows.
+ * @param k The number of neighbours per row.
+ */
+void printNeighbors(const std::vector<Neighbor>& neighbors, size_t n, size_t k)
+{
+    std::cout << std::setprecision(2) << std::fixed;
+    for (size_t i = 0; i < n; ++i)
+    {
+        std::cout << std::right << std::setw(6) << i << ':';
+        for (size_t j = 0; j < k; ++j)
+        {
+            const Neighbor& nb = neighbors[i * k + j];
+            if (nb.doc != no_neighbor) {
+                std::cout << " (" << nb.doc << ", " << nb.score << ')';
+            }
+        }
+        std::cout << std::endl;
+    }
+}
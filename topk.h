@@ -0,0 +1,85 @@
+/******************************************************************************
+ * Filename: topk.h
+ * Author: Zachary Colbert
+ * Contact: zcolbert@sfsu.edu
+ *
+ * Description: Interface of the top-k nearest neighbour search, which finds
+ *              the most similar documents without materializing the full
+ *              similarity matrix.
+ *****************************************************************************/
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+
+/** A neighbouring document and its similarity score. */
+struct Neighbor
+{
+    uint32_t doc;
+    float score;
+};
+
+/** Document ID of the padding entries in rows with fewer than k neighbours. */
+constexpr uint32_t no_neighbor = UINT32_MAX;
+
+/**
+ * Select the k highest scores of a row.
+ *
+ * @param scores The scores of the row.
+ * @param n The number of scores.
+ * @param k The number of neighbours to keep.
+ * @param exclude An index never reported, or n to keep every index.
+ * @param out The k neighbours, sorted by descending score. Entries beyond the
+ *            number of candidates are left unchanged.
+ */
+void selectTopK(const float* scores, size_t n, size_t k, size_t exclude, Neighbor* out);
+
+/**
+ * Select the k best of a list of candidates.
+ *
+ * @param candidates The candidates, in any order. Reordered by the selection.
+ * @param k The number of neighbours to keep.
+ * @param out The k neighbours, sorted by descending score. Entries beyond the
+ *            number of candidates are left unchanged.
+ */
+void selectTopK(std::vector<Neighbor>& candidates, size_t k, Neighbor* out);
+
+/**
+ * Merge candidates into a row of k neighbours, keeping the k best.
+ *
+ * @param row The k neighbours of the row, sorted by descending score and padded with
+ *            {no_neighbor, 0}. Receives the merged list, in the same form.
+ * @param k The number of neighbours per row.
+ * @param candidates The new candidates, in any order. Reordered by the merge.
+ */
+void mergeNeighbors(Neighbor* row, size_t k, std::vector<Neighbor>& candidates);
+
+/**
+ * Find the k rows most similar to each row of a row-wise matrix, by dot product.
+ *
+ * The similarity is computed one stripe of tile_rows rows at a time with the tiled
+ * multiply kernel, and a bounded heap per row keeps the best candidates. Peak memory
+ * is O(N * k + tile_rows * N) rather than O(N^2).
+ *
+ * @param matrix The row-wise N x M matrix of (normalized) document vectors.
+ * @param n The number of rows in the matrix.
+ * @param m The number of columns in the matrix.
+ * @param k The number of neighbours to keep for each row.
+ * @param tile_rows The number of rows whose similarities are computed at once.
+ * @param exclude_self If true, a row is never reported as its own neighbour.
+ * @return A row-wise N x k list of neighbours, each row sorted by descending score.
+ *         Rows with fewer than k candidates are padded with {no_neighbor, 0}.
+ */
+std::vector<Neighbor> topKSimilar(const std::vector<float>& matrix, size_t n, size_t m, size_t k,
+                                  size_t tile_rows, bool exclude_self = true);
+
+/**
+ * Print the neighbours of each row as (doc, score) pairs.
+ *
+ * @param neighbors The row-wise N x k list of neighbours.
+ * @param n The number of rows.
+ * @param k The number of neighbours per row.
+ */
+void printNeighbors(const std::vector<Neighbor>& neighbors, size_t n, size_t k);
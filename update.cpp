@@ -0,0 +1,424 @@
+/******************************************************************************
+ * Filename: update.cpp
+ * Author: Zachary Colbert
+ * Contact: zcolbert@sfsu.edu
+ *
+ * Description: Implementation of the incremental corpus update.
+ *****************************************************************************/
+
+#include "update.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>   // rename
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <unordered_map>
+
+#include "mapped_file.h"
+#include "stream.h"
+#include "tokenize.h"
+#include "topk.h"
+
+
+/** Pairs collected before each write of a merged Pairs file. */
+static constexpr size_t pair_chunk = 65536;
+
+/**
+ * Tokenize new documents and vectorize them against the vocabulary of an index,
+ * appending their unseen ngrams to the vocabulary in order of first appearance.
+ *
+ * @param index The index the documents will be added to.
+ * @param lines The text of each new document.
+ * @param ignorecase If true, ignore case sensitivity, as when the index was built.
+ * @return The new columns and the normalized vectors of the new documents.
+ */
+IndexAddition vectorizeAddition(const CorpusIndex& index, const std::vector<std::string_view>& lines, bool ignorecase)
+{
+    const size_t old_cols = index.cols();
+    const uint64_t* vocabulary = index.vocabulary();
+    std::unordered_map<uint64_t, uint32_t> columns;
+    columns.reserve(old_cols * 2);
+    for (size_t c = 0; c < old_cols; ++c) {
+        columns.emplace(vocabulary[c], static_cast<uint32_t>(c));
+    }
+
+    IndexAddition addition;
+    CsrMatrix& matrix = addition.matrix;
+    matrix.rows = lines.size();
+    matrix.row_ptr.reserve(lines.size() + 1);
+    matrix.row_ptr.push_back(0);
+
+    // New columns are numbered as a full rebuild would number them: after the existing ones,
+    // in the order their ngrams first appear in the new documents
+    NgramCounter counter(index.ngramLength(), ignorecase);
+    std::vector<std::pair<uint32_t, float>> row;
+    for (std::string_view line: lines)
+    {
+        counter.count(line);
+        counter.forEach([&](uint64_t key, unsigned int count) {
+            auto inserted = columns.emplace(key, static_cast<uint32_t>(old_cols + addition.vocabulary.size()));
+            if (inserted.second) {
+                addition.vocabulary.push_back(key);
+            }
+            row.emplace_back(inserted.first->second, static_cast<float>(count));
+        });
+        counter.clear();
+
+        std::sort(row.begin(), row.end());
+        for (const auto& element: row)
+        {
+            matrix.col_idx.push_back(element.first);
+            matrix.values.push_back(element.second);
+        }
+        matrix.row_ptr.push_back(matrix.values.size());
+        row.clear();
+    }
+    matrix.cols = old_cols + addition.vocabulary.size();
+
+    addition.norms = sparseRowNorms(matrix);
+    normalizeSparseMatrix(matrix);
+    return addition;
+}
+
+/**
+ * Score each new document against every document of the grown corpus.
+ *
+ * Each row of new scores is accumulated in a dense array of N + D scores, from the
+ * postings of the index for the existing documents and from the postings of the
+ * new documents for the new ones. Only new documents are ever scored, so the cost
+ * is O(D * N) however large N is.
+ *
+ * @param postings The postings of the index.
+ * @param addition The new documents.
+ * @param visit A callable taking (i, scores), called from the OpenMP threads once for
+ *              each new document i with its scores against the N + D documents.
+ */
+template <typename Visit>
+static void scoreAddition(const CsrView& postings, const IndexAddition& addition, Visit visit)
+{
+    const CsrMatrix& added = addition.matrix;
+    const CsrMatrix added_postings = transpose(added);
+    const size_t old_rows = postings.cols;
+    const size_t old_cols = postings.rows;
+    const size_t n = old_rows + added.rows;
+
+    #pragma omp parallel
+    {
+        std::vector<float> scores(n);
+
+        #pragma omp for schedule(dynamic, 4)
+        for (size_t i = 0; i < added.rows; ++i)
+        {
+            std::fill(scores.begin(), scores.end(), 0.0f);
+            for (size_t p = added.row_ptr[i]; p < added.row_ptr[i + 1]; ++p)
+            {
+                const uint32_t col = added.col_idx[p];
+                const float v = added.values[p];
+                if (col < old_cols)
+                {
+                    for (size_t q = postings.row_ptr[col]; q < postings.row_ptr[col + 1]; ++q) {
+                        scores[postings.col_idx[q]] += v * postings.values[q];
+                    }
+                }
+                for (size_t q = added_postings.row_ptr[col]; q < added_postings.row_ptr[col + 1]; ++q) {
+                    scores[old_rows + added_postings.col_idx[q]] += v * added_postings.values[q];
+                }
+            }
+            visit(i, scores);
+        }
+    }
+}
+
+/**
+ * Map a score file and validate its header.
+ *
+ * @param file The mapped score file.
+ * @param error Receives a description of why the file is invalid.
+ * @return The header, or nullptr if the file is not a complete score file.
+ */
+static const ScoreFileHeader* scoreFileHeader(const MappedFile& file, std::string& error)
+{
+    if (!file.isOpen() || file.size() < sizeof(ScoreFileHeader)
+        || std::memcmp(file.data(), score_magic, sizeof(score_magic)) != 0) {
+        error = "is not a score file";
+        return nullptr;
+    }
+    const auto* header = reinterpret_cast<const ScoreFileHeader*>(file.data());
+    if (header->version != score_version) {
+        error = "has score file version " + std::to_string(header->version);
+        return nullptr;
+    }
+
+    size_t record = sizeof(float);
+    if (header->format == ScoreFormat::Pairs) {
+        record = sizeof(ScorePair);
+    } else if (header->format == ScoreFormat::Neighbors) {
+        record = sizeof(Neighbor);
+    }
+    if (header->count > (file.size() - sizeof(ScoreFileHeader)) / record) {
+        error = "is truncated";
+        return nullptr;
+    }
+    return header;
+}
+
+/**
+ * Write a Pairs file holding the pairs of an earlier file and the new pairs, in row order.
+ *
+ * @param path The path of the merged file.
+ * @param old_header The header of the earlier file.
+ * @param old_pairs The pairs of the earlier file, in row order.
+ * @param added The new pairs, sorted by row and then column.
+ * @param rows The number of documents after the update.
+ * @param error Receives a description of why the merge failed.
+ * @return False if the earlier pairs are not in row order, or if the file could not be written.
+ */
+static bool writeMergedPairs(const std::string& path, const ScoreFileHeader& old_header, const ScorePair* old_pairs,
+                             const std::vector<ScorePair>& added, size_t rows, std::string& error)
+{
+    std::ofstream outfile(path, std::ios::binary | std::ios::trunc);
+    if (!outfile) {
+        error = "cannot be written";
+        return false;
+    }
+
+    ScoreFileHeader header = old_header;
+    header.rows = rows;
+    header.cols = rows;
+    header.count = old_header.count + added.size();
+    outfile.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+    // Within a row the new pairs follow the old, as their documents come last
+    std::vector<ScorePair> chunk;
+    chunk.reserve(pair_chunk);
+    size_t a = 0;
+    size_t b = 0;
+    while (a < old_header.count || b < added.size())
+    {
+        if (a < old_header.count && a > 0 && old_pairs[a].row < old_pairs[a - 1].row) {
+            error = "is not in row order, as files written by --pipeline are not";
+            return false;
+        }
+        if (b == added.size() || (a < old_header.count && old_pairs[a].row <= added[b].row)) {
+            chunk.push_back(old_pairs[a++]);
+        } else {
+            chunk.push_back(added[b++]);
+        }
+        if (chunk.size() == pair_chunk)
+        {
+            outfile.write(reinterpret_cast<const char*>(chunk.data()), static_cast<std::streamsize>(chunk.size() * sizeof(ScorePair)));
+            chunk.clear();
+        }
+    }
+    outfile.write(reinterpret_cast<const char*>(chunk.data()), static_cast<std::streamsize>(chunk.size() * sizeof(ScorePair)));
+    outfile.close();
+    if (!outfile) {
+        error = "cannot be written";
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Score the new documents and write the updated score file.
+ *
+ * @param path The path of the updated file.
+ * @param header The header of the earlier score file.
+ * @param records The records following the header of the earlier file.
+ * @param index The index before the update.
+ * @param addition The new documents.
+ * @param stats Receives the number of records added.
+ * @param error Receives a description of why the update failed.
+ * @return False if the file could not be written.
+ */
+static bool writeUpdatedScores(const std::string& path, const ScoreFileHeader& header, const char* records,
+                               const CorpusIndex& index, const IndexAddition& addition,
+                               UpdateStats& stats, std::string& error)
+{
+    const size_t old_rows = index.rows();
+    const size_t rows = old_rows + addition.matrix.rows;
+
+    // New pairs, or candidates for the lists of the existing documents, found by each new document
+    std::vector<std::vector<ScorePair>> found(addition.matrix.rows);
+
+    if (header.format == ScoreFormat::Pairs)
+    {
+        const float threshold = header.threshold;
+        scoreAddition(index.postings(), addition, [&](size_t i, const std::vector<float>& scores) {
+            const uint32_t doc = static_cast<uint32_t>(old_rows + i);
+            for (uint32_t j = 0; j < doc; ++j)
+            {
+                if (scores[j] >= threshold) {
+                    found[i].push_back({j, doc, scores[j]});
+                }
+            }
+        });
+
+        std::vector<ScorePair> added;
+        for (auto& pairs: found) {
+            added.insert(added.end(), pairs.begin(), pairs.end());
+        }
+        std::sort(added.begin(), added.end(), [](const ScorePair& lhs, const ScorePair& rhs) {
+            return lhs.row < rhs.row || (lhs.row == rhs.row && lhs.col < rhs.col);
+        });
+        stats.added = added.size();
+        return writeMergedPairs(path, header, reinterpret_cast<const ScorePair*>(records), added, rows, error);
+    }
+
+    // Neighbors: the new documents are searched in full, and each existing list is only
+    // offered the new documents which beat its last entry
+    const size_t k = header.cols;
+    const auto* old_neighbors = reinterpret_cast<const Neighbor*>(records);
+    std::vector<Neighbor> neighbors(rows * k, Neighbor{no_neighbor, 0.0f});
+    std::copy(old_neighbors, old_neighbors + old_rows * k, neighbors.begin());
+
+    scoreAddition(index.postings(), addition, [&](size_t i, const std::vector<float>& scores) {
+        const uint32_t doc = static_cast<uint32_t>(old_rows + i);
+        selectTopK(scores.data(), rows, k, doc, &neighbors[doc * k]);
+        for (uint32_t j = 0; j < old_rows; ++j)
+        {
+            const Neighbor& last = old_neighbors[j * k + k - 1];
+            if (last.doc == no_neighbor || scores[j] > last.score) {
+                found[i].push_back({j, doc, scores[j]});
+            }
+        }
+    });
+
+    std::vector<ScorePair> offers;
+    for (auto& pairs: found) {
+        offers.insert(offers.end(), pairs.begin(), pairs.end());
+    }
+    std::sort(offers.begin(), offers.end(), [](const ScorePair& lhs, const ScorePair& rhs) {
+        return lhs.row < rhs.row;
+    });
+    std::vector<Neighbor> candidates;
+    for (size_t p = 0; p < offers.size(); )
+    {
+        const uint32_t row = offers[p].row;
+        candidates.clear();
+        for (; p < offers.size() && offers[p].row == row; ++p) {
+            candidates.push_back({offers[p].col, offers[p].score});
+        }
+        mergeNeighbors(&neighbors[row * k], k, candidates);
+    }
+    stats.added = offers.size();
+
+    if (!writeNeighborFile(neighbors, rows, k, path)) {
+        error = "cannot be written";
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Add new documents to an index and to the score file of an earlier run on it.
+ *
+ * @param index_path The path of an index written by writeIndex(). It is replaced by the grown index.
+ * @param score_path The path of a score file computed from the index, or an empty string to only grow the index.
+ * @param lines The text of each new document.
+ * @param ignorecase If true, ignore case sensitivity, as when the index was built.
+ * @param stats Receives the sizes and the time of each step.
+ * @param error Receives a description of why the update failed.
+ * @return False if a file could not be read or written, or if the score file does not match the index.
+ */
+bool updateCorpus(const std::string& index_path, const std::string& score_path,
+                  const std::vector<std::string_view>& lines, bool ignorecase,
+                  UpdateStats& stats, std::string& error)
+{
+    using clock = std::chrono::steady_clock;
+
+    CorpusIndex index(index_path);
+    if (!index.isOpen()) {
+        error = index.error();
+        return false;
+    }
+
+    // The earlier result must describe exactly the documents of the index
+    std::unique_ptr<MappedFile> score_file;
+    const ScoreFileHeader* header = nullptr;
+    if (!score_path.empty())
+    {
+        score_file = std::make_unique<MappedFile>(score_path);
+        header = scoreFileHeader(*score_file, error);
+        if (header == nullptr) {
+            error = "'" + score_path + "' " + error;
+            return false;
+        }
+        if (header->format == ScoreFormat::Dense) {
+            error = "'" + score_path + "' holds the full matrix, which an update would rewrite. "
+                    "Use --threshold or --topk with --output";
+            return false;
+        }
+        if (header->rows != index.rows()) {
+            error = "'" + score_path + "' has scores of " + std::to_string(header->rows) + " documents, but the index holds "
+                    + std::to_string(index.rows());
+            return false;
+        }
+    }
+
+    stats = UpdateStats{};
+    stats.old_documents = index.rows();
+    stats.old_columns = index.cols();
+
+    auto start = clock::now();
+    const IndexAddition addition = vectorizeAddition(index, lines, ignorecase);
+    stats.new_documents = addition.matrix.rows;
+    stats.new_columns = addition.vocabulary.size();
+    std::chrono::duration<double> elapsed = clock::now() - start;
+    stats.vectorize_seconds = elapsed.count();
+
+    // The updated scores are written beside the earlier file, and only replace it once the index is written
+    const std::string score_tmp = score_path + ".tmp";
+    if (header != nullptr)
+    {
+        start = clock::now();
+        const char* records = score_file->data() + sizeof(ScoreFileHeader);
+        bool written = writeUpdatedScores(score_tmp, *header, records, index, addition, stats, error);
+        elapsed = clock::now() - start;
+        stats.score_seconds = elapsed.count();
+        if (!written) {
+            error = "'" + score_path + "' " + error;
+            std::remove(score_tmp.c_str());
+            return false;
+        }
+    }
+
+    // Existing rows and columns are unchanged, so the grown matrix is the old one with the new rows appended
+    start = clock::now();
+    const CsrView old_matrix = index.matrix();
+    CsrMatrix matrix;
+    matrix.rows = old_matrix.rows + addition.matrix.rows;
+    matrix.cols = addition.matrix.cols;
+    matrix.row_ptr.assign(old_matrix.row_ptr, old_matrix.row_ptr + old_matrix.rows + 1);
+    matrix.col_idx.assign(old_matrix.col_idx, old_matrix.col_idx + old_matrix.nonZeros());
+    matrix.values.assign(old_matrix.values, old_matrix.values + old_matrix.nonZeros());
+    const size_t offset = old_matrix.nonZeros();
+    for (size_t i = 1; i <= addition.matrix.rows; ++i) {
+        matrix.row_ptr.push_back(offset + addition.matrix.row_ptr[i]);
+    }
+    matrix.col_idx.insert(matrix.col_idx.end(), addition.matrix.col_idx.begin(), addition.matrix.col_idx.end());
+    matrix.values.insert(matrix.values.end(), addition.matrix.values.begin(), addition.matrix.values.end());
+
+    std::vector<uint64_t> vocabulary(index.vocabulary(), index.vocabulary() + index.cols());
+    vocabulary.insert(vocabulary.end(), addition.vocabulary.begin(), addition.vocabulary.end());
+    std::vector<float> norms(index.norms(), index.norms() + index.rows());
+    norms.insert(norms.end(), addition.norms.begin(), addition.norms.end());
+
+    // The mappings of the earlier files stay valid after the new files are renamed over them
+    bool written = writeIndex(index_path, index.ngramLength(), vocabulary, matrix, norms);
+    if (!written) {
+        error = "'" + index_path + "' cannot be written";
+        std::remove(score_tmp.c_str());
+        return false;
+    }
+    if (header != nullptr && std::rename(score_tmp.c_str(), score_path.c_str()) != 0) {
+        error = "'" + score_path + "' cannot be replaced";
+        std::remove(score_tmp.c_str());
+        return false;
+    }
+    elapsed = clock::now() - start;
+    stats.write_seconds = elapsed.count();
+    return true;
+}
@@ -0,0 +1,85 @@
+/******************************************************************************
+ * Filename: update.h
+ * Author: Zachary Colbert
+ * Contact: zcolbert@sfsu.edu
+ *
+ * Description: Interface of the incremental corpus update, which adds new
+ *              documents to an index and to the result of an earlier run
+ *              without recomputing the scores of the existing documents.
+ *
+ *              Only the new documents are tokenized. Their ngrams which are
+ *              not in the vocabulary are appended as new columns, so every
+ *              existing column, vector and norm is unchanged. The scores of
+ *              the new x old block are found through the postings of the
+ *              index, and those of the new x new block through the postings
+ *              of the new documents, so an update of D documents to a corpus
+ *              of N costs O(D * N) rather than O((N + D)^2).
+ *****************************************************************************/
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "index.h"
+#include "sparse.h"
+
+
+/** The vectors of documents to be added to an index. */
+struct IndexAddition
+{
+    std::vector<uint64_t> vocabulary;   // Packed ngram of each new column, numbered from the index's cols()
+    CsrMatrix matrix;                   // Row-normalized new documents x (old and new columns)
+    std::vector<float> norms;           // Length of each new row before normalization
+};
+
+/** What an update did. */
+struct UpdateStats
+{
+    size_t old_documents = 0;
+    size_t new_documents = 0;
+    size_t old_columns = 0;
+    size_t new_columns = 0;
+    uint64_t added = 0;             // Pairs or neighbours added to the score file
+    double vectorize_seconds = 0.0;
+    double score_seconds = 0.0;
+    double write_seconds = 0.0;     // Writing the grown index and score file
+};
+
+/**
+ * Tokenize new documents and vectorize them against the vocabulary of an index,
+ * appending their unseen ngrams to the vocabulary in order of first appearance.
+ *
+ * @param index The index the documents will be added to.
+ * @param lines The text of each new document.
+ * @param ignorecase If true, ignore case sensitivity, as when the index was built.
+ * @return The new columns and the normalized vectors of the new documents.
+ */
+IndexAddition vectorizeAddition(const CorpusIndex& index, const std::vector<std::string_view>& lines, bool ignorecase);
+
+/**
+ * Add new documents to an index and to the score file of an earlier run on it.
+ *
+ * The score file is updated in the format it was written in. In the Pairs format the
+ * new pairs at or above the file's threshold are merged into row order. In the
+ * Neighbors format the new documents get their own lists of the file's k neighbours,
+ * and the lists of the existing documents take in any new document which beats their
+ * last entry. The Dense format would have to be rewritten in full, so it is rejected.
+ *
+ * Both files are written to temporary paths and renamed, the score file last. Each rename
+ * is atomic, but the pair is not: if the score file cannot be replaced, the grown index
+ * is left beside the earlier score file.
+ *
+ * @param index_path The path of an index written by writeIndex(). It is replaced by the grown index.
+ * @param score_path The path of a score file computed from the index, or an empty string to only grow the index.
+ * @param lines The text of each new document.
+ * @param ignorecase If true, ignore case sensitivity, as when the index was built.
+ * @param stats Receives the sizes and the time of each step.
+ * @param error Receives a description of why the update failed.
+ * @return False if a file could not be read or written, or if the score file does not match the index.
+ */
+bool updateCorpus(const std::string& index_path, const std::string& score_path,
+                  const std::vector<std::string_view>& lines, bool ignorecase,
+                  UpdateStats& stats, std::string& error);